@@ -0,0 +1,107 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "AlignColorMap.h"
+#include "Parameters.h"
+
+// CPU reference of AlignColorMap.cu, one OpenMP task per row of the aligned color map.
+namespace BackgroundCpuNamespace {
+	const float COLOR_THRESHOLD = 50.0f;
+	const float DEPTH_THRESHOLD = 0.05f;
+};
+using namespace BackgroundCpuNamespace;
+
+void cpuAlignCamera(uchar4* alignedColor, float* depth, uchar4* color, Intrinsics depthIntrinsics, Intrinsics colorIntrinsics, Transformation depth2color) {
+	const int MAX_SHIFT = DEPTH_W >> 4;
+
+	#pragma omp parallel for
+	for (int y = 0; y < COLOR_H; y++) {
+		int2 colorPixel[COLOR_W];
+
+		for (int i = 0; i < COLOR_W; i++) {
+			float2 pixelFloat = make_float2((float)i * DEPTH_W / COLOR_W, (float)y * DEPTH_H / COLOR_H);
+			int2 pixel = make_int2((int)pixelFloat.x, (int)pixelFloat.y);
+
+			if (0 <= pixel.x && pixel.x < DEPTH_W && 0 <= pixel.y && pixel.y < DEPTH_H) {
+				float3 pos = depthIntrinsics.deproject(pixelFloat, depth[pixel.y * DEPTH_W + pixel.x]);
+				pos = depth2color.translate(pos);
+				colorPixel[i] = colorIntrinsics.translate(pos);
+			} else {
+				colorPixel[i] = make_int2(-1, -1);
+			}
+		}
+
+		for (int x = 0; x < COLOR_W; x++) {
+			uchar4 result = uchar4();
+			int2 pixel = colorPixel[x];
+
+			if (0 <= pixel.x && pixel.x < COLOR_W && 0 <= pixel.y && pixel.y < COLOR_H) {
+				result = color[pixel.y * COLOR_W + pixel.x];
+			}
+
+			for (int shift = 1; shift <= MAX_SHIFT; shift++) {
+				if (x - shift >= 0 && colorPixel[x - shift].x > pixel.x) {
+					result = uchar4();
+					break;
+				}
+			}
+
+			alignedColor[y * COLOR_W + x] = result;
+		}
+	}
+}
+
+void cpuRemoveCameraBackground(uchar4* color, float* depth, uchar4* colorBackground, float* depthBackground) {
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int x = 0; x < DEPTH_W; x++) {
+			int id = y * DEPTH_W + x;
+			if (depth[id] != 0 && depthBackground[id] != 0 && fabs(depth[id] - depthBackground[id]) < DEPTH_THRESHOLD) {
+				int cx = x * COLOR_W / DEPTH_W;
+				int cy = y * COLOR_H / DEPTH_H;
+				if (cx < COLOR_W && cy < COLOR_H) {
+					int cid = cy * COLOR_W + cx;
+					uchar4 c0 = color[cid];
+					uchar4 c1 = colorBackground[cid];
+					float colorDiff = (float)(abs(c0.x - c1.x) + abs(c0.y - c1.y) + abs(c0.z - c1.z)) / 3;
+					if (colorDiff < COLOR_THRESHOLD) {
+						depth[id] = 0;
+					}
+				}
+			}
+		}
+	}
+}
+
+extern "C"
+void cpuAlignInit(RGBQUAD*& alignedColor, float*& depthBackground, RGBQUAD*& colorBackground) {
+	alignedColor = new RGBQUAD[MAX_CAMERAS * COLOR_H * COLOR_W];
+	depthBackground = new float[MAX_CAMERAS * DEPTH_H * DEPTH_W];
+	colorBackground = new RGBQUAD[MAX_CAMERAS * COLOR_H * COLOR_W];
+	memset(alignedColor, 0, MAX_CAMERAS * COLOR_H * COLOR_W * sizeof(RGBQUAD));
+}
+
+extern "C"
+void cpuAlignClean(RGBQUAD*& alignedColor, float*& depthBackground, RGBQUAD*& colorBackground) {
+	delete[] alignedColor;
+	delete[] depthBackground;
+	delete[] colorBackground;
+}
+
+extern "C"
+void cpuAlignProcess(int cameras, bool* check, RGBQUAD* alignedColor, float* depth, RGBQUAD* color, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics, Transformation* depth2color) {
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			cpuAlignCamera((uchar4*)alignedColor + i * COLOR_H * COLOR_W, depth + i * DEPTH_H * DEPTH_W, (uchar4*)color + i * COLOR_H * COLOR_W, depthIntrinsics[i], colorIntrinsics[i], depth2color[i]);
+		}
+	}
+}
+
+extern "C"
+void cpuRemoveBackground(int cameras, bool* check, RGBQUAD* alignedColor, float* depth, RGBQUAD* colorBackground, float* depthBackground) {
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			cpuRemoveCameraBackground((uchar4*)alignedColor + i * COLOR_H * COLOR_W, depth + i * DEPTH_H * DEPTH_W, (uchar4*)colorBackground + i * COLOR_H * COLOR_W, depthBackground + i * DEPTH_H * DEPTH_W);
+		}
+	}
+}
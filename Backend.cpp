@@ -0,0 +1,59 @@
+#include "Backend.h"
+#include <string.h>
+#include <stdlib.h>
+
+bool Backend::cpu = false;
+
+bool Backend::hasCudaDevice()
+{
+	int count = 0;
+	return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+}
+
+void Backend::copy(void* dst, const void* src, size_t size, cudaMemcpyKind kind)
+{
+	if (cpu) {
+		memcpy(dst, src, size);
+	} else {
+		HANDLE_ERROR(cudaMemcpy(dst, src, size, kind));
+	}
+}
+
+void* Backend::allocHost(size_t size)
+{
+	void* ptr = NULL;
+	if (cpu) {
+		ptr = malloc(size);
+	} else {
+		HANDLE_ERROR(cudaHostAlloc(&ptr, size, cudaHostAllocDefault));
+	}
+	return ptr;
+}
+
+void Backend::freeHost(void* ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+	if (cpu) {
+		free(ptr);
+	} else {
+		HANDLE_ERROR(cudaFreeHost(ptr));
+	}
+}
+
+void Backend::copyAsync(void* dst, const void* src, size_t size, cudaMemcpyKind kind)
+{
+	if (cpu) {
+		memcpy(dst, src, size);
+	} else {
+		HANDLE_ERROR(cudaMemcpyAsync(dst, src, size, kind));
+	}
+}
+
+void Backend::synchronize()
+{
+	if (!cpu) {
+		HANDLE_ERROR(cudaDeviceSynchronize());
+	}
+}
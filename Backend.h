@@ -0,0 +1,24 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "CudaHandleError.h"
+
+// Selects whether the pipeline runs on the GPU or on the CPU reference backend.
+// The buffers passed between the stages live in the memory of the selected backend,
+// so code outside the filters copies them with Backend::copy instead of cudaMemcpy.
+class Backend {
+private:
+	static bool cpu;
+public:
+	static void useCpu(bool cpu) { Backend::cpu = cpu; }
+	static bool isCpu() { return cpu; }
+	static bool hasCudaDevice();
+	static void copy(void* dst, const void* src, size_t size, cudaMemcpyKind kind);
+	// Host memory is page-locked on the GPU backend, copyAsync from it runs as DMA until synchronize
+	static void* allocHost(size_t size);
+	static void freeHost(void* ptr);
+	static void copyAsync(void* dst, const void* src, size_t size, cudaMemcpyKind kind);
+	static void synchronize();
+};
+
+#endif
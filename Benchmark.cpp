@@ -0,0 +1,363 @@
+#include "Benchmark.h"
+#include "TsdfVolume.h"
+#include "DepthFilter.h"
+#include "ColorFilter.h"
+#include "AlignColorMap.h"
+#include "DepthMedian.h"
+#include "Backend.h"
+#include "Timer.h"
+#include <iostream>
+#include <cmath>
+#include <string.h>
+
+extern "C" void cudaBenchmarkIntegrate(int cameras, float* depth_device, Transformation* world2depth, Intrinsics* depthIntrinsics, int iterations, float& columnTime, float& tileTime, int& mismatches);
+extern "C" void cudaBenchmarkDepthFilter(UINT16* depthMap, float convertFactor, const FilterStage* stages, int iterations, int* launches, float* kernelTime, double* kernelBytes, int& mismatches);
+
+// A sphere of 0.5 m at the origin, seen by cameras on a ring of 1.5 m looking at the center.
+void Benchmark::createScene(int cameras, float* depth, Transformation* world2depth, Intrinsics* depthIntrinsics)
+{
+	const double PI = acos(-1.0);
+	const float RADIUS = 0.5f;
+	const float DISTANCE = 1.5f;
+
+	for (int i = 0; i < cameras; i++) {
+		double theta = 2 * PI * i / cameras;
+		double rotation[9] = { cos(theta), 0, sin(theta), 0, 1, 0, -sin(theta), 0, cos(theta) };
+		double translation[3] = { 0, 0, DISTANCE };
+		world2depth[i] = Transformation(rotation, translation);
+
+		depthIntrinsics[i].fx = 600;
+		depthIntrinsics[i].fy = 600;
+		depthIntrinsics[i].ppx = DEPTH_W * 0.5f;
+		depthIntrinsics[i].ppy = DEPTH_H * 0.5f;
+
+		for (int y = 0; y < DEPTH_H; y++) {
+			for (int x = 0; x < DEPTH_W; x++) {
+				float dx = (x + 0.5f - depthIntrinsics[i].ppx) / depthIntrinsics[i].fx;
+				float dy = (y + 0.5f - depthIntrinsics[i].ppy) / depthIntrinsics[i].fy;
+				float a = dx * dx + dy * dy + 1;
+				float b = -2 * DISTANCE;
+				float c = DISTANCE * DISTANCE - RADIUS * RADIUS;
+				float delta = b * b - 4 * a * c;
+				depth[(i * DEPTH_H + y) * DEPTH_W + x] = (delta >= 0) ? (-b - sqrt(delta)) / (2 * a) : 0;
+			}
+		}
+	}
+}
+
+void Benchmark::run()
+{
+	if (Backend::hasCudaDevice()) {
+		integrate();
+		depthFilter();
+	}
+	pipeline();
+}
+
+void Benchmark::integrate()
+{
+#ifdef SPARSE_VOLUME
+	std::cout << "integrate: skipped, the dense integration is not used with SPARSE_VOLUME" << std::endl;
+#else
+	const int ITERATIONS = 20;
+	const int CAMERAS[3] = { 1, 4, 8 };
+
+	TsdfVolume volume(2, 2, 2, 0, 0, 0);
+	float* depth = new float[MAX_CAMERAS * DEPTH_H * DEPTH_W];
+	float* depth_device;
+	Transformation world2depth[MAX_CAMERAS];
+	Intrinsics depthIntrinsics[MAX_CAMERAS];
+	HANDLE_ERROR(cudaMalloc(&depth_device, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(float)));
+
+	for (int i = 0; i < 3; i++) {
+		int cameras = CAMERAS[i];
+		createScene(cameras, depth, world2depth, depthIntrinsics);
+		HANDLE_ERROR(cudaMemcpy(depth_device, depth, cameras * DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyHostToDevice));
+
+		float columnTime, tileTime;
+		int mismatches;
+		cudaBenchmarkIntegrate(cameras, depth_device, world2depth, depthIntrinsics, ITERATIONS, columnTime, tileTime, mismatches);
+		std::cout << "integrate: " << cameras << " cameras, column " << columnTime << " ms, z-tile " << tileTime << " ms, speedup " << columnTime / tileTime << "x, mismatched voxels " << mismatches << std::endl;
+	}
+
+	HANDLE_ERROR(cudaFree(depth_device));
+	delete[] depth;
+#endif
+}
+
+// Per kernel time and estimated memory traffic of the depth filter, as a chain of kernels and as the fused kernel.
+void Benchmark::depthFilter()
+{
+	const int ITERATIONS = 100;
+	const int KERNELS = 7;
+	const char* NAMES[KERNELS] = { "to disparity", "spatial vertical", "spatial horizontal", "fill holes", "temporal", "to depth", "fused" };
+
+	float* sceneDepth = new float[DEPTH_H * DEPTH_W];
+	UINT16* depthMap = new UINT16[DEPTH_H * DEPTH_W];
+	Transformation world2depth;
+	Intrinsics depthIntrinsics;
+	createScene(1, sceneDepth, &world2depth, &depthIntrinsics);
+	// Scattered holes so that the median and the hole filling have work to do
+	for (int i = 0; i < DEPTH_H * DEPTH_W; i++) {
+		depthMap[i] = (i % 7 == 0) ? 0 : (UINT16)(sceneDepth[i] * 1000);
+	}
+
+	int launches[KERNELS];
+	float kernelTime[KERNELS];
+	double kernelBytes[KERNELS];
+	int mismatches;
+	FilterStage stages[3] = { DepthFilter::getDefaultStage(DepthFilter::STAGE_SPATIAL), DepthFilter::getDefaultStage(DepthFilter::STAGE_FILL_HOLES), DepthFilter::getDefaultStage(DepthFilter::STAGE_TEMPORAL) };
+	cudaBenchmarkDepthFilter(depthMap, depthIntrinsics.fx * 50 * (1 << 5), stages, ITERATIONS, launches, kernelTime, kernelBytes, mismatches);
+
+	float chainTime = 0;
+	double chainBytes = 0;
+	for (int k = 0; k < KERNELS; k++) {
+		std::cout << "depth filter: " << NAMES[k] << ", " << launches[k] << " launches, " << kernelTime[k] << " ms, " << kernelBytes[k] / 1e6 << " MB" << std::endl;
+		if (k < KERNELS - 1) {
+			chainTime += kernelTime[k];
+			chainBytes += kernelBytes[k];
+		}
+	}
+	float fusedTime = kernelTime[KERNELS - 1];
+	double fusedBytes = kernelBytes[KERNELS - 1];
+	std::cout << "depth filter: chain " << chainTime << " ms " << chainBytes / 1e6 << " MB, fused " << fusedTime << " ms " << fusedBytes / 1e6 << " MB, saved "
+		<< (chainBytes - fusedBytes) / 1e6 << " MB per frame, speedup " << chainTime / fusedTime << "x, mismatched pixels " << mismatches << std::endl;
+
+	// Every camera on its own against all cameras in one upload and one launch per kernel
+	bool cpu = Backend::isCpu();
+	Backend::useCpu(false);
+	{
+		DepthFilter filter;
+		UINT16* depthMaps[MAX_CAMERAS];
+		bool check[MAX_CAMERAS];
+		for (int i = 0; i < MAX_CAMERAS; i++) {
+			depthMaps[i] = depthMap;
+			check[i] = true;
+			filter.setConvertFactor(i, depthIntrinsics.fx * 50 * (1 << 5));
+		}
+		Timer timer;
+		timer.reset();
+		for (int k = 0; k < ITERATIONS; k++) {
+			for (int i = 0; i < MAX_CAMERAS; i++) {
+				filter.process(i, depthMaps[i]);
+			}
+			Backend::synchronize();
+		}
+		float cameraTime = timer.getTime() * 1000 / ITERATIONS;
+		timer.reset();
+		for (int k = 0; k < ITERATIONS; k++) {
+			filter.process(MAX_CAMERAS, check, depthMaps);
+			Backend::synchronize();
+		}
+		float batchTime = timer.getTime() * 1000 / ITERATIONS;
+		std::cout << "depth filter: " << MAX_CAMERAS << " cameras, per camera " << cameraTime << " ms, batched " << batchTime << " ms" << std::endl;
+
+		const char* STAGES[3] = { "spatial", "fill holes", "temporal" };
+		FilterStage filterStages[DepthFilter::MAX_STAGES];
+		float stageTimes[DepthFilter::MAX_STAGES + 2];
+		filter.getStages(filterStages);
+		filter.setProfiling(true);
+		filter.process(MAX_CAMERAS, check, depthMaps);
+		int count = filter.getStageTimes(stageTimes);
+		std::cout << "depth filter: " << MAX_CAMERAS << " cameras by stage, to disparity " << stageTimes[0] << " ms";
+		for (int s = 1; s < count - 1; s++) {
+			std::cout << ", " << STAGES[filterStages[s - 1].type] << " " << stageTimes[s] << " ms";
+		}
+		std::cout << ", to depth " << stageTimes[count - 1] << " ms" << std::endl;
+		filter.setProfiling(false);
+
+		// The guided filter with a color that is bright on the sphere, its time grows with (32 + 2 * radius) / 32
+		const int RADII[4] = { 2, 4, 8, DepthFilter::MAX_GUIDE_RADIUS };
+		ColorFilter colorFilter;
+		UINT8* colorMap = new UINT8[2 * COLOR_H * COLOR_W];
+		for (int y = 0; y < COLOR_H; y++) {
+			for (int x = 0; x < COLOR_W; x++) {
+				int id = y * COLOR_W + x;
+				colorMap[id * 2] = (sceneDepth[(y * DEPTH_H / COLOR_H) * DEPTH_W + x * DEPTH_W / COLOR_W] != 0) ? 200 : 40;
+				colorMap[id * 2 + 1] = 128;
+			}
+		}
+		for (int i = 0; i < MAX_CAMERAS; i++) {
+			colorFilter.process(i, colorMap);
+		}
+		std::cout << "depth filter: " << MAX_CAMERAS << " cameras guided";
+		for (int r = 0; r < 4; r++) {
+			filter.setGuide(true, RADII[r], 0.001f);
+			filter.process(MAX_CAMERAS, check, depthMaps);
+			Backend::synchronize();
+			timer.reset();
+			for (int k = 0; k < ITERATIONS; k++) {
+				filter.guide(MAX_CAMERAS, check, colorFilter.getCurrFrame_device());
+			}
+			Backend::synchronize();
+			std::cout << (r == 0 ? ", radius " : ", ") << RADII[r] << " " << timer.getTime() * 1000 / ITERATIONS << " ms";
+		}
+		std::cout << std::endl;
+		delete[] colorMap;
+		filter.setGuide(false, RADII[0], 0.001f);
+
+		// The median of the capture threads on every instruction set against kernelFilterToDisparity, which also
+		// converts to disparity. Without stages the depth must come out the same either way, except where the kernel
+		// divides by the mean of two middle depths with an odd sum, which the capture median rounds up by half a unit.
+		UINT16* reference = new UINT16[DEPTH_H * DEPTH_W];
+		UINT16* prefiltered = new UINT16[DEPTH_H * DEPTH_W];
+		float* results[2] = { new float[DEPTH_H * DEPTH_W], new float[DEPTH_H * DEPTH_W] };
+		DepthMedian::filter(DepthMedian::MEDIAN_SCALAR, depthMap, reference);
+		std::cout << "depth median: kernel " << kernelTime[0] << " ms";
+		for (int set = DepthMedian::MEDIAN_SCALAR; set <= DepthMedian::getInstructionSet(); set++) {
+			timer.reset();
+			for (int k = 0; k < ITERATIONS; k++) {
+				DepthMedian::filter(set, depthMap, prefiltered);
+			}
+			std::cout << ", " << DepthMedian::getName(set) << " " << timer.getTime() * 1000 / ITERATIONS << " ms";
+			if (memcmp(prefiltered, reference, DEPTH_H * DEPTH_W * sizeof(UINT16)) != 0) {
+				std::cout << " (differs from scalar)";
+			}
+		}
+		std::cout << std::endl;
+
+		for (int i = 0; i < 2; i++) {
+			filter.setStages(0, NULL);
+			filter.setMedianOnCapture(i == 1);
+			filter.process(0, (i == 1) ? prefiltered : depthMap);
+			Backend::copy(results[i], filter.getCurrFrame_device(), DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyDeviceToHost);
+		}
+		filter.setMedianOnCapture(false);
+		filter.resetStages();
+		int medianMismatches = 0;
+		float medianError = 0;
+		for (int i = 0; i < DEPTH_H * DEPTH_W; i++) {
+			if (memcmp(results[0] + i, results[1] + i, sizeof(float)) != 0) {
+				medianMismatches++;
+				medianError = max(medianError, fabs(results[0][i] - results[1][i]));
+			}
+		}
+		std::cout << "depth median: on capture against the kernel, mismatched pixels " << medianMismatches << ", largest difference " << medianError * 1000 << " mm" << std::endl;
+		delete[] reference;
+		delete[] prefiltered;
+		delete[] results[0];
+		delete[] results[1];
+	}
+	Backend::useCpu(cpu);
+
+	delete[] sceneDepth;
+	delete[] depthMap;
+}
+
+// Runs every stage once on the selected backend and copies the results back to the host.
+void Benchmark::runPipeline(int cameras, UINT16* depthMap, UINT8* colorMap, Transformation* world2depth, Intrinsics* depthIntrinsics, byte* mesh, float* depth, RGBQUAD* color, float stageTime[4])
+{
+	DepthFilter depthFilter;
+	ColorFilter colorFilter;
+	AlignColorMap alignColorMap;
+	TsdfVolume volume(2, 2, 2, 0, 0, 0);
+	bool check[MAX_CAMERAS];
+	UINT16* depthMaps[MAX_CAMERAS];
+	Transformation depth2color[MAX_CAMERAS];
+	Timer timer;
+
+	for (int i = 0; i < cameras; i++) {
+		check[i] = true;
+		depth2color[i].setIdentity();
+		depthFilter.setConvertFactor(i, depthIntrinsics[i].fx * 50 * (1 << 5));
+		depthMaps[i] = depthMap + i * DEPTH_H * DEPTH_W;
+	}
+
+	timer.reset();
+	depthFilter.process(cameras, check, depthMaps);
+	Backend::synchronize();
+	stageTime[0] = timer.getTime() * 1000;
+
+	timer.reset();
+	for (int i = 0; i < cameras; i++) {
+		colorFilter.process(i, colorMap);
+	}
+	Backend::synchronize();
+	stageTime[1] = timer.getTime() * 1000;
+
+	timer.reset();
+	RGBQUAD* aligned = alignColorMap.getAlignedColor_device(cameras, check, depthFilter.getCurrFrame_device(), colorFilter.getCurrFrame_device(), depthIntrinsics, depthIntrinsics, depth2color);
+	depthFilter.guide(cameras, check, aligned);
+	Backend::synchronize();
+	stageTime[2] = timer.getTime() * 1000;
+
+	timer.reset();
+	volume.integrate(mesh, cameras, cameras, depthFilter.getCurrFrame_device(), aligned, world2depth, depthIntrinsics, depthIntrinsics);
+	stageTime[3] = timer.getTime() * 1000;
+
+	Backend::copy(depth, depthFilter.getCurrFrame_device(), cameras * DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyDeviceToHost);
+	Backend::copy(color, aligned, cameras * COLOR_H * COLOR_W * sizeof(RGBQUAD), cudaMemcpyDeviceToHost);
+}
+
+// Per stage time of the CPU backend, and of the GPU with the difference of the results when a device exists.
+void Benchmark::pipeline()
+{
+	const int CAMERAS = 4;
+	const char* STAGES[4] = { "depth filter", "color filter", "align", "integrate" };
+
+	float* sceneDepth = new float[MAX_CAMERAS * DEPTH_H * DEPTH_W];
+	UINT16* depthMap = new UINT16[MAX_CAMERAS * DEPTH_H * DEPTH_W];
+	UINT8* colorMap = new UINT8[2 * COLOR_H * COLOR_W];
+	Transformation world2depth[MAX_CAMERAS];
+	Intrinsics depthIntrinsics[MAX_CAMERAS];
+	createScene(CAMERAS, sceneDepth, world2depth, depthIntrinsics);
+	for (int i = 0; i < CAMERAS * DEPTH_H * DEPTH_W; i++) {
+		depthMap[i] = (UINT16)(sceneDepth[i] * 1000);
+	}
+	for (int i = 0; i < 2 * COLOR_H * COLOR_W; i++) {
+		colorMap[i] = (i & 1) ? 128 : (UINT8)(i / 2 % COLOR_W * 255 / COLOR_W);
+	}
+
+	bool gpu = Backend::hasCudaDevice();
+	bool cpu = Backend::isCpu();
+	byte* mesh[2];
+	float* depth[2];
+	RGBQUAD* color[2];
+	float stageTime[2][4];
+	for (int b = 0; b < 2; b++) {
+		mesh[b] = new byte[MESH_BUFFER_SIZE];
+		depth[b] = new float[CAMERAS * DEPTH_H * DEPTH_W];
+		color[b] = new RGBQUAD[CAMERAS * COLOR_H * COLOR_W];
+		if (b == 1 || gpu) {
+			Backend::useCpu(b == 1);
+			runPipeline(CAMERAS, depthMap, colorMap, world2depth, depthIntrinsics, mesh[b], depth[b], color[b], stageTime[b]);
+		}
+	}
+	Backend::useCpu(cpu);
+
+	for (int s = 0; s < 4; s++) {
+		std::cout << "pipeline: " << STAGES[s] << ", cpu " << stageTime[1][s] << " ms";
+		if (gpu) {
+			std::cout << ", gpu " << stageTime[0][s] << " ms";
+		}
+		std::cout << std::endl;
+	}
+
+	if (gpu) {
+		float depthError = 0;
+		int colorMismatches = 0;
+		for (int i = 0; i < CAMERAS * DEPTH_H * DEPTH_W; i++) {
+			depthError = max(depthError, fabs(depth[0][i] - depth[1][i]));
+		}
+		for (int i = 0; i < CAMERAS * COLOR_H * COLOR_W; i++) {
+			if (memcmp(&color[0][i], &color[1][i], sizeof(RGBQUAD)) != 0) {
+				colorMismatches++;
+			}
+		}
+#ifdef INDEXED_MESH
+		int triangles[2] = { *((int*)(mesh[0] + 4)), *((int*)(mesh[1] + 4)) };
+#else
+		int triangles[2] = { *((int*)mesh[0]), *((int*)mesh[1]) };
+#endif
+		std::cout << "pipeline: max depth error " << depthError << " m, mismatched color pixels " << colorMismatches << ", triangles gpu " << triangles[0] << " cpu " << triangles[1] << std::endl;
+	}
+
+	for (int b = 0; b < 2; b++) {
+		delete[] mesh[b];
+		delete[] depth[b];
+		delete[] color[b];
+	}
+	delete[] sceneDepth;
+	delete[] depthMap;
+	delete[] colorMap;
+}
@@ -0,0 +1,18 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "Parameters.h"
+#include "TsdfVolume.cuh"
+
+class Benchmark {
+private:
+	static void createScene(int cameras, float* depth, Transformation* world2depth, Intrinsics* depthIntrinsics);
+	static void runPipeline(int cameras, UINT16* depthMap, UINT8* colorMap, Transformation* world2depth, Intrinsics* depthIntrinsics, byte* mesh, float* depth, RGBQUAD* color, float stageTime[4]);
+public:
+	static void run();
+	static void integrate();
+	static void depthFilter();
+	static void pipeline();
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "ColorCodec.h"
+
+// Planes: Y of every pixel, then Cb and Cr of every 2x1 (YUV422) or 2x2 (YUV420) block
+namespace ColorCodecNamespace {
+	inline BYTE clamp255(int v) {
+		return (BYTE)(v < 0 ? 0 : (v > 255 ? 255 : v));
+	}
+
+	inline bool isBlack(BYTE* p) {
+		return p[0] == 0 && p[1] == 0 && p[2] == 0;
+	}
+
+	// Fixed point BT.601 full range with 16 fractional bits
+	inline int luma(BYTE* p) {
+		return (19595 * p[0] + 38470 * p[1] + 7471 * p[2] + 32768) >> 16;
+	}
+}
+using namespace ColorCodecNamespace;
+
+int ColorCodec::encode(int mode, int width, int height, RGBQUAD* color, BYTE* data)
+{
+	if (mode == COLOR_RAW) {
+		memcpy(data, color, width * height * sizeof(RGBQUAD));
+		return width * height * sizeof(RGBQUAD);
+	}
+
+	const int BLOCK_H = (mode == COLOR_YUV420) ? 2 : 1;
+	const int CHROMA_W = width / 2;
+	const int CHROMA_H = height / BLOCK_H;
+	BYTE* pixels = (BYTE*)color;
+	BYTE* Y = data;
+	BYTE* Cb = Y + width * height;
+	BYTE* Cr = Cb + CHROMA_W * CHROMA_H;
+
+	#pragma omp parallel for
+	for (int cy = 0; cy < CHROMA_H; cy++) {
+		for (int cx = 0; cx < CHROMA_W; cx++) {
+			int sumR = 0, sumG = 0, sumB = 0, cnt = 0;
+			for (int dy = 0; dy < BLOCK_H; dy++) {
+				for (int dx = 0; dx < 2; dx++) {
+					int id = (cy * BLOCK_H + dy) * width + cx * 2 + dx;
+					BYTE* p = pixels + id * 4;
+					int y = luma(p);
+					// Real colors that round to luma 0 would decode as missing
+					Y[id] = (y == 0 && !isBlack(p)) ? 1 : y;
+					if (!isBlack(p)) {
+						sumR += p[0];
+						sumG += p[1];
+						sumB += p[2];
+						cnt++;
+					}
+				}
+			}
+			int cid = cy * CHROMA_W + cx;
+			if (cnt == 0) {
+				Cb[cid] = 128;
+				Cr[cid] = 128;
+			} else {
+				int r = sumR / cnt, g = sumG / cnt, b = sumB / cnt;
+				Cb[cid] = clamp255(128 + ((-11056 * r - 21712 * g + 32768 * b + 32768) >> 16));
+				Cr[cid] = clamp255(128 + ((32768 * r - 27440 * g - 5328 * b + 32768) >> 16));
+			}
+		}
+	}
+
+	return width * height + 2 * CHROMA_W * CHROMA_H;
+}
+
+int ColorCodec::decode(int mode, int width, int height, BYTE* data, int size, RGBQUAD* color)
+{
+	if (mode == COLOR_RAW) {
+		if (size != (int)(width * height * sizeof(RGBQUAD))) {
+			return -1;
+		}
+		memcpy(color, data, width * height * sizeof(RGBQUAD));
+		return width * height * sizeof(RGBQUAD);
+	}
+	if (mode != COLOR_YUV422 && mode != COLOR_YUV420) {
+		return -1;
+	}
+
+	const int BLOCK_H = (mode == COLOR_YUV420) ? 2 : 1;
+	const int CHROMA_W = width / 2;
+	const int CHROMA_H = height / BLOCK_H;
+	if (size != width * height + 2 * CHROMA_W * CHROMA_H) {
+		return -1;
+	}
+	BYTE* pixels = (BYTE*)color;
+	BYTE* Y = data;
+	BYTE* Cb = Y + width * height;
+	BYTE* Cr = Cb + CHROMA_W * CHROMA_H;
+
+	#pragma omp parallel for
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int id = y * width + x;
+			int cid = (y / BLOCK_H) * CHROMA_W + x / 2;
+			BYTE* p = pixels + id * 4;
+			int l = Y[id];
+			if (l == 0) {
+				p[0] = p[1] = p[2] = 0;
+			} else {
+				int cb = Cb[cid] - 128;
+				int cr = Cr[cid] - 128;
+				p[0] = clamp255(l + ((91881 * cr + 32768) >> 16));
+				p[1] = clamp255(l - ((22554 * cb + 46802 * cr + 32768) >> 16));
+				p[2] = clamp255(l + ((116130 * cb + 32768) >> 16));
+			}
+			p[3] = 0;
+		}
+	}
+
+	return width * height + 2 * CHROMA_W * CHROMA_H;
+}
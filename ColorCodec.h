@@ -0,0 +1,22 @@
+#ifndef COLOR_CODEC_H
+#define COLOR_CODEC_H
+
+#include <Windows.h>
+#include "Parameters.h"
+
+// Aligned color maps (R, G, B, 0 per pixel) as full range YCbCr with subsampled chroma. Black pixels mark
+// missing color for the colorization, so they are left out of the chroma averages and decoded as exact black.
+class ColorCodec {
+public:
+	enum Mode { COLOR_RAW = 0, COLOR_YUV422 = 1, COLOR_YUV420 = 2 };
+	static const int MAX_ENCODED_SIZE = COLOR_W * COLOR_H * sizeof(RGBQUAD);
+	// encode returns the number of bytes written to data. decode reads the size bytes of data and returns -1 when the
+	// mode is unknown or size is not the size of the image in it. The chroma blocks need an even width, and an even
+	// height for COLOR_YUV420.
+	static int encode(int mode, RGBQUAD* color, BYTE* data) { return encode(mode, COLOR_W, COLOR_H, color, data); }
+	static int decode(int mode, BYTE* data, int size, RGBQUAD* color) { return decode(mode, COLOR_W, COLOR_H, data, size, color); }
+	static int encode(int mode, int width, int height, RGBQUAD* color, BYTE* data);
+	static int decode(int mode, int width, int height, BYTE* data, int size, RGBQUAD* color);
+};
+
+#endif
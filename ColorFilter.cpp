@@ -1,21 +1,37 @@
 #include <iostream>
 #include "ColorFilter.h"
+#include "Backend.h"
 
 extern "C" void cudaColorFiltering(UINT8* colorMap, UINT8* source_device, RGBQUAD* color_device);
 extern "C" void cudaColorFilterInit(UINT8*& source_device, RGBQUAD*& color_device);
 extern "C" void cudaColorFilterClean(UINT8*& source_device, RGBQUAD*& color_device);
+extern "C" void cpuColorFiltering(UINT8* colorMap, UINT8* data, RGBQUAD* color);
+extern "C" void cpuColorFilterInit(UINT8*& data, RGBQUAD*& color);
+extern "C" void cpuColorFilterClean(UINT8*& data, RGBQUAD*& color);
 
 ColorFilter::ColorFilter()
 {
-	cudaColorFilterInit(data_device, color_device);
+	if (Backend::isCpu()) {
+		cpuColorFilterInit(data_device, color_device);
+	} else {
+		cudaColorFilterInit(data_device, color_device);
+	}
 }
 
 ColorFilter::~ColorFilter()
 {
-	cudaColorFilterClean(data_device, color_device);
+	if (Backend::isCpu()) {
+		cpuColorFilterClean(data_device, color_device);
+	} else {
+		cudaColorFilterClean(data_device, color_device);
+	}
 }
 
 void ColorFilter::process(int cameraId, UINT8* colorMap)
 {
-	cudaColorFiltering(colorMap, data_device, color_device + cameraId * COLOR_H * COLOR_W);
+	if (Backend::isCpu()) {
+		cpuColorFiltering(colorMap, data_device, color_device + cameraId * COLOR_H * COLOR_W);
+	} else {
+		cudaColorFiltering(colorMap, data_device, color_device + cameraId * COLOR_H * COLOR_W);
+	}
 }
@@ -0,0 +1,45 @@
+#include <Windows.h>
+#include <string.h>
+#include "Parameters.h"
+
+// CPU reference of ColorFilter.cu, converts YUYV to RGB with the same fixed point arithmetic.
+extern "C"
+void cpuColorFilterInit(UINT8*& data, RGBQUAD*& color) {
+	data = new UINT8[2 * COLOR_H * COLOR_W];
+	color = new RGBQUAD[MAX_CAMERAS * COLOR_H * COLOR_W];
+	memset(color, 0, MAX_CAMERAS * COLOR_H * COLOR_W * sizeof(RGBQUAD));
+}
+
+extern "C"
+void cpuColorFilterClean(UINT8*& data, RGBQUAD*& color) {
+	delete[] data;
+	delete[] color;
+}
+
+extern "C"
+void cpuColorFiltering(UINT8* colorMap, UINT8* data, RGBQUAD* color) {
+	memcpy(data, colorMap, 2 * COLOR_H * COLOR_W * sizeof(UINT8));
+	UINT8* target = (UINT8*)color;
+
+	// Two pixels share one U and V sample
+	#pragma omp parallel for
+	for (int y = 0; y < COLOR_H; y++) {
+		for (int x = 0; x < COLOR_W; x++) {
+			int id = y * COLOR_W + x;
+			INT16 Y = data[id * 2];
+			INT16 U = data[(id - (id & 1)) * 2 + 1];
+			INT16 V = data[(id - (id & 1)) * 2 + 3];
+			INT16 C = Y - 16;
+			INT16 D = U - 128;
+			INT16 E = V - 128;
+			INT16 R = (298 * C + 409 * E + 128) >> 8;
+			INT16 G = (298 * C - 100 * D - 208 * E + 128) >> 8;
+			INT16 B = (298 * C + 516 * D + 128) >> 8;
+
+			target[id * 4 + 0] = max(0, min(255, (int)INT16(R * 1.358)));
+			target[id * 4 + 1] = max(0, min(255, (int)INT16(G * 1.160)));
+			target[id * 4 + 2] = max(0, min(255, (int)INT16(B * 1.000)));
+			target[id * 4 + 3] = 0;
+		}
+	}
+}
@@ -1,9 +1,23 @@
 #include "Configuration.h"
+#include "Backend.h"
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
 
+namespace ConfigurationNamespace {
+	// Keeps the value when the line has no more words
+	template <typename T>
+	void readValue(std::istream& words, T& value) {
+		T read;
+		if (words >> read) {
+			value = read;
+		}
+	}
+}
+using namespace ConfigurationNamespace;
+
 void Configuration::saveExtrinsics(Transformation* transformation)
 {
 	const char* EXTRINSICS_FILE = "Extrinsics.cfg";
@@ -118,16 +132,18 @@ void Configuration::loadBackground(AlignColorMap* alignColorMap)
 	file.close();
 }
 
-int Configuration::loadDelayFrame()
+int Configuration::loadDelayFrame(bool& adaptive)
 {
 	const char* DELAY_FILE = "Delay.cfg";
 	std::fstream file;
 	file.open(DELAY_FILE, std::ios::in);
 
+	// Delay in frames, then 0 to keep it fixed or 1 to adapt it to the network jitter starting from there
 	int result = 1;
+	int mode = 1;
 	if (file) {
 		FILE* fin = fopen(DELAY_FILE, "r");
-		fscanf(fin, "%d", &result);
+		fscanf(fin, "%d %d", &result, &mode);
 		if (result <= 0 || result >= MAX_DELAY_FRAME) {
 			result = 1;
 		}
@@ -135,5 +151,214 @@ int Configuration::loadDelayFrame()
 	}
 	file.close();
 
+	adaptive = (mode != 0);
 	return result;
 }
+
+StreamFormat Configuration::loadStreamFormat()
+{
+	const char* STREAM_FILE = "Stream.cfg";
+	std::fstream file;
+	file.open(STREAM_FILE, std::ios::in);
+
+	// Depth codec, the error of DEPTH_LOSSY in mm, the color codec, mesh mode, mesh delta frames and region of interest cropping.
+	// Delta frames are off by default, the volume compacts its vertices with atomics so their order changes between frames.
+	StreamFormat format;
+	format.depthCodec = DepthCodec::DEPTH_LOSSLESS;
+	format.colorCodec = ColorCodec::COLOR_YUV420;
+	format.mesh = 0;
+	format.meshDelta = 0;
+	format.roi = 1;
+	float depthError = 1;
+	if (file) {
+		FILE* fin = fopen(STREAM_FILE, "r");
+		fscanf(fin, "%d %f %d %d %d %d", &format.depthCodec, &depthError, &format.colorCodec, &format.mesh, &format.meshDelta, &format.roi);
+		if (format.depthCodec < DepthCodec::DEPTH_RAW || format.depthCodec > DepthCodec::DEPTH_LOSSY) {
+			format.depthCodec = DepthCodec::DEPTH_LOSSLESS;
+		}
+		if (format.colorCodec < ColorCodec::COLOR_RAW || format.colorCodec > ColorCodec::COLOR_YUV420) {
+			format.colorCodec = ColorCodec::COLOR_YUV420;
+		}
+		fclose(fin);
+	}
+	file.close();
+
+	format.depthError = max(0, (int)(depthError * 0.001f / DEPTH_CODEC_UNIT));
+	return format;
+}
+
+void Configuration::loadTemporalFusion(TsdfVolume* volume)
+{
+	const char* FUSION_FILE = "Fusion.cfg";
+	std::fstream file;
+	file.open(FUSION_FILE, std::ios::in);
+
+	int enable = 0;
+	float maxWeight = 16;
+	float decay = 0.9f;
+	if (file) {
+		FILE* fin = fopen(FUSION_FILE, "r");
+		fscanf(fin, "%d %f %f", &enable, &maxWeight, &decay);
+		if (maxWeight < 1) {
+			maxWeight = 1;
+		}
+		if (decay <= 0 || decay > 1) {
+			decay = 0.9f;
+		}
+		fclose(fin);
+	}
+	file.close();
+
+	volume->setTemporalFusion(enable != 0, maxWeight, decay);
+}
+
+void Configuration::loadBackend()
+{
+	const char* BACKEND_FILE = "Backend.cfg";
+	std::fstream file;
+	file.open(BACKEND_FILE, std::ios::in);
+
+	int cpu = 0;
+	if (file) {
+		FILE* fin = fopen(BACKEND_FILE, "r");
+		fscanf(fin, "%d", &cpu);
+		fclose(fin);
+	}
+	file.close();
+
+	if (cpu == 0 && !Backend::hasCudaDevice()) {
+		std::cout << "No CUDA device, using the CPU backend." << std::endl;
+		cpu = 1;
+	}
+	Backend::useCpu(cpu != 0);
+}
+
+bool Configuration::loadReplay(std::string& file, bool& realTime)
+{
+	const char* REPLAY_FILE = "Replay.cfg";
+	std::ifstream fin(REPLAY_FILE);
+
+	int mode = 1;
+	bool result = false;
+	if (fin >> file) {
+		if (fin >> mode) {
+			realTime = (mode != 0);
+		} else {
+			realTime = true;
+		}
+		result = true;
+	}
+	fin.close();
+
+	return result;
+}
+
+bool Configuration::loadRecord(std::string& file)
+{
+	const char* RECORD_FILE = "Record.cfg";
+	std::ifstream fin(RECORD_FILE);
+
+	bool result = false;
+	if (fin >> file) {
+		result = true;
+	}
+	fin.close();
+
+	return result;
+}
+
+void Configuration::loadPeers(std::vector<PeerAddress>& peers)
+{
+	const char* PEER_FILE = "Peer.cfg";
+	std::ifstream fin(PEER_FILE);
+
+	// One line per remote site: the address to listen on or to connect to, its port and whether this side listens.
+	// Every pair of sites needs its own port. 127.0.0.1 runs several sites on one machine.
+	peers.clear();
+	PeerAddress peer;
+	std::string line;
+	while (std::getline(fin, line)) {
+		std::istringstream words(line);
+		if (words >> peer.ip) {
+			peer.port = PEER_PORT;
+			peer.isServer = IS_SERVER;
+			int value = 0;
+			if (words >> value) {
+				peer.port = value;
+			}
+			if (words >> value) {
+				peer.isServer = (value != 0);
+			}
+			peers.push_back(peer);
+		}
+	}
+	if (peers.empty()) {
+		peer.ip = PEER_IP;
+		peer.port = PEER_PORT;
+		peer.isServer = IS_SERVER;
+		peers.push_back(peer);
+	}
+	fin.close();
+}
+
+void Configuration::loadDepthFilter(DepthFilter* depthFilter)
+{
+	const char* FILTER_FILE = "DepthFilter.cfg";
+	std::ifstream fin(FILTER_FILE);
+
+	// One line per stage in the order they run, its name, 1 or 0 to enable it and its parameters, the missing ones
+	// keep their default: spatial <passes> <radius> <alpha> <threshold>, fill <passes> <neighbours>, temporal <alpha>
+	// <threshold>. The lines median <enabled> and fused <enabled> switch the median of the raw depth and the fused
+	// kernel, guided <enabled> <radius> <epsilon> the guided filter with the aligned color. Without stage lines the
+	// default pipeline runs.
+	std::vector<FilterStage> stages;
+	std::string line;
+	while (std::getline(fin, line)) {
+		std::istringstream words(line);
+		std::string name;
+		if (!(words >> name)) {
+			continue;
+		}
+		int enabled = 1;
+		readValue(words, enabled);
+		if (name == "spatial") {
+			FilterStage stage = DepthFilter::getDefaultStage(DepthFilter::STAGE_SPATIAL);
+			stage.enabled = enabled;
+			readValue(words, stage.passes);
+			readValue(words, stage.radius);
+			readValue(words, stage.alpha);
+			readValue(words, stage.threshold);
+			stages.push_back(stage);
+		} else if (name == "fill") {
+			FilterStage stage = DepthFilter::getDefaultStage(DepthFilter::STAGE_FILL_HOLES);
+			stage.enabled = enabled;
+			readValue(words, stage.passes);
+			readValue(words, stage.neighbours);
+			stages.push_back(stage);
+		} else if (name == "temporal") {
+			FilterStage stage = DepthFilter::getDefaultStage(DepthFilter::STAGE_TEMPORAL);
+			stage.enabled = enabled;
+			readValue(words, stage.alpha);
+			readValue(words, stage.threshold);
+			stages.push_back(stage);
+		} else if (name == "median") {
+			depthFilter->setMedian(enabled != 0);
+		} else if (name == "fused") {
+			depthFilter->setFused(enabled != 0);
+		} else if (name == "guided") {
+			bool guided;
+			int radius;
+			float epsilon;
+			depthFilter->getGuide(guided, radius, epsilon);
+			readValue(words, radius);
+			readValue(words, epsilon);
+			depthFilter->setGuide(enabled != 0, radius, epsilon);
+		} else {
+			std::cout << "unknown depth filter stage " << name << std::endl;
+		}
+	}
+	if (!stages.empty()) {
+		depthFilter->setStages((int)stages.size(), stages.data());
+	}
+	fin.close();
+}
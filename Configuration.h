@@ -4,6 +4,10 @@
 #include "Parameters.h"
 #include "TsdfVolume.cuh"
 #include "AlignColorMap.h"
+#include "TsdfVolume.h"
+#include "Transmission.h"
+#include "DepthFilter.h"
+#include <string>
 
 class Configuration {
 public:
@@ -11,7 +15,14 @@ public:
 	static void loadExtrinsics(Transformation* transformation);
 	static void saveBackground(AlignColorMap* alignColorMap);
 	static void loadBackground(AlignColorMap* alignColorMap);
-	static int loadDelayFrame();
+	static int loadDelayFrame(bool& adaptive);
+	static StreamFormat loadStreamFormat();
+	static void loadTemporalFusion(TsdfVolume* volume);
+	static void loadBackend();
+	static bool loadReplay(std::string& file, bool& realTime);
+	static bool loadRecord(std::string& file);
+	static void loadPeers(std::vector<PeerAddress>& peers);
+	static void loadDepthFilter(DepthFilter* depthFilter);
 };
 
 #endif
@@ -0,0 +1,211 @@
+#include "DepthCodec.h"
+#include <emmintrin.h>
+#include <vector>
+
+// float meters -> UINT16 units, 8 pixels at a time. Depth beyond the 16 bit range is dropped as invalid.
+void DepthCodec::quantize(int count, float* depth, UINT16* quantized)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / DEPTH_CODEC_UNIT);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i limit = _mm_set1_epi32(65535);
+	const __m128i bias32 = _mm_set1_epi32(32768);
+	const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(depth + i), scale), half));
+		__m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(depth + i + 4), scale), half));
+		a = _mm_andnot_si128(_mm_cmpgt_epi32(a, limit), a);
+		b = _mm_andnot_si128(_mm_cmpgt_epi32(b, limit), b);
+		// SSE2 only packs with signed saturation, so the values are moved into the signed range and back
+		__m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+		_mm_storeu_si128((__m128i*)(quantized + i), _mm_xor_si128(packed, bias16));
+	}
+	for (; i < count; i++) {
+		int q = (int)(depth[i] * (1.0f / DEPTH_CODEC_UNIT) + 0.5f);
+		quantized[i] = (q > 65535) ? 0 : q;
+	}
+}
+
+void DepthCodec::dequantize(int count, UINT16* quantized, float* depth)
+{
+	const __m128 unit = _mm_set1_ps(DEPTH_CODEC_UNIT);
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i q = _mm_loadu_si128((__m128i*)(quantized + i));
+		_mm_storeu_ps(depth + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(q, zero)), unit));
+		_mm_storeu_ps(depth + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(q, zero)), unit));
+	}
+	for (; i < count; i++) {
+		depth[i] = quantized[i] * DEPTH_CODEC_UNIT;
+	}
+}
+
+// Tokens: 0x00-0x7F literal, 0x80-0xBF run of 1-64 zeros, 0xC0-0xFE value 128-16255 in two bytes, 0xFF raw 16 bit value.
+int DepthCodec::pack(UINT16* values, int N, BYTE* data)
+{
+	int size = 0;
+	for (int i = 0; i < N; ) {
+		UINT16 v = values[i];
+		if (v == 0) {
+			int run = 1;
+			while (run < 64 && i + run < N && values[i + run] == 0) {
+				run++;
+			}
+			data[size++] = 0x80 + (run - 1);
+			i += run;
+			continue;
+		}
+		if (v < 0x80) {
+			data[size++] = (BYTE)v;
+		} else if (v < 128 + 63 * 256) {
+			int w = v - 128;
+			data[size++] = 0xC0 + (w >> 8);
+			data[size++] = w & 0xFF;
+		} else {
+			data[size++] = 0xFF;
+			data[size++] = v & 0xFF;
+			data[size++] = v >> 8;
+		}
+		i++;
+	}
+	return size;
+}
+
+int DepthCodec::unpack(BYTE* data, int maxSize, int N, UINT16* values)
+{
+	int size = 0;
+	for (int i = 0; i < N; ) {
+		if (size >= maxSize) {
+			return -1;
+		}
+		BYTE b = data[size++];
+		if (b < 0x80) {
+			values[i++] = b;
+		} else if (b < 0xC0) {
+			int run = min(b - 0x80 + 1, N - i);
+			memset(values + i, 0, run * sizeof(UINT16));
+			i += run;
+		} else if (b < 0xFF) {
+			if (size + 1 > maxSize) {
+				return -1;
+			}
+			values[i++] = 128 + ((b - 0xC0) << 8) + data[size++];
+		} else {
+			if (size + 2 > maxSize) {
+				return -1;
+			}
+			values[i++] = data[size] | (data[size + 1] << 8);
+			size += 2;
+		}
+	}
+	return size;
+}
+
+inline UINT16 zigzag(INT16 r) {
+	return (UINT16)((r << 1) ^ (r >> 15));
+}
+
+inline INT16 unzigzag(UINT16 v) {
+	return (INT16)((v >> 1) ^ -(INT16)(v & 1));
+}
+
+int DepthCodec::encode(int mode, int maxError, int width, int height, float* depth, BYTE* data)
+{
+	if (mode == DEPTH_RAW) {
+		memcpy(data, depth, width * height * sizeof(float));
+		return width * height * sizeof(float);
+	}
+
+	thread_local std::vector<UINT16> quantizedBuffer(DEPTH_W * DEPTH_H);
+	thread_local std::vector<UINT16> residualBuffer(DEPTH_W * DEPTH_H);
+	UINT16* q = quantizedBuffer.data();
+	UINT16* residual = residualBuffer.data();
+	quantize(width * height, depth, q);
+
+	if (mode == DEPTH_LOSSLESS || maxError <= 0) {
+		// Residuals wrap around in 16 bit, the decoder undoes them with the same wrap
+		for (int y = 0; y < height; y++) {
+			UINT16* row = q + y * width;
+			UINT16* out = residual + y * width;
+			out[0] = zigzag((INT16)(row[0] - (y > 0 ? row[-width] : 0)));
+			int x = 1;
+			for (; x + 8 <= width; x += 8) {
+				__m128i r = _mm_sub_epi16(_mm_loadu_si128((__m128i*)(row + x)), _mm_loadu_si128((__m128i*)(row + x - 1)));
+				r = _mm_xor_si128(_mm_slli_epi16(r, 1), _mm_srai_epi16(r, 15));
+				_mm_storeu_si128((__m128i*)(out + x), r);
+			}
+			for (; x < width; x++) {
+				out[x] = zigzag((INT16)(row[x] - row[x - 1]));
+			}
+		}
+	} else {
+		// Near lossless: the prediction uses the reconstructed neighbor, exactly as the decoder sees it
+		const int step = 2 * maxError + 1;
+		for (int y = 0; y < height; y++) {
+			UINT16* row = q + y * width;
+			UINT16* out = residual + y * width;
+			for (int x = 0; x < width; x++) {
+				int pred = (x > 0) ? row[x - 1] : (y > 0 ? row[-width] : 0);
+				int r = row[x] - pred;
+				int k = (r >= 0) ? (r + maxError) / step : -((maxError - r) / step);
+				int recon = pred + k * step;
+				if (recon <= maxError || recon > 65535) {
+					recon = (recon <= maxError) ? 0 : 65535;
+				}
+				row[x] = recon;
+				out[x] = zigzag((INT16)k);
+			}
+		}
+	}
+
+	return pack(residual, width * height, data);
+}
+
+int DepthCodec::decode(int mode, int maxError, int width, int height, BYTE* data, int size, float* depth)
+{
+	if (mode == DEPTH_RAW) {
+		if (size != (int)(width * height * sizeof(float))) {
+			return -1;
+		}
+		memcpy(depth, data, width * height * sizeof(float));
+		return width * height * sizeof(float);
+	}
+	if (mode != DEPTH_LOSSLESS && mode != DEPTH_LOSSY) {
+		return -1;
+	}
+
+	thread_local std::vector<UINT16> quantizedBuffer(DEPTH_W * DEPTH_H);
+	UINT16* q = quantizedBuffer.data();
+	if (unpack(data, size, width * height, q) != size) {
+		return -1;
+	}
+
+	if (mode == DEPTH_LOSSLESS || maxError <= 0) {
+		for (int y = 0; y < height; y++) {
+			UINT16* row = q + y * width;
+			row[0] = (UINT16)((y > 0 ? row[-width] : 0) + unzigzag(row[0]));
+			for (int x = 1; x < width; x++) {
+				row[x] = (UINT16)(row[x - 1] + unzigzag(row[x]));
+			}
+		}
+	} else {
+		const int step = 2 * maxError + 1;
+		for (int y = 0; y < height; y++) {
+			UINT16* row = q + y * width;
+			for (int x = 0; x < width; x++) {
+				int pred = (x > 0) ? row[x - 1] : (y > 0 ? row[-width] : 0);
+				int recon = pred + unzigzag(row[x]) * step;
+				if (recon <= maxError || recon > 65535) {
+					recon = (recon <= maxError) ? 0 : 65535;
+				}
+				row[x] = recon;
+			}
+		}
+	}
+
+	dequantize(width * height, q, depth);
+	return size;
+}
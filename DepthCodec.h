@@ -0,0 +1,34 @@
+#ifndef DEPTH_CODEC_H
+#define DEPTH_CODEC_H
+
+#include <Windows.h>
+#include "Parameters.h"
+
+// Depth maps in meters are quantized to 16 bit on a DEPTH_CODEC_UNIT grid, predicted from the left neighbor
+// (the pixel above for the first column) and the residuals are packed with a byte oriented zero run coder.
+// DEPTH_LOSSLESS keeps the quantized depth exactly, DEPTH_LOSSY quantizes the residuals so that every pixel
+// is within maxError units of the quantized depth. Zero (invalid) depth always stays zero.
+#define DEPTH_CODEC_UNIT 0.0001f
+
+class DepthCodec {
+private:
+	static void quantize(int count, float* depth, UINT16* quantized);
+	static void dequantize(int count, UINT16* quantized, float* depth);
+public:
+	enum Mode { DEPTH_RAW = 0, DEPTH_LOSSLESS = 1, DEPTH_LOSSY = 2 };
+	// Worst case size of an encoded depth map
+	static const int MAX_ENCODED_SIZE = 3 * DEPTH_W * DEPTH_H;
+	// encode returns the number of bytes written to data. decode reads the size bytes of data and returns -1 when the
+	// mode is unknown, the data ends early or the image ends before the data. Images other than DEPTH_W x DEPTH_H
+	// must not have more pixels than that.
+	static int encode(int mode, int maxError, float* depth, BYTE* data) { return encode(mode, maxError, DEPTH_W, DEPTH_H, depth, data); }
+	static int decode(int mode, int maxError, BYTE* data, int size, float* depth) { return decode(mode, maxError, DEPTH_W, DEPTH_H, data, size, depth); }
+	static int encode(int mode, int maxError, int width, int height, float* depth, BYTE* data);
+	static int decode(int mode, int maxError, int width, int height, BYTE* data, int size, float* depth);
+	// Zero run coder of zigzag residuals, shared with the other codecs. At most 3 bytes per value. unpack reads at
+	// most size bytes and returns the bytes read, -1 when they run out before count values.
+	static int pack(UINT16* values, int count, BYTE* data);
+	static int unpack(BYTE* data, int size, int count, UINT16* values);
+};
+
+#endif
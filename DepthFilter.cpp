@@ -1,21 +1,186 @@
 #include "DepthFilter.h"
 #include "Parameters.h"
+#include "Backend.h"
+#include <string.h>
 
-extern "C" void cudaDepthFiltering(UINT16* depthMap, UINT16* depth_device, float* depthFloat_device, float* lastFrame_device, float convertFactor);
-extern "C" void cudaDepthFilterInit(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device);
-extern "C" void cudaDepthFilterClean(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device);
+extern "C" void cudaDepthFiltering(int count, const int* cameras, const float* convertFactors, UINT16* depthMaps, UINT16* depth_device, float* depthFloat_device, float* lastFrame_device, float* buffer_device, int stageCount, const FilterStage* stages, bool median, bool fused, float* stageTimes);
+extern "C" void cudaDepthFilterGuide(int count, const int* cameras, float* depthFloat_device, RGBQUAD* alignedColor_device, float* guide_device, int radius, float epsilon);
+extern "C" void cudaDepthFilterInit(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device, float*& buffer_device, float*& guide_device);
+extern "C" void cudaDepthFilterReset(float* lastFrame_device);
+extern "C" void cudaDepthFilterClean(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device, float*& buffer_device, float*& guide_device);
+extern "C" void cpuDepthFiltering(UINT16* depthMap, UINT16* depth, float* depthFloat, float* lastFrame, float convertFactor, int stageCount, const FilterStage* stages, bool median, float* stageTimes);
+extern "C" void cpuDepthFilterGuide(float* depthFloat, RGBQUAD* alignedColor, int radius, float epsilon);
+extern "C" void cpuDepthFilterInit(UINT16*& depth, float*& depthFloat, float*& lastFrame);
+extern "C" void cpuDepthFilterReset(float* lastFrame);
+extern "C" void cpuDepthFilterClean(UINT16*& depth, float*& depthFloat, float*& lastFrame);
 
 DepthFilter::DepthFilter()
 {
-	cudaDepthFilterInit(depth_device, depthFloat_device, lastFrame_device);
+	fused = true;
+	median = true;
+	medianOnCapture = false;
+	profiling = false;
+	guided = false;
+	guideRadius = 4;
+	guideEpsilon = 0.001f;
+	buffer_device = NULL;
+	guide_device = NULL;
+	depthMaps_host = (UINT16*)Backend::allocHost(MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(UINT16));
+	if (Backend::isCpu()) {
+		cpuDepthFilterInit(depth_device, depthFloat_device, lastFrame_device);
+	} else {
+		cudaDepthFilterInit(depth_device, depthFloat_device, lastFrame_device, buffer_device, guide_device);
+	}
+	resetStages();
 }
 
 DepthFilter::~DepthFilter()
 {
-	cudaDepthFilterClean(depth_device, depthFloat_device, lastFrame_device);
+	Backend::freeHost(depthMaps_host);
+	if (Backend::isCpu()) {
+		cpuDepthFilterClean(depth_device, depthFloat_device, lastFrame_device);
+	} else {
+		cudaDepthFilterClean(depth_device, depthFloat_device, lastFrame_device, buffer_device, guide_device);
+	}
+}
+
+FilterStage DepthFilter::getDefaultStage(int type)
+{
+	FilterStage stage;
+	stage.type = type;
+	stage.enabled = 1;
+	stage.passes = (type == STAGE_FILL_HOLES) ? 3 : 2;
+	stage.radius = 5;
+	stage.alpha = (type == STAGE_TEMPORAL) ? 0.5f : 0.75f;
+	stage.threshold = 40.0f;
+	stage.neighbours = 5;
+	return stage;
+}
+
+void DepthFilter::resetStages()
+{
+	FilterStage stages[3] = { getDefaultStage(STAGE_SPATIAL), getDefaultStage(STAGE_FILL_HOLES), getDefaultStage(STAGE_TEMPORAL) };
+	setStages(3, stages);
+}
+
+void DepthFilter::setStages(int count, const FilterStage* stages)
+{
+	stageCount = 0;
+	for (int i = 0; i < count && stageCount < MAX_STAGES; i++) {
+		FilterStage stage = stages[i];
+		if (stage.type < STAGE_SPATIAL || stage.type > STAGE_TEMPORAL) {
+			continue;
+		}
+		stage.passes = max(0, min(MAX_PASSES, stage.passes));
+		stage.radius = max(1, min(MAX_RADIUS, stage.radius));
+		stage.alpha = max(0.0f, min(1.0f, stage.alpha));
+		stage.threshold = max(0.0f, stage.threshold);
+		stage.neighbours = max(1, min(8, stage.neighbours));
+		this->stages[stageCount++] = stage;
+	}
+	memset(stageTimes, 0, sizeof(stageTimes));
+
+	// The state of a temporal filter that was off or elsewhere in the pipeline does not fit the new frames
+	if (Backend::isCpu()) {
+		cpuDepthFilterReset(lastFrame_device);
+	} else {
+		cudaDepthFilterReset(lastFrame_device);
+	}
+}
+
+int DepthFilter::getStages(FilterStage* stages)
+{
+	memcpy(stages, this->stages, stageCount * sizeof(FilterStage));
+	return stageCount;
+}
+
+int DepthFilter::getStageTimes(float* times)
+{
+	memcpy(times, stageTimes, (stageCount + 2) * sizeof(float));
+	return stageCount + 2;
+}
+
+void DepthFilter::setGuide(bool guided, int radius, float epsilon)
+{
+	this->guided = guided;
+	guideRadius = max(1, min(MAX_GUIDE_RADIUS, radius));
+	guideEpsilon = max(1e-6f, epsilon);
+}
+
+void DepthFilter::getGuide(bool& guided, int& radius, float& epsilon)
+{
+	guided = this->guided;
+	radius = guideRadius;
+	epsilon = guideEpsilon;
 }
 
 void DepthFilter::process(int cameraId, UINT16* depthMap)
 {
-	cudaDepthFiltering(depthMap, depth_device, depthFloat_device + cameraId * DEPTH_H * DEPTH_W, lastFrame_device + cameraId * DEPTH_H * DEPTH_W, convertFactor[cameraId]);
+	bool check[MAX_CAMERAS] = { false };
+	UINT16* depthMaps[MAX_CAMERAS];
+	check[cameraId] = true;
+	depthMaps[cameraId] = depthMap;
+	process(cameraId + 1, check, depthMaps);
+}
+
+void DepthFilter::process(int cameras, bool* check, UINT16** depthMaps)
+{
+	float* times = profiling ? stageTimes : NULL;
+	bool median = this->median && !medianOnCapture;
+	memset(stageTimes, 0, sizeof(stageTimes));
+
+	if (Backend::isCpu()) {
+		for (int i = 0; i < cameras; i++) {
+			if (check[i]) {
+				float* depthFloat = depthFloat_device + i * DEPTH_H * DEPTH_W;
+				float* lastFrame = lastFrame_device + i * DEPTH_H * DEPTH_W;
+				cpuDepthFiltering(depthMaps[i], depth_device, depthFloat, lastFrame, convertFactor[i], stageCount, stages, median, times);
+			}
+		}
+		return;
+	}
+
+	// The frames are packed into page-locked memory, the upload of the previous ones has long finished by now
+	Backend::synchronize();
+	int cameraIds[MAX_CAMERAS];
+	float factors[MAX_CAMERAS];
+	int count = 0;
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			memcpy(depthMaps_host + count * DEPTH_H * DEPTH_W, depthMaps[i], DEPTH_H * DEPTH_W * sizeof(UINT16));
+			cameraIds[count] = i;
+			factors[count] = convertFactor[i];
+			count++;
+		}
+	}
+	if (count > 0) {
+		cudaDepthFiltering(count, cameraIds, factors, depthMaps_host, depth_device, depthFloat_device, lastFrame_device, buffer_device, stageCount, stages, median, fused, times);
+	}
+}
+
+void DepthFilter::guide(int cameras, bool* check, RGBQUAD* alignedColor_device)
+{
+	if (!guided) {
+		return;
+	}
+
+	if (Backend::isCpu()) {
+		for (int i = 0; i < cameras; i++) {
+			if (check[i]) {
+				cpuDepthFilterGuide(depthFloat_device + i * DEPTH_H * DEPTH_W, alignedColor_device + i * COLOR_H * COLOR_W, guideRadius, guideEpsilon);
+			}
+		}
+		return;
+	}
+
+	int cameraIds[MAX_CAMERAS];
+	int count = 0;
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			cameraIds[count++] = i;
+		}
+	}
+	if (count > 0) {
+		cudaDepthFilterGuide(count, cameraIds, depthFloat_device, alignedColor_device, guide_device, guideRadius, guideEpsilon);
+	}
 }
@@ -2,21 +2,129 @@
 #include "Parameters.h"
 #include "DepthFilter.h"
 #include "Timer.h"
+#include <string.h>
 
 namespace FilterNamespace {
-	__constant__ int SF_RADIUS = 5;
-	__constant__ float SF_ALPHA = 0.75f;
-	__constant__ float SF_THRESHOLD = 40.0f;
-	__constant__ float TF_ALPHA = 0.5f;
-	__constant__ float TF_THRESHOLD = 40.0f;
-	__constant__ int HF_RADIUS = 5;		//뾶ԲΣ
-	__constant__ float HF_TC = 0.75;	//Чֵ75%Чֵʱ
-	__constant__ float HF_TR = 40.0f;	//򼫲
-
-	float* lastFrame;
+	// Output tile of kernelFusedFilter. The shared buffers hold the halo of the default pipeline, two spatial passes
+	// of radius 5 and three hole fills around the tile, pipelines that reach further use the chain.
+	const int FUSED_TILE_W = 32;
+	const int FUSED_TILE_H = 16;
+	const int FUSED_HALO = 13;
+	const int FUSED_W = FUSED_TILE_W + 2 * FUSED_HALO;
+	const int FUSED_H = FUSED_TILE_H + 2 * FUSED_HALO;
+
+	// The guided filter sums its boxes along runs of GUIDE_RUN pixels of a row or a column per thread. Every run fills
+	// its window anew from 2 * radius more pixels, so a pass costs (GUIDE_RUN + 2 * radius) / GUIDE_RUN reads per pixel,
+	// the price of a thread per run rather than per whole row or column. Per camera it keeps GUIDE_PLANES frames,
+	// the five box sums of the input and then the three of the coefficients.
+	const int GUIDE_RUN = 32;
+	const int GUIDE_PLANES = 8;
+
+	// The frames of one launch are indexed by blockIdx.z, the raw frames are packed, the filtered ones and the
+	// temporal state are at the position of the camera.
+	__constant__ int FILTER_CAMERAS[MAX_CAMERAS];
+	__constant__ float CONVERT_FACTORS[MAX_CAMERAS];
+	__constant__ FilterStage FILTER_STAGES[DepthFilter::MAX_STAGES];
 };
 using namespace FilterNamespace;
 
+// The per pixel steps are shared by the kernel chain and the fused kernel, so that both give the same bits.
+__device__ __forceinline__ float filterToDisparity(UINT16 center, UINT16 left, UINT16 right, UINT16 up, UINT16 down, float convertFactor, bool median) {
+	#define DEPTH_SORT(a, b) { if ((a) > (b)) {UINT16 temp = (a); (a) = (b); (b) = temp;} }
+
+	if (!median) {
+		return (center != 0) ? convertFactor / center : 0;
+	}
+	UINT16 arr[5] = { center, left, right, up, down };
+	DEPTH_SORT(arr[0], arr[1]);
+	DEPTH_SORT(arr[0], arr[2]);
+	DEPTH_SORT(arr[0], arr[3]);
+	DEPTH_SORT(arr[0], arr[4]);
+	DEPTH_SORT(arr[1], arr[2]);
+	DEPTH_SORT(arr[1], arr[3]);
+	DEPTH_SORT(arr[1], arr[4]);
+	DEPTH_SORT(arr[2], arr[3]);
+	DEPTH_SORT(arr[2], arr[4]);
+	DEPTH_SORT(arr[3], arr[4]);
+	float target = 0;
+	if (arr[0] != 0) {
+		target = convertFactor / arr[2];
+	} else
+	if (arr[1] != 0) {
+		target = convertFactor * 2 / (arr[2] + arr[3]);
+	} else
+	if (arr[2] != 0) {
+		target = convertFactor / arr[3];
+	} else
+	if (arr[3] != 0) {
+		target = convertFactor * 2 / (arr[3] + arr[4]);
+	} else
+	if (arr[4] != 0) {
+		target = convertFactor / arr[4];
+	} else {
+		target = 0;
+	}
+	return target;
+}
+
+// before and after are the number of pixels of the frame on either side of center along step
+__device__ __forceinline__ float spatialFilter(const float* center, int step, int before, int after, const FilterStage& stage) {
+	float origin = center[0];
+	float result = 0;
+	if (origin != 0) {
+		float sum = origin;
+		float weight = 1;
+		float w = 1;
+		for (int r = 1; r <= stage.radius; r++) {
+			w *= stage.alpha;
+			if (r <= before && center[-r * step] != 0 && fabs(center[-r * step] - origin) <= stage.threshold) {
+				weight += w;
+				sum += w * center[-r * step];
+			}
+			if (r <= after && center[r * step] != 0 && fabs(center[r * step] - origin) <= stage.threshold) {
+				weight += w;
+				sum += w * center[r * step];
+			}
+		}
+		result = sum / weight;
+	}
+	return result;
+}
+
+__device__ __forceinline__ float fillHoles(const float* center, int pitch, int x, int y, const FilterStage& stage) {
+	float result = center[0];
+	int cnt = 0;
+	if (result == 0) {
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				if (0 <= x + dx && x + dx < DEPTH_W && 0 <= y + dy && y + dy < DEPTH_H && (dx != 0 || dy != 0)) {
+					float currDepth = center[dy * pitch + dx];
+					if (currDepth != 0) {
+						cnt++;
+						result = max(result, currDepth);
+					}
+				}
+			}
+		}
+	}
+	return (cnt >= stage.neighbours) ? result : center[0];
+}
+
+__device__ __forceinline__ float temporalFilter(float depth, float lastDepth, const FilterStage& stage) {
+	float result = depth;
+	if (lastDepth != 0 && fabs(result - lastDepth) <= stage.threshold) {
+		result = result * stage.alpha + lastDepth * (1 - stage.alpha);
+	}
+	return result;
+}
+
+__device__ __forceinline__ float filterToDepth(float disparity, float convertFactor) {
+	if (disparity != 0) {
+		return convertFactor / disparity * 0.001; //to m
+	}
+	return disparity;
+}
+
 __global__ void kernelCleanLastFrame(float* lastFrame) {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
@@ -27,179 +135,475 @@ __global__ void kernelCleanLastFrame(float* lastFrame) {
 	}
 }
 
-__global__ void kernelFilterToDisparity(UINT16* source, float* target, float convertFactor) {
-	#define DEPTH_SORT(a, b) { if ((a) > (b)) {UINT16 temp = (a); (a) = (b); (b) = temp;} }
-
+__global__ void kernelFilterToDisparity(UINT16* source, float* target, bool median) {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	source += blockIdx.z * DEPTH_H * DEPTH_W;
+	target += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
 
 	if (x < DEPTH_W && y < DEPTH_H) {
 		int id = y * DEPTH_W + x;
-		UINT16 arr[5] = { source[id], 0, 0, 0, 0 };
-		if (x - 1 >= 0) arr[1] = source[id - 1];
-		if (x + 1 < DEPTH_W) arr[2] = source[id + 1];
-		if (y - 1 >= 0) arr[3] = source[id - DEPTH_W];
-		if (y + 1 < DEPTH_H) arr[4] = source[id + DEPTH_W];
-		DEPTH_SORT(arr[0], arr[1]);
-		DEPTH_SORT(arr[0], arr[2]);
-		DEPTH_SORT(arr[0], arr[3]);
-		DEPTH_SORT(arr[0], arr[4]);
-		DEPTH_SORT(arr[1], arr[2]);
-		DEPTH_SORT(arr[1], arr[3]);
-		DEPTH_SORT(arr[1], arr[4]);
-		DEPTH_SORT(arr[2], arr[3]);
-		DEPTH_SORT(arr[2], arr[4]);
-		DEPTH_SORT(arr[3], arr[4]);
-		__syncthreads();
-		if (arr[0] != 0) {
-			target[id] = convertFactor / arr[2];
-		} else
-		if (arr[1] != 0) {
-			target[id] = convertFactor * 2 / (arr[2] + arr[3]);
-		} else
-		if (arr[2] != 0) {
-			target[id] = convertFactor / arr[3];
-		} else
-		if (arr[3] != 0) {
-			target[id] = convertFactor * 2 / (arr[3] + arr[4]);
-		} 
-		if (arr[4] != 0) {
-			target[id] = convertFactor / arr[4];
-		} else {
-			target[id] = 0;
-		}
+		UINT16 left = (x - 1 >= 0) ? source[id - 1] : 0;
+		UINT16 right = (x + 1 < DEPTH_W) ? source[id + 1] : 0;
+		UINT16 up = (y - 1 >= 0) ? source[id - DEPTH_W] : 0;
+		UINT16 down = (y + 1 < DEPTH_H) ? source[id + DEPTH_W] : 0;
+		target[id] = filterToDisparity(source[id], left, right, up, down, CONVERT_FACTORS[blockIdx.z], median);
 	}
 }
 
-__global__ void kernelFilterToDepth(float* depth, float convertFactor) {
+__global__ void kernelFilterToDepth(float* source, float* depth) {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	source += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+	depth += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
 
 	if (x < DEPTH_W && y < DEPTH_H) {
 		int id = y * DEPTH_W + x;
-		if (depth[id] != 0) {
-			depth[id] = convertFactor / depth[id] * 0.001; //to m
-		}
+		depth[id] = filterToDepth(source[id], CONVERT_FACTORS[blockIdx.z]);
 	}
 }
 
-__global__ void kernelSFVertical(float* depth)
+// The neighbourhood passes read one buffer and write another, a pass in place would read pixels that other blocks
+// have already overwritten. stage indexes FILTER_STAGES.
+__global__ void kernelSFVertical(float* source, float* target, int stage)
 {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	source += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+	target += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
 
 	if (x < DEPTH_W && y < DEPTH_H) {
 		int id = y * DEPTH_W + x;
-
-		float origin = depth[id];
-		float result = 0;
-		if (origin != 0) {
-			float sum = origin;
-			float weight = 1;
-			float w = 1;
-			for (int r = 1; r <= SF_RADIUS; r++) {
-				w *= SF_ALPHA;
-				if (y - r >= 0 && depth[id - r * DEPTH_W] != 0 && fabs(depth[id - r * DEPTH_W] - origin) <= SF_THRESHOLD) {
-					weight += w;
-					sum += w * depth[id - r * DEPTH_W];
-				}
-				if (y + r < DEPTH_H && depth[id + r * DEPTH_W] != 0 && fabs(depth[id + r * DEPTH_W] - origin) <= SF_THRESHOLD) {
-					weight += w;
-					sum += w * depth[id + r * DEPTH_W];
-				}
-			}
-			result = sum / weight;
-		}
-		__syncthreads();
-		depth[id] = result;
+		target[id] = spatialFilter(source + id, DEPTH_W, y, DEPTH_H - 1 - y, FILTER_STAGES[stage]);
 	}
 }
 
-__global__ void kernelSFHorizontal(float* depth)
+__global__ void kernelSFHorizontal(float* source, float* target, int stage)
 {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	source += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+	target += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
 
 	if (x < DEPTH_W && y < DEPTH_H) {
 		int id = y * DEPTH_W + x;
+		target[id] = spatialFilter(source + id, 1, x, DEPTH_W - 1 - x, FILTER_STAGES[stage]);
+	}
+}
 
-		float origin = depth[id];
-		float result = 0;
-		if (origin != 0) {
-			float sum = origin;
-			float weight = 1;
-			float w = 1;
-			for (int r = 1; r <= SF_RADIUS; r++) {
-				w *= SF_ALPHA;
-				if (x - r >= 0 && depth[id - r] != 0 && fabs(depth[id - r] - origin) <= SF_THRESHOLD) {
-					weight += w;
-					sum += w * depth[id - r];
-				}
-				if (x + r < DEPTH_W && depth[id + r] != 0 && fabs(depth[id + r] - origin) <= SF_THRESHOLD) {
-					weight += w;
-					sum += w * depth[id + r];
-				}
-			}
-			result = sum / weight;
-		}
-		__syncthreads();
-		depth[id] = result;
+__global__ void kernelFillHoles(float* source, float* target, int stage) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	source += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+	target += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+
+	if (x < DEPTH_W && y < DEPTH_H) {
+		int id = y * DEPTH_W + x;
+		target[id] = fillHoles(source + id, DEPTH_W, x, y, FILTER_STAGES[stage]);
 	}
 }
 
-__global__ void kernelFillHoles(float* depth) {
+__global__ void kernelTemporalFilter(float* source, float* target, float* lastFrame, int stage) {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	source += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+	target += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+	lastFrame += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
 
 	if (x < DEPTH_W && y < DEPTH_H) {
 		int id = y * DEPTH_W + x;
-		float result = depth[id];
-		int cnt = 0;
-		if (result == 0) {
-			for (int xx = x - 1; xx <= x + 1; xx++) {
-				for (int yy = y - 1; yy <= y + 1; yy++) {
-					if (0 <= xx && xx < DEPTH_W && 0 <= yy && yy < DEPTH_H && (xx != x || yy != y)) {
-						float currDepth = depth[yy * DEPTH_W + xx];
-						if (currDepth != 0) {
-							cnt++;
-							result = max(result, currDepth);
-						}
-					}
-				}
+		float result = temporalFilter(source[id], lastFrame[id], FILTER_STAGES[stage]);
+		target[id] = result;
+		lastFrame[id] = result;
+	}
+}
+
+// A neighbourhood pass of kernelFusedFilter over the w x h pixels of the shared tile in use. The border of
+// (skipX, skipY) pixels is left out, its neighbours are not valid any more, and so are the pixels outside of the frame.
+__device__ void fusedPass(float (*source)[FUSED_W], float (*target)[FUSED_W], int dx, int dy, int w, int h, int skipX, int skipY, int left, int top, int stage) {
+	int passW = w - 2 * skipX;
+	int passH = h - 2 * skipY;
+	for (int i = threadIdx.y * blockDim.x + threadIdx.x; i < passW * passH; i += blockDim.x * blockDim.y) {
+		int sx = skipX + i % passW;
+		int sy = skipY + i / passW;
+		int x = left + sx;
+		int y = top + sy;
+		if (0 <= x && x < DEPTH_W && 0 <= y && y < DEPTH_H) {
+			if (dx != 0) {
+				target[sy][sx] = spatialFilter(&source[sy][sx], 1, x, DEPTH_W - 1 - x, FILTER_STAGES[stage]);
+			} else if (dy != 0) {
+				target[sy][sx] = spatialFilter(&source[sy][sx], FUSED_W, y, DEPTH_H - 1 - y, FILTER_STAGES[stage]);
+			} else {
+				target[sy][sx] = fillHoles(&source[sy][sx], FUSED_W, x, y, FILTER_STAGES[stage]);
+			}
+		}
+	}
+	__syncthreads();
+}
+
+// The whole pipeline for one FUSED_TILE_W x FUSED_TILE_H tile. The raw depth of the tile and its halo is read once,
+// the neighbourhood stages ping-pong between two shared buffers, each one over the part that the later stages still
+// need, and only the result and the temporal state are written back. halo is what the stages reach together, the
+// temporal stage can only be the last one.
+__global__ void kernelFusedFilter(UINT16* source, float* depth, float* lastFrame, int stageCount, int halo, bool median) {
+	__shared__ UINT16 raw[FUSED_H + 2][FUSED_W + 2];
+	__shared__ float buffer[2][FUSED_H][FUSED_W];
+	float convertFactor = CONVERT_FACTORS[blockIdx.z];
+	source += blockIdx.z * DEPTH_H * DEPTH_W;
+	depth += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+	lastFrame += FILTER_CAMERAS[blockIdx.z] * DEPTH_H * DEPTH_W;
+
+	int w = FUSED_TILE_W + 2 * halo;
+	int h = FUSED_TILE_H + 2 * halo;
+	int left = blockIdx.x * FUSED_TILE_W - halo;
+	int top = blockIdx.y * FUSED_TILE_H - halo;
+	int thread = threadIdx.y * blockDim.x + threadIdx.x;
+	int threads = blockDim.x * blockDim.y;
+
+	// Pixels outside of the frame read as 0, which is what the median takes for missing neighbours
+	for (int i = thread; i < (h + 2) * (w + 2); i += threads) {
+		int sx = i % (w + 2);
+		int sy = i / (w + 2);
+		int x = left - 1 + sx;
+		int y = top - 1 + sy;
+		raw[sy][sx] = (0 <= x && x < DEPTH_W && 0 <= y && y < DEPTH_H) ? source[y * DEPTH_W + x] : 0;
+	}
+	__syncthreads();
+
+	for (int i = thread; i < h * w; i += threads) {
+		int sx = i % w + 1;
+		int sy = i / w + 1;
+		buffer[0][sy - 1][sx - 1] = filterToDisparity(raw[sy][sx], raw[sy][sx - 1], raw[sy][sx + 1], raw[sy - 1][sx], raw[sy + 1][sx], convertFactor, median);
+	}
+	__syncthreads();
+
+	int curr = 0;
+	int skipX = 0;
+	int skipY = 0;
+	int temporal = -1;
+	for (int s = 0; s < stageCount; s++) {
+		const FilterStage& stage = FILTER_STAGES[s];
+		if (!stage.enabled) {
+			continue;
+		}
+		if (stage.type == DepthFilter::STAGE_SPATIAL) {
+			for (int i = 0; i < stage.passes; i++) {
+				skipY += stage.radius;
+				fusedPass(buffer[curr], buffer[1 - curr], 0, 1, w, h, skipX, skipY, left, top, s);
+				curr = 1 - curr;
+				skipX += stage.radius;
+				fusedPass(buffer[curr], buffer[1 - curr], 1, 0, w, h, skipX, skipY, left, top, s);
+				curr = 1 - curr;
+			}
+		} else if (stage.type == DepthFilter::STAGE_FILL_HOLES) {
+			for (int i = 0; i < stage.passes; i++) {
+				skipX++;
+				skipY++;
+				fusedPass(buffer[curr], buffer[1 - curr], 0, 0, w, h, skipX, skipY, left, top, s);
+				curr = 1 - curr;
 			}
+		} else {
+			temporal = s;
+		}
+	}
+
+	for (int i = thread; i < FUSED_TILE_H * FUSED_TILE_W; i += threads) {
+		int x = left + halo + i % FUSED_TILE_W;
+		int y = top + halo + i / FUSED_TILE_W;
+		if (x < DEPTH_W && y < DEPTH_H) {
+			int id = y * DEPTH_W + x;
+			float result = buffer[curr][halo + i / FUSED_TILE_W][halo + i % FUSED_TILE_W];
+			if (temporal >= 0) {
+				result = temporalFilter(result, lastFrame[id], FILTER_STAGES[temporal]);
+				lastFrame[id] = result;
+			}
+			depth[id] = filterToDepth(result, convertFactor);
+		}
+	}
+}
+
+void setFilterCameras(int count, const int* cameras, const float* convertFactors) {
+	HANDLE_ERROR(cudaMemcpyToSymbolAsync(FILTER_CAMERAS, cameras, count * sizeof(int)));
+	if (convertFactors != NULL) {
+		HANDLE_ERROR(cudaMemcpyToSymbolAsync(CONVERT_FACTORS, convertFactors, count * sizeof(float)));
+	}
+}
+
+// Intensity in [0, 1] of the aligned color at a depth pixel, sampled like kernelRemoveBackground does
+__device__ __forceinline__ float guideIntensity(const uchar4* color, int x, int y) {
+	uchar4 c = color[(y * COLOR_H / DEPTH_H) * COLOR_W + x * COLOR_W / DEPTH_W];
+	return (0.299f * c.x + 0.587f * c.y + 0.114f * c.z) / 255;
+}
+
+// What the first boxes of the guided filter sum for one pixel: whether it has depth, the intensity, the depth, the
+// intensity squared and the intensity times the depth, all 0 without depth.
+__device__ __forceinline__ void guideInput(const float* depth, const uchar4* color, int x, int y, float* input) {
+	float p = depth[y * DEPTH_W + x];
+	float I = (p != 0) ? guideIntensity(color, x, y) : 0;
+	input[0] = (p != 0) ? 1.0f : 0.0f;
+	input[1] = I;
+	input[2] = p;
+	input[3] = I * I;
+	input[4] = I * p;
+}
+
+__device__ __forceinline__ void guideAccumulate(float* sum, const float* input, int channels, float sign) {
+	for (int c = 0; c < channels; c++) {
+		sum[c] += sign * input[c];
+	}
+}
+
+__device__ __forceinline__ void guideLoad(const float* planes, int id, int channels, float* input) {
+	for (int c = 0; c < channels; c++) {
+		input[c] = planes[c * DEPTH_H * DEPTH_W + id];
+	}
+}
+
+// The guided filter of He et al. over the pixels with depth, in four passes of running box sums. blockIdx.x and
+// threadIdx.x index the runs of a row in the row passes and the columns in the column passes.
+__global__ void kernelGuideRows(float* depth, uchar4* color, float* guide, int radius) {
+	int run = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	int camera = FILTER_CAMERAS[blockIdx.z];
+	depth += camera * DEPTH_H * DEPTH_W;
+	color += camera * COLOR_H * COLOR_W;
+	guide += camera * GUIDE_PLANES * DEPTH_H * DEPTH_W;
+
+	int begin = run * GUIDE_RUN;
+	if (begin < DEPTH_W && y < DEPTH_H) {
+		int end = min(begin + GUIDE_RUN, DEPTH_W);
+		float sum[5] = { 0 };
+		float input[5];
+		for (int x = max(0, begin - radius); x < min(DEPTH_W, begin + radius); x++) {
+			guideInput(depth, color, x, y, input);
+			guideAccumulate(sum, input, 5, 1);
 		}
-		__syncthreads();
-		if (cnt >= 5) {
-			depth[id] = result;
+		for (int x = begin; x < end; x++) {
+			if (x + radius < DEPTH_W) {
+				guideInput(depth, color, x + radius, y, input);
+				guideAccumulate(sum, input, 5, 1);
+			}
+			for (int c = 0; c < 5; c++) {
+				guide[c * DEPTH_H * DEPTH_W + y * DEPTH_W + x] = sum[c];
+			}
+			if (x - radius >= 0) {
+				guideInput(depth, color, x - radius, y, input);
+				guideAccumulate(sum, input, 5, -1);
+			}
 		}
 	}
 }
 
-__global__ void kernelTemporalFilter(float* depth, float* lastFrame) {
+// Turns the box sums into the linear coefficients a and b of the depth in the intensity, with a weight of 1 where the
+// box holds depth, in planes 5 to 7
+__global__ void kernelGuideCoefficients(float* guide, int radius, float epsilon) {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int run = blockIdx.y * blockDim.y + threadIdx.y;
+	guide += FILTER_CAMERAS[blockIdx.z] * GUIDE_PLANES * DEPTH_H * DEPTH_W;
+
+	int begin = run * GUIDE_RUN;
+	if (x < DEPTH_W && begin < DEPTH_H) {
+		int end = min(begin + GUIDE_RUN, DEPTH_H);
+		float sum[5] = { 0 };
+		float input[5];
+		for (int y = max(0, begin - radius); y < min(DEPTH_H, begin + radius); y++) {
+			guideLoad(guide, y * DEPTH_W + x, 5, input);
+			guideAccumulate(sum, input, 5, 1);
+		}
+		for (int y = begin; y < end; y++) {
+			if (y + radius < DEPTH_H) {
+				guideLoad(guide, (y + radius) * DEPTH_W + x, 5, input);
+				guideAccumulate(sum, input, 5, 1);
+			}
+			float a = 0;
+			float b = 0;
+			float weight = 0;
+			if (sum[0] > 0) {
+				float meanI = sum[1] / sum[0];
+				float meanP = sum[2] / sum[0];
+				float varI = max(sum[3] / sum[0] - meanI * meanI, 0.0f);
+				float covIP = sum[4] / sum[0] - meanI * meanP;
+				a = covIP / (varI + epsilon);
+				b = meanP - a * meanI;
+				weight = 1;
+			}
+			int id = y * DEPTH_W + x;
+			guide[5 * DEPTH_H * DEPTH_W + id] = a;
+			guide[6 * DEPTH_H * DEPTH_W + id] = b;
+			guide[7 * DEPTH_H * DEPTH_W + id] = weight;
+			if (y - radius >= 0) {
+				guideLoad(guide, (y - radius) * DEPTH_W + x, 5, input);
+				guideAccumulate(sum, input, 5, -1);
+			}
+		}
+	}
+}
+
+// Row sums of the coefficients, planes 5 to 7 into planes 0 to 2
+__global__ void kernelGuideCoefficientRows(float* guide, int radius) {
+	int run = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
+	guide += FILTER_CAMERAS[blockIdx.z] * GUIDE_PLANES * DEPTH_H * DEPTH_W;
+	float* coefficients = guide + 5 * DEPTH_H * DEPTH_W;
 
-	if (x < DEPTH_W && y < DEPTH_H) {
-		int id = y * DEPTH_W + x;
-		float result = depth[id];
-		float lastDepth = lastFrame[id];
-		if (lastDepth != 0 && fabs(result - lastDepth) <= TF_THRESHOLD) {
-			result = result * TF_ALPHA + lastDepth * (1 - TF_ALPHA);
+	int begin = run * GUIDE_RUN;
+	if (begin < DEPTH_W && y < DEPTH_H) {
+		int end = min(begin + GUIDE_RUN, DEPTH_W);
+		float sum[3] = { 0 };
+		float input[3];
+		for (int x = max(0, begin - radius); x < min(DEPTH_W, begin + radius); x++) {
+			guideLoad(coefficients, y * DEPTH_W + x, 3, input);
+			guideAccumulate(sum, input, 3, 1);
+		}
+		for (int x = begin; x < end; x++) {
+			if (x + radius < DEPTH_W) {
+				guideLoad(coefficients, y * DEPTH_W + x + radius, 3, input);
+				guideAccumulate(sum, input, 3, 1);
+			}
+			for (int c = 0; c < 3; c++) {
+				guide[c * DEPTH_H * DEPTH_W + y * DEPTH_W + x] = sum[c];
+			}
+			if (x - radius >= 0) {
+				guideLoad(coefficients, y * DEPTH_W + x - radius, 3, input);
+				guideAccumulate(sum, input, 3, -1);
+			}
 		}
-		__syncthreads();
-		depth[id] = result;
-		lastFrame[id] = result;
 	}
 }
 
-extern "C"
-void cudaDepthFilterInit(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device) {
+// The depth with the coefficients averaged over the box applied to the intensity, in place, the pixels without depth
+// are left as they are
+__global__ void kernelGuideOutput(float* depth, uchar4* color, float* guide, int radius) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int run = blockIdx.y * blockDim.y + threadIdx.y;
+	int camera = FILTER_CAMERAS[blockIdx.z];
+	depth += camera * DEPTH_H * DEPTH_W;
+	color += camera * COLOR_H * COLOR_W;
+	guide += camera * GUIDE_PLANES * DEPTH_H * DEPTH_W;
+
+	int begin = run * GUIDE_RUN;
+	if (x < DEPTH_W && begin < DEPTH_H) {
+		int end = min(begin + GUIDE_RUN, DEPTH_H);
+		float sum[3] = { 0 };
+		float input[3];
+		for (int y = max(0, begin - radius); y < min(DEPTH_H, begin + radius); y++) {
+			guideLoad(guide, y * DEPTH_W + x, 3, input);
+			guideAccumulate(sum, input, 3, 1);
+		}
+		for (int y = begin; y < end; y++) {
+			if (y + radius < DEPTH_H) {
+				guideLoad(guide, (y + radius) * DEPTH_W + x, 3, input);
+				guideAccumulate(sum, input, 3, 1);
+			}
+			int id = y * DEPTH_W + x;
+			if (depth[id] != 0 && sum[2] > 0) {
+				depth[id] = (sum[0] * guideIntensity(color, x, y) + sum[1]) / sum[2];
+			}
+			if (y - radius >= 0) {
+				guideLoad(guide, (y - radius) * DEPTH_W + x, 3, input);
+				guideAccumulate(sum, input, 3, -1);
+			}
+		}
+	}
+}
+
+void setFilterStages(int stageCount, const FilterStage* stages) {
+	HANDLE_ERROR(cudaMemcpyToSymbolAsync(FILTER_STAGES, stages, stageCount * sizeof(FilterStage)));
+}
+
+// The halo kernelFusedFilter needs for the stages, or -1 when they do not fit into it
+int fusedHalo(int stageCount, const FilterStage* stages) {
+	int halo = 0;
+	bool temporal = false;
+	for (int s = 0; s < stageCount; s++) {
+		if (!stages[s].enabled) {
+			continue;
+		}
+		if (temporal) {
+			return -1;
+		}
+		if (stages[s].type == DepthFilter::STAGE_SPATIAL) {
+			halo += stages[s].passes * stages[s].radius;
+		} else if (stages[s].type == DepthFilter::STAGE_FILL_HOLES) {
+			halo += stages[s].passes;
+		} else {
+			temporal = true;
+		}
+	}
+	return (halo <= FUSED_HALO) ? halo : -1;
+}
+
+// One launch per pass for all the frames. With events, events[0] is recorded before the conversion to disparity,
+// events[s + 1] before stage s, events[stageCount + 1] before the conversion to depth and events[stageCount + 2] after it.
+void depthFilterChain(int count, UINT16* depth_device, float* depthFloat_device, float* lastFrame_device, float* buffer_device, int stageCount, const FilterStage* stages, bool median, cudaEvent_t* events) {
 	dim3 threadsPerBlock = dim3(256, 1);
-	dim3 blocksPerGrid = dim3((DEPTH_W + threadsPerBlock.x - 1) / threadsPerBlock.x, (DEPTH_H + threadsPerBlock.y - 1) / threadsPerBlock.y);
+	dim3 blocksPerGrid = dim3((DEPTH_W + threadsPerBlock.x - 1) / threadsPerBlock.x, (DEPTH_H + threadsPerBlock.y - 1) / threadsPerBlock.y, count);
 
-	HANDLE_ERROR(cudaMalloc(&depth_device, DEPTH_H * DEPTH_W * sizeof(UINT16)));
+	if (events != NULL) {
+		HANDLE_ERROR(cudaEventRecord(events[0]));
+	}
+	kernelFilterToDisparity << <blocksPerGrid, threadsPerBlock >> > (depth_device, depthFloat_device, median);
+	cudaGetLastError();
+
+	float* source = depthFloat_device;
+	float* target = buffer_device;
+	for (int s = 0; s < stageCount; s++) {
+		if (events != NULL) {
+			HANDLE_ERROR(cudaEventRecord(events[s + 1]));
+		}
+		if (!stages[s].enabled) {
+			continue;
+		}
+		int launches = (stages[s].type == DepthFilter::STAGE_SPATIAL) ? 2 * stages[s].passes : (stages[s].type == DepthFilter::STAGE_FILL_HOLES ? stages[s].passes : 1);
+		for (int i = 0; i < launches; i++) {
+			if (stages[s].type == DepthFilter::STAGE_SPATIAL && i % 2 == 0) {
+				kernelSFVertical << <blocksPerGrid, threadsPerBlock >> > (source, target, s);
+			} else if (stages[s].type == DepthFilter::STAGE_SPATIAL) {
+				kernelSFHorizontal << <blocksPerGrid, threadsPerBlock >> > (source, target, s);
+			} else if (stages[s].type == DepthFilter::STAGE_FILL_HOLES) {
+				kernelFillHoles << <blocksPerGrid, threadsPerBlock >> > (source, target, s);
+			} else {
+				kernelTemporalFilter << <blocksPerGrid, threadsPerBlock >> > (source, target, lastFrame_device, s);
+			}
+			cudaGetLastError();
+			float* temp = source;
+			source = target;
+			target = temp;
+		}
+	}
+
+	if (events != NULL) {
+		HANDLE_ERROR(cudaEventRecord(events[stageCount + 1]));
+	}
+	kernelFilterToDepth << <blocksPerGrid, threadsPerBlock >> > (source, depthFloat_device);
+	cudaGetLastError();
+	if (events != NULL) {
+		HANDLE_ERROR(cudaEventRecord(events[stageCount + 2]));
+	}
+}
+
+void depthFilterFused(int count, UINT16* depth_device, float* depthFloat_device, float* lastFrame_device, int stageCount, int halo, bool median) {
+	dim3 threadsPerBlock = dim3(FUSED_TILE_W, 8);
+	dim3 blocksPerGrid = dim3((DEPTH_W + FUSED_TILE_W - 1) / FUSED_TILE_W, (DEPTH_H + FUSED_TILE_H - 1) / FUSED_TILE_H, count);
+
+	kernelFusedFilter << <blocksPerGrid, threadsPerBlock >> > (depth_device, depthFloat_device, lastFrame_device, stageCount, halo, median);
+	cudaGetLastError();
+}
+
+extern "C"
+void cudaDepthFilterInit(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device, float*& buffer_device, float*& guide_device) {
+	HANDLE_ERROR(cudaMalloc(&depth_device, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(UINT16)));
 	HANDLE_ERROR(cudaMalloc(&depthFloat_device, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(float)));
 	HANDLE_ERROR(cudaMalloc(&lastFrame_device, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(float)));
+	HANDLE_ERROR(cudaMalloc(&buffer_device, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(float)));
+	HANDLE_ERROR(cudaMalloc(&guide_device, MAX_CAMERAS * GUIDE_PLANES * DEPTH_H * DEPTH_W * sizeof(float)));
+}
+
+extern "C"
+void cudaDepthFilterReset(float* lastFrame_device) {
+	dim3 threadsPerBlock = dim3(256, 1);
+	dim3 blocksPerGrid = dim3((DEPTH_W + threadsPerBlock.x - 1) / threadsPerBlock.x, (DEPTH_H + threadsPerBlock.y - 1) / threadsPerBlock.y);
+
 	for (int i = 0; i < MAX_CAMERAS; i++) {
 		kernelCleanLastFrame << <blocksPerGrid, threadsPerBlock >> > (lastFrame_device + i * DEPTH_H * DEPTH_W);
 		cudaGetLastError();
@@ -207,35 +611,162 @@ void cudaDepthFilterInit(UINT16*& depth_device, float*& depthFloat_device, float
 }
 
 extern "C"
-void cudaDepthFilterClean(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device) {
+void cudaDepthFilterClean(UINT16*& depth_device, float*& depthFloat_device, float*& lastFrame_device, float*& buffer_device, float*& guide_device) {
 	HANDLE_ERROR(cudaFree(depth_device));
 	HANDLE_ERROR(cudaFree(depthFloat_device));
 	HANDLE_ERROR(cudaFree(lastFrame_device));
+	HANDLE_ERROR(cudaFree(buffer_device));
+	HANDLE_ERROR(cudaFree(guide_device));
+}
+
+// Filters the count packed raw frames of depthMaps, frame k belongs to camera cameras[k]. The upload only runs
+// asynchronously when depthMaps is page-locked. Every kernel is launched once for all the frames. With stageTimes the
+// chain runs with an event around every stage and the call waits for it, see DepthFilter::getStageTimes.
+extern "C"
+void cudaDepthFiltering(int count, const int* cameras, const float* convertFactors, UINT16* depthMaps, UINT16* depth_device, float* depthFloat_device, float* lastFrame_device, float* buffer_device, int stageCount, const FilterStage* stages, bool median, bool fused, float* stageTimes) {
+	HANDLE_ERROR(cudaMemcpyAsync(depth_device, depthMaps, count * DEPTH_H * DEPTH_W * sizeof(UINT16), cudaMemcpyHostToDevice));
+	setFilterCameras(count, cameras, convertFactors);
+	setFilterStages(stageCount, stages);
+
+	int halo = fusedHalo(stageCount, stages);
+	if (fused && halo >= 0 && stageTimes == NULL) {
+		depthFilterFused(count, depth_device, depthFloat_device, lastFrame_device, stageCount, halo, median);
+	} else if (stageTimes == NULL) {
+		depthFilterChain(count, depth_device, depthFloat_device, lastFrame_device, buffer_device, stageCount, stages, median, NULL);
+	} else {
+		cudaEvent_t events[DepthFilter::MAX_STAGES + 3];
+		for (int i = 0; i < stageCount + 3; i++) {
+			HANDLE_ERROR(cudaEventCreate(&events[i]));
+		}
+		depthFilterChain(count, depth_device, depthFloat_device, lastFrame_device, buffer_device, stageCount, stages, median, events);
+		HANDLE_ERROR(cudaEventSynchronize(events[stageCount + 2]));
+		for (int i = 0; i < stageCount + 2; i++) {
+			HANDLE_ERROR(cudaEventElapsedTime(&stageTimes[i], events[i], events[i + 1]));
+		}
+		for (int i = 0; i < stageCount + 3; i++) {
+			HANDLE_ERROR(cudaEventDestroy(events[i]));
+		}
+	}
+}
+
+// Guided filter of the filtered depth of the count cameras, in meters, with the aligned color of the same cameras.
+// Each pass is launched once for all of them.
+extern "C"
+void cudaDepthFilterGuide(int count, const int* cameras, float* depthFloat_device, RGBQUAD* alignedColor_device, float* guide_device, int radius, float epsilon) {
+	const int RUNS_W = (DEPTH_W + GUIDE_RUN - 1) / GUIDE_RUN;
+	const int RUNS_H = (DEPTH_H + GUIDE_RUN - 1) / GUIDE_RUN;
+	dim3 threadsPerBlock = dim3(32, 8);
+	dim3 rowBlocks = dim3((RUNS_W + threadsPerBlock.x - 1) / threadsPerBlock.x, (DEPTH_H + threadsPerBlock.y - 1) / threadsPerBlock.y, count);
+	dim3 columnBlocks = dim3((DEPTH_W + threadsPerBlock.x - 1) / threadsPerBlock.x, (RUNS_H + threadsPerBlock.y - 1) / threadsPerBlock.y, count);
+
+	setFilterCameras(count, cameras, NULL);
+	kernelGuideRows << <rowBlocks, threadsPerBlock >> > (depthFloat_device, (uchar4*)alignedColor_device, guide_device, radius);
+	cudaGetLastError();
+	kernelGuideCoefficients << <columnBlocks, threadsPerBlock >> > (guide_device, radius, epsilon);
+	cudaGetLastError();
+	kernelGuideCoefficientRows << <rowBlocks, threadsPerBlock >> > (guide_device, radius);
+	cudaGetLastError();
+	kernelGuideOutput << <columnBlocks, threadsPerBlock >> > (depthFloat_device, (uchar4*)alignedColor_device, guide_device, radius);
+	cudaGetLastError();
 }
 
+// Times every kernel of the chain and the fused kernel on one frame, as ms per frame together with the launches per
+// frame, in the order to disparity, spatial vertical, spatial horizontal, fill holes, temporal, to depth, fused. The
+// stages are a spatial, a fill holes and a temporal one in this order. The
+// global memory traffic is estimated from the bytes each thread reads and writes, with the neighbourhoods served by the
+// cache, and the halo of the fused tiles counted every time it is read. mismatches counts the pixels whose depth or
+// temporal state differs after two frames through the chain and through the fused kernel.
 extern "C"
-void cudaDepthFiltering(UINT16* depthMap, UINT16* depth_device, float* depthFloat_device, float* lastFrame_device, float convertFactor) {
+void cudaBenchmarkDepthFilter(UINT16* depthMap, float convertFactor, const FilterStage* stages, int iterations, int* launches, float* kernelTime, double* kernelBytes, int& mismatches) {
+	const int KERNELS = 7;
+	const double PIXELS = DEPTH_H * DEPTH_W;
 	dim3 threadsPerBlock = dim3(256, 1);
 	dim3 blocksPerGrid = dim3((DEPTH_W + threadsPerBlock.x - 1) / threadsPerBlock.x, (DEPTH_H + threadsPerBlock.y - 1) / threadsPerBlock.y);
+	dim3 fusedThreads = dim3(FUSED_TILE_W, 8);
+	dim3 fusedBlocks = dim3((DEPTH_W + FUSED_TILE_W - 1) / FUSED_TILE_W, (DEPTH_H + FUSED_TILE_H - 1) / FUSED_TILE_H);
 
+	UINT16* depth_device;
+	float* depthFloat_device[2];
+	float* lastFrame_device[2];
+	float* buffer_device;
+	HANDLE_ERROR(cudaMalloc(&depth_device, DEPTH_H * DEPTH_W * sizeof(UINT16)));
+	HANDLE_ERROR(cudaMalloc(&buffer_device, DEPTH_H * DEPTH_W * sizeof(float)));
+	for (int i = 0; i < 2; i++) {
+		HANDLE_ERROR(cudaMalloc(&depthFloat_device[i], DEPTH_H * DEPTH_W * sizeof(float)));
+		HANDLE_ERROR(cudaMalloc(&lastFrame_device[i], DEPTH_H * DEPTH_W * sizeof(float)));
+		HANDLE_ERROR(cudaMemset(lastFrame_device[i], 0, DEPTH_H * DEPTH_W * sizeof(float)));
+	}
 	HANDLE_ERROR(cudaMemcpy(depth_device, depthMap, DEPTH_H * DEPTH_W * sizeof(UINT16), cudaMemcpyHostToDevice));
-	kernelFilterToDisparity << <blocksPerGrid, threadsPerBlock >> > (depth_device, depthFloat_device, convertFactor);
-	cudaGetLastError();
+	int camera = 0;
+	setFilterCameras(1, &camera, &convertFactor);
+	setFilterStages(3, stages);
+	int halo = fusedHalo(3, stages);
+
+	int frameLaunches[KERNELS] = { 1, stages[0].passes, stages[0].passes, stages[1].passes, 1, 1, 1 };
+	double launchBytes[KERNELS] = { PIXELS * (2 + 4), PIXELS * 8, PIXELS * 8, PIXELS * 8, PIXELS * 16, PIXELS * 8,
+		fusedBlocks.x * fusedBlocks.y * (FUSED_TILE_W + 2 * halo + 2) * (FUSED_TILE_H + 2 * halo + 2) * 2.0 + PIXELS * 12 };
+	float* a = depthFloat_device[0];
+	float* b = depthFloat_device[1];
+
+	cudaEvent_t start, stop;
+	HANDLE_ERROR(cudaEventCreate(&start));
+	HANDLE_ERROR(cudaEventCreate(&stop));
+	kernelFilterToDisparity << <blocksPerGrid, threadsPerBlock >> > (depth_device, a, true);
+	for (int k = 0; k < KERNELS; k++) {
+		HANDLE_ERROR(cudaEventRecord(start));
+		for (int i = 0; i < iterations; i++) {
+			switch (k) {
+			case 0: kernelFilterToDisparity << <blocksPerGrid, threadsPerBlock >> > (depth_device, buffer_device, true); break;
+			case 1: kernelSFVertical << <blocksPerGrid, threadsPerBlock >> > (a, buffer_device, 0); break;
+			case 2: kernelSFHorizontal << <blocksPerGrid, threadsPerBlock >> > (a, buffer_device, 0); break;
+			case 3: kernelFillHoles << <blocksPerGrid, threadsPerBlock >> > (a, buffer_device, 1); break;
+			case 4: kernelTemporalFilter << <blocksPerGrid, threadsPerBlock >> > (a, b, lastFrame_device[0], 2); break;
+			case 5: kernelFilterToDepth << <blocksPerGrid, threadsPerBlock >> > (b, b); break;
+			default: kernelFusedFilter << <fusedBlocks, fusedThreads >> > (depth_device, b, lastFrame_device[1], 3, halo, true); break;
+			}
+		}
+		HANDLE_ERROR(cudaEventRecord(stop));
+		HANDLE_ERROR(cudaEventSynchronize(stop));
+		HANDLE_ERROR(cudaGetLastError());
+		HANDLE_ERROR(cudaEventElapsedTime(&kernelTime[k], start, stop));
+		kernelTime[k] = kernelTime[k] / iterations * frameLaunches[k];
+		launches[k] = frameLaunches[k];
+		kernelBytes[k] = launchBytes[k] * frameLaunches[k];
+	}
 
+	// The second frame goes through the temporal filter with the state the first one left
 	for (int i = 0; i < 2; i++) {
-		kernelSFVertical << <blocksPerGrid, threadsPerBlock >> > (depthFloat_device);
-		cudaGetLastError();
-		kernelSFHorizontal << <blocksPerGrid, threadsPerBlock >> > (depthFloat_device);
-		cudaGetLastError();
+		HANDLE_ERROR(cudaMemset(lastFrame_device[i], 0, DEPTH_H * DEPTH_W * sizeof(float)));
+	}
+	for (int frame = 0; frame < 2; frame++) {
+		depthFilterChain(1, depth_device, depthFloat_device[0], lastFrame_device[0], buffer_device, 3, stages, true, NULL);
+		depthFilterFused(1, depth_device, depthFloat_device[1], lastFrame_device[1], 3, halo, true);
 	}
+	HANDLE_ERROR(cudaDeviceSynchronize());
 
-	for (int i = 0; i < 3; i++) {
-		kernelFillHoles << <blocksPerGrid, threadsPerBlock >> > (depthFloat_device);
-		cudaGetLastError();
+	float* result_host[2];
+	float* lastFrame_host[2];
+	for (int i = 0; i < 2; i++) {
+		result_host[i] = new float[DEPTH_H * DEPTH_W];
+		lastFrame_host[i] = new float[DEPTH_H * DEPTH_W];
+		HANDLE_ERROR(cudaMemcpy(result_host[i], depthFloat_device[i], DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyDeviceToHost));
+		HANDLE_ERROR(cudaMemcpy(lastFrame_host[i], lastFrame_device[i], DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyDeviceToHost));
+	}
+	mismatches = 0;
+	for (int i = 0; i < DEPTH_H * DEPTH_W; i++) {
+		if (memcmp(result_host[0] + i, result_host[1] + i, sizeof(float)) != 0 || memcmp(lastFrame_host[0] + i, lastFrame_host[1] + i, sizeof(float)) != 0) {
+			mismatches++;
+		}
 	}
 
-	kernelTemporalFilter << <blocksPerGrid, threadsPerBlock >> > (depthFloat_device, lastFrame_device);
-	cudaGetLastError();
-	kernelFilterToDepth << <blocksPerGrid, threadsPerBlock >> > (depthFloat_device, convertFactor);
-	cudaGetLastError();
+	for (int i = 0; i < 2; i++) {
+		delete[] result_host[i];
+		delete[] lastFrame_host[i];
+		HANDLE_ERROR(cudaFree(depthFloat_device[i]));
+		HANDLE_ERROR(cudaFree(lastFrame_device[i]));
+	}
+	HANDLE_ERROR(cudaEventDestroy(start));
+	HANDLE_ERROR(cudaEventDestroy(stop));
+	HANDLE_ERROR(cudaFree(depth_device));
+	HANDLE_ERROR(cudaFree(buffer_device));
 }
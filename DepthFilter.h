@@ -2,20 +2,96 @@
 #define DEPTH_FILTER_H
 
 #include <Windows.h>
+#include <atomic>
 #include "Parameters.h"
 
+// One step of the depth filter between the conversion of the raw depth to disparity and back. Plain data so that it
+// can be passed through the DLL API. The fields a type does not use are ignored.
+struct FilterStage {
+	int type;
+	int enabled;
+	int passes; // spatial and fill holes
+	int radius; // spatial, in pixels along each axis
+	float alpha; // spatial weight of the next neighbour, temporal weight of the new frame
+	float threshold; // spatial and temporal, largest disparity difference that is still averaged
+	int neighbours; // fill holes, pixels with depth around a hole needed to fill it
+};
+
 class DepthFilter {
+public:
+	enum StageType { STAGE_SPATIAL = 0, STAGE_FILL_HOLES = 1, STAGE_TEMPORAL = 2 };
+	static const int MAX_STAGES = 8;
+	static const int MAX_RADIUS = 8;
+	static const int MAX_PASSES = 4;
+	static const int MAX_GUIDE_RADIUS = 16;
+
+private:
 	UINT16* depth_device;
 	float* depthFloat_device;
 	float* lastFrame_device;
+	float* buffer_device;
+	float* guide_device;
+	UINT16* depthMaps_host;
 	float convertFactor[MAX_CAMERAS];
+	bool fused;
+	std::atomic<bool> median;
+	std::atomic<bool> medianOnCapture;
+	bool profiling;
+	int stageCount;
+	FilterStage stages[MAX_STAGES];
+	float stageTimes[MAX_STAGES + 2];
+	bool guided;
+	int guideRadius;
+	float guideEpsilon;
+
 public:
 	DepthFilter();
 	~DepthFilter();
 	void process(int cameraId, UINT16* depthMap);
+	// Filters the frames of every camera with check set, on the GPU with one upload and one launch per kernel
+	void process(int cameras, bool* check, UINT16** depthMaps);
 	void setConvertFactor(int cameraId, float converFactor) {
 		this->convertFactor[cameraId] = converFactor;
 	}
+	// On the GPU the passes run either as one kernel over shared memory tiles or as one kernel per pass. The fused
+	// kernel needs the temporal stage last and the neighbourhoods of all stages within its halo, the chain is used
+	// for the other pipelines.
+	void setFused(bool fused) {
+		this->fused = fused;
+	}
+	// The 5 pixel median of the raw depth before the conversion to disparity
+	void setMedian(bool median) {
+		this->median = median;
+	}
+	// The median runs in the capture threads of the grabber with DepthMedian instead, and process takes the raw depth
+	// as already filtered. The capture threads ask isMedianOnCapture for every frame, so the frames already waiting
+	// in their rings when either setting changes are filtered as they were captured.
+	void setMedianOnCapture(bool onCapture) {
+		this->medianOnCapture = onCapture;
+	}
+	bool isMedianOnCapture() {
+		return median && medianOnCapture;
+	}
+	static FilterStage getDefaultStage(int type);
+	// The stages in the order they run, out of range parameters are clamped. Changing them restarts the temporal filter.
+	void setStages(int count, const FilterStage* stages);
+	int getStages(FilterStage* stages);
+	void resetStages();
+	// Per stage timing runs the chain and waits for every frame. The times in ms of the last process are the
+	// conversion to disparity, every stage and the conversion to depth.
+	void setProfiling(bool profiling) {
+		this->profiling = profiling;
+	}
+	int getStageTimes(float* times);
+	// The guided filter smooths the depth in meters with the aligned color as the guide, so that it follows the edges
+	// of the color. radius is the half width of its box in pixels, epsilon the variance of the intensity in [0, 1]
+	// below which a box is flattened rather than kept as an edge. Every box is refilled once per run of 32 pixels, so
+	// a pass reads (32 + 2 * radius) / 32 pixels per pixel, twice as many at MAX_GUIDE_RADIUS as at radius 0.
+	void setGuide(bool guided, int radius, float epsilon);
+	void getGuide(bool& guided, int& radius, float& epsilon);
+	// Runs the guided filter on the frames of the cameras with check set, alignedColor is what AlignColorMap made of
+	// the depth of process. Holes stay holes.
+	void guide(int cameras, bool* check, RGBQUAD* alignedColor_device);
 	float* getCurrFrame_device() {
 		return depthFloat_device;
 	}
@@ -0,0 +1,324 @@
+#include <Windows.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "Parameters.h"
+#include "DepthFilter.h"
+#include "Timer.h"
+
+// CPU reference of DepthFilter.cu. Every pass reads the previous result and writes a separate buffer,
+// rows are distributed over the OpenMP threads and the inner loops run over contiguous pixels.
+
+void cpuFilterToDisparity(UINT16* source, float* target, float convertFactor, bool median) {
+	#define DEPTH_SORT(a, b) { if ((a) > (b)) {UINT16 temp = (a); (a) = (b); (b) = temp;} }
+
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int x = 0; x < DEPTH_W; x++) {
+			int id = y * DEPTH_W + x;
+			if (!median) {
+				target[id] = (source[id] != 0) ? convertFactor / source[id] : 0;
+				continue;
+			}
+			UINT16 arr[5] = { source[id], 0, 0, 0, 0 };
+			if (x - 1 >= 0) arr[1] = source[id - 1];
+			if (x + 1 < DEPTH_W) arr[2] = source[id + 1];
+			if (y - 1 >= 0) arr[3] = source[id - DEPTH_W];
+			if (y + 1 < DEPTH_H) arr[4] = source[id + DEPTH_W];
+			DEPTH_SORT(arr[0], arr[1]);
+			DEPTH_SORT(arr[0], arr[2]);
+			DEPTH_SORT(arr[0], arr[3]);
+			DEPTH_SORT(arr[0], arr[4]);
+			DEPTH_SORT(arr[1], arr[2]);
+			DEPTH_SORT(arr[1], arr[3]);
+			DEPTH_SORT(arr[1], arr[4]);
+			DEPTH_SORT(arr[2], arr[3]);
+			DEPTH_SORT(arr[2], arr[4]);
+			DEPTH_SORT(arr[3], arr[4]);
+			if (arr[0] != 0) {
+				target[id] = convertFactor / arr[2];
+			} else
+			if (arr[1] != 0) {
+				target[id] = convertFactor * 2 / (arr[2] + arr[3]);
+			} else
+			if (arr[2] != 0) {
+				target[id] = convertFactor / arr[3];
+			} else
+			if (arr[3] != 0) {
+				target[id] = convertFactor * 2 / (arr[3] + arr[4]);
+			} else
+			if (arr[4] != 0) {
+				target[id] = convertFactor / arr[4];
+			} else {
+				target[id] = 0;
+			}
+		}
+	}
+}
+
+// Spatial filter along (dx, dy), kernelSFVertical and kernelSFHorizontal in one loop.
+void cpuSpatialFilter(float* source, float* target, int dx, int dy, const FilterStage& stage) {
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int x = 0; x < DEPTH_W; x++) {
+			int id = y * DEPTH_W + x;
+			float origin = source[id];
+			float result = 0;
+			if (origin != 0) {
+				float sum = origin;
+				float weight = 1;
+				float w = 1;
+				for (int r = 1; r <= stage.radius; r++) {
+					w *= stage.alpha;
+					if (x - r * dx >= 0 && y - r * dy >= 0) {
+						float d = source[id - r * (dx + dy * DEPTH_W)];
+						if (d != 0 && fabs(d - origin) <= stage.threshold) {
+							weight += w;
+							sum += w * d;
+						}
+					}
+					if (x + r * dx < DEPTH_W && y + r * dy < DEPTH_H) {
+						float d = source[id + r * (dx + dy * DEPTH_W)];
+						if (d != 0 && fabs(d - origin) <= stage.threshold) {
+							weight += w;
+							sum += w * d;
+						}
+					}
+				}
+				result = sum / weight;
+			}
+			target[id] = result;
+		}
+	}
+}
+
+void cpuFillHoles(float* source, float* target, const FilterStage& stage) {
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int x = 0; x < DEPTH_W; x++) {
+			int id = y * DEPTH_W + x;
+			float result = source[id];
+			int cnt = 0;
+			if (result == 0) {
+				for (int xx = x - 1; xx <= x + 1; xx++) {
+					for (int yy = y - 1; yy <= y + 1; yy++) {
+						if (0 <= xx && xx < DEPTH_W && 0 <= yy && yy < DEPTH_H && (xx != x || yy != y)) {
+							float currDepth = source[yy * DEPTH_W + xx];
+							if (currDepth != 0) {
+								cnt++;
+								result = max(result, currDepth);
+							}
+						}
+					}
+				}
+			}
+			target[id] = (cnt >= stage.neighbours) ? result : source[id];
+		}
+	}
+}
+
+void cpuTemporalFilter(float* source, float* target, float* lastFrame, const FilterStage& stage) {
+	#pragma omp parallel for
+	for (int id = 0; id < DEPTH_H * DEPTH_W; id++) {
+		float result = source[id];
+		float lastDepth = lastFrame[id];
+		if (lastDepth != 0 && fabs(result - lastDepth) <= stage.threshold) {
+			result = result * stage.alpha + lastDepth * (1 - stage.alpha);
+		}
+		target[id] = result;
+		lastFrame[id] = result;
+	}
+}
+
+void cpuFilterToDepth(float* source, float* depth, float convertFactor) {
+	#pragma omp parallel for
+	for (int id = 0; id < DEPTH_H * DEPTH_W; id++) {
+		if (source[id] != 0) {
+			depth[id] = convertFactor / source[id] * 0.001; //to m
+		} else {
+			depth[id] = 0;
+		}
+	}
+}
+
+// Intensity in [0, 1] of the aligned color at a depth pixel, the color holds R, G and B in the first three bytes
+float cpuGuideIntensity(const UINT8* color, int x, int y) {
+	const UINT8* c = color + ((y * COLOR_H / DEPTH_H) * COLOR_W + x * COLOR_W / DEPTH_W) * 4;
+	return (0.299f * c[0] + 0.587f * c[1] + 0.114f * c[2]) / 255;
+}
+
+// Sums of the boxes of 2 * radius + 1 pixels along the rows of channels planes, with a running sum per row
+void cpuGuideBoxRows(const float* source, float* target, int channels, int radius) {
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int c = 0; c < channels; c++) {
+			const float* row = source + c * DEPTH_H * DEPTH_W + y * DEPTH_W;
+			float* result = target + c * DEPTH_H * DEPTH_W + y * DEPTH_W;
+			float sum = 0;
+			for (int x = 0; x < min(DEPTH_W, radius); x++) {
+				sum += row[x];
+			}
+			for (int x = 0; x < DEPTH_W; x++) {
+				if (x + radius < DEPTH_W) {
+					sum += row[x + radius];
+				}
+				result[x] = sum;
+				if (x - radius >= 0) {
+					sum -= row[x - radius];
+				}
+			}
+		}
+	}
+}
+
+// The same along the columns, the running sums of a whole row of columns are kept so that the loops stay contiguous
+void cpuGuideBoxColumns(const float* source, float* target, int channels, int radius) {
+	#pragma omp parallel for
+	for (int c = 0; c < channels; c++) {
+		const float* plane = source + c * DEPTH_H * DEPTH_W;
+		float* result = target + c * DEPTH_H * DEPTH_W;
+		std::vector<float> sum(DEPTH_W, 0.0f);
+		for (int y = 0; y < min(DEPTH_H, radius); y++) {
+			for (int x = 0; x < DEPTH_W; x++) {
+				sum[x] += plane[y * DEPTH_W + x];
+			}
+		}
+		for (int y = 0; y < DEPTH_H; y++) {
+			for (int x = 0; x < DEPTH_W; x++) {
+				if (y + radius < DEPTH_H) {
+					sum[x] += plane[(y + radius) * DEPTH_W + x];
+				}
+				result[y * DEPTH_W + x] = sum[x];
+				if (y - radius >= 0) {
+					sum[x] -= plane[(y - radius) * DEPTH_W + x];
+				}
+			}
+		}
+	}
+}
+
+// Guided filter of kernelGuide*, in meters and in place. The running sums cover whole rows and columns here, so the
+// result matches the GPU up to rounding.
+extern "C"
+void cpuDepthFilterGuide(float* depth, RGBQUAD* alignedColor, int radius, float epsilon) {
+	const int PIXELS = DEPTH_H * DEPTH_W;
+	thread_local std::vector<float> inputBuffer(5 * PIXELS);
+	thread_local std::vector<float> rowBuffer(5 * PIXELS);
+	float* input = inputBuffer.data();
+	float* rows = rowBuffer.data();
+	const UINT8* color = (const UINT8*)alignedColor;
+
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int x = 0; x < DEPTH_W; x++) {
+			int id = y * DEPTH_W + x;
+			float p = depth[id];
+			float I = (p != 0) ? cpuGuideIntensity(color, x, y) : 0;
+			input[id] = (p != 0) ? 1.0f : 0.0f;
+			input[PIXELS + id] = I;
+			input[2 * PIXELS + id] = p;
+			input[3 * PIXELS + id] = I * I;
+			input[4 * PIXELS + id] = I * p;
+		}
+	}
+	cpuGuideBoxRows(input, rows, 5, radius);
+	cpuGuideBoxColumns(rows, input, 5, radius);
+
+	// The coefficients a and b and their weight replace the first three planes
+	#pragma omp parallel for
+	for (int id = 0; id < PIXELS; id++) {
+		float count = input[id];
+		float a = 0;
+		float b = 0;
+		float weight = 0;
+		if (count > 0) {
+			float meanI = input[PIXELS + id] / count;
+			float meanP = input[2 * PIXELS + id] / count;
+			float varI = max(input[3 * PIXELS + id] / count - meanI * meanI, 0.0f);
+			float covIP = input[4 * PIXELS + id] / count - meanI * meanP;
+			a = covIP / (varI + epsilon);
+			b = meanP - a * meanI;
+			weight = 1;
+		}
+		input[id] = a;
+		input[PIXELS + id] = b;
+		input[2 * PIXELS + id] = weight;
+	}
+	cpuGuideBoxRows(input, rows, 3, radius);
+	cpuGuideBoxColumns(rows, input, 3, radius);
+
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int x = 0; x < DEPTH_W; x++) {
+			int id = y * DEPTH_W + x;
+			if (depth[id] != 0 && input[2 * PIXELS + id] > 0) {
+				depth[id] = (input[id] * cpuGuideIntensity(color, x, y) + input[PIXELS + id]) / input[2 * PIXELS + id];
+			}
+		}
+	}
+}
+
+extern "C"
+void cpuDepthFilterInit(UINT16*& depth, float*& depthFloat, float*& lastFrame) {
+	depth = new UINT16[DEPTH_H * DEPTH_W];
+	depthFloat = new float[MAX_CAMERAS * DEPTH_H * DEPTH_W];
+	lastFrame = new float[MAX_CAMERAS * DEPTH_H * DEPTH_W];
+	memset(depthFloat, 0, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(float));
+	memset(lastFrame, 0, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(float));
+}
+
+extern "C"
+void cpuDepthFilterReset(float* lastFrame) {
+	memset(lastFrame, 0, MAX_CAMERAS * DEPTH_H * DEPTH_W * sizeof(float));
+}
+
+extern "C"
+void cpuDepthFilterClean(UINT16*& depth, float*& depthFloat, float*& lastFrame) {
+	delete[] depth;
+	delete[] depthFloat;
+	delete[] lastFrame;
+}
+
+// stageTimes, when not NULL, accumulates the time of every stage as DepthFilter::getStageTimes reports it
+extern "C"
+void cpuDepthFiltering(UINT16* depthMap, UINT16* depth, float* depthFloat, float* lastFrame, float convertFactor, int stageCount, const FilterStage* stages, bool median, float* stageTimes) {
+	thread_local std::vector<float> temp(DEPTH_H * DEPTH_W);
+	Timer timer;
+
+	timer.reset();
+	memcpy(depth, depthMap, DEPTH_H * DEPTH_W * sizeof(UINT16));
+	cpuFilterToDisparity(depth, depthFloat, convertFactor, median);
+	if (stageTimes != NULL) {
+		stageTimes[0] += timer.getTime() * 1000;
+	}
+
+	float* source = depthFloat;
+	float* target = temp.data();
+	for (int s = 0; s < stageCount; s++) {
+		timer.reset();
+		const FilterStage& stage = stages[s];
+		int passes = (stage.type == DepthFilter::STAGE_TEMPORAL) ? 1 : stage.passes;
+		for (int i = 0; stage.enabled && i < passes; i++) {
+			if (stage.type == DepthFilter::STAGE_SPATIAL) {
+				cpuSpatialFilter(source, target, 0, 1, stage);
+				std::swap(source, target);
+				cpuSpatialFilter(source, target, 1, 0, stage);
+			} else if (stage.type == DepthFilter::STAGE_FILL_HOLES) {
+				cpuFillHoles(source, target, stage);
+			} else {
+				cpuTemporalFilter(source, target, lastFrame, stage);
+			}
+			std::swap(source, target);
+		}
+		if (stageTimes != NULL) {
+			stageTimes[s + 1] += timer.getTime() * 1000;
+		}
+	}
+
+	timer.reset();
+	cpuFilterToDepth(source, depthFloat, convertFactor);
+	if (stageTimes != NULL) {
+		stageTimes[stageCount + 1] += timer.getTime() * 1000;
+	}
+}
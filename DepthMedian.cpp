@@ -0,0 +1,164 @@
+#include "DepthMedian.h"
+#include <intrin.h>
+#include <immintrin.h>
+
+namespace DepthMedianNamespace {
+	const UINT16 ZERO_ROW[DEPTH_W] = { 0 };
+
+	// Loads, stores, the unsigned 16 bit minimum, maximum and rounded mean, and the selection by the zero lanes of
+	// one register of every instruction set. SSE2 has no unsigned minimum or maximum, a - b saturated at 0 gives
+	// them: a minus it is the minimum, plus b the maximum.
+	struct Sse2 {
+		typedef __m128i Vector;
+		typedef __m128i Mask;
+		static const int LANES = 8;
+		static Vector load(const UINT16* p) { return _mm_loadu_si128((const __m128i*)p); }
+		static void store(UINT16* p, Vector v) { _mm_storeu_si128((__m128i*)p, v); }
+		static Vector minimum(Vector a, Vector b) { return _mm_sub_epi16(a, _mm_subs_epu16(a, b)); }
+		static Vector maximum(Vector a, Vector b) { return _mm_adds_epu16(_mm_subs_epu16(a, b), b); }
+		static Vector mean(Vector a, Vector b) { return _mm_avg_epu16(a, b); }
+		static Mask isZero(Vector v) { return _mm_cmpeq_epi16(v, _mm_setzero_si128()); }
+		static Vector select(Mask mask, Vector a, Vector b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+	};
+	struct Avx2 {
+		typedef __m256i Vector;
+		typedef __m256i Mask;
+		static const int LANES = 16;
+		static Vector load(const UINT16* p) { return _mm256_loadu_si256((const __m256i*)p); }
+		static void store(UINT16* p, Vector v) { _mm256_storeu_si256((__m256i*)p, v); }
+		static Vector minimum(Vector a, Vector b) { return _mm256_min_epu16(a, b); }
+		static Vector maximum(Vector a, Vector b) { return _mm256_max_epu16(a, b); }
+		static Vector mean(Vector a, Vector b) { return _mm256_avg_epu16(a, b); }
+		static Mask isZero(Vector v) { return _mm256_cmpeq_epi16(v, _mm256_setzero_si256()); }
+		static Vector select(Mask mask, Vector a, Vector b) { return _mm256_blendv_epi8(b, a, mask); }
+	};
+	struct Avx512 {
+		typedef __m512i Vector;
+		typedef __mmask32 Mask;
+		static const int LANES = 32;
+		static Vector load(const UINT16* p) { return _mm512_loadu_si512(p); }
+		static void store(UINT16* p, Vector v) { _mm512_storeu_si512(p, v); }
+		static Vector minimum(Vector a, Vector b) { return _mm512_min_epu16(a, b); }
+		static Vector maximum(Vector a, Vector b) { return _mm512_max_epu16(a, b); }
+		static Vector mean(Vector a, Vector b) { return _mm512_avg_epu16(a, b); }
+		static Mask isZero(Vector v) { return _mm512_cmpeq_epi16_mask(v, _mm512_setzero_si512()); }
+		static Vector select(Mask mask, Vector a, Vector b) { return _mm512_mask_blend_epi16(mask, b, a); }
+	};
+	// One lane at a time, for the first and the last pixels of a row
+	struct Scalar {
+		typedef UINT16 Vector;
+		typedef bool Mask;
+		static Vector minimum(Vector a, Vector b) { return min(a, b); }
+		static Vector maximum(Vector a, Vector b) { return max(a, b); }
+		static Vector mean(Vector a, Vector b) { return (UINT16)((a + b + 1) >> 1); }
+		static Mask isZero(Vector v) { return v == 0; }
+		static Vector select(Mask mask, Vector a, Vector b) { return mask ? a : b; }
+	};
+}
+using namespace DepthMedianNamespace;
+
+// Sorts the five values with the 9 compare-exchanges of a sorting network in five stages, zeros end up first. Then
+// picks what kernelFilterToDisparity picks by the number of zeros: the median of the values with depth, the rounded
+// mean of the two middle ones when their count is even. The kernel divides by that mean in float, so where the two
+// middle depths have an odd sum the result is half a unit deeper than the one the kernel divides by.
+template <class S>
+inline typename S::Vector medianOf(typename S::Vector v0, typename S::Vector v1, typename S::Vector v2, typename S::Vector v3, typename S::Vector v4) {
+	typedef typename S::Vector Vector;
+	#define MEDIAN_SORT(a, b) { Vector low = S::minimum(a, b); b = S::maximum(a, b); a = low; }
+	MEDIAN_SORT(v0, v3);
+	MEDIAN_SORT(v1, v4);
+	MEDIAN_SORT(v0, v2);
+	MEDIAN_SORT(v1, v3);
+	MEDIAN_SORT(v0, v1);
+	MEDIAN_SORT(v2, v4);
+	MEDIAN_SORT(v1, v2);
+	MEDIAN_SORT(v3, v4);
+	MEDIAN_SORT(v2, v3);
+	#undef MEDIAN_SORT
+
+	Vector result = v4;
+	result = S::select(S::isZero(v3), result, S::mean(v3, v4));
+	result = S::select(S::isZero(v2), result, v3);
+	result = S::select(S::isZero(v1), result, S::mean(v2, v3));
+	result = S::select(S::isZero(v0), result, v2);
+	return result;
+}
+
+// Pixels outside of the frame read as 0 as in the kernel
+inline UINT16 medianPixel(const UINT16* up, const UINT16* row, const UINT16* down, int x) {
+	UINT16 left = (x - 1 >= 0) ? row[x - 1] : 0;
+	UINT16 right = (x + 1 < DEPTH_W) ? row[x + 1] : 0;
+	return medianOf<Scalar>(row[x], left, right, up[x], down[x]);
+}
+
+// The rows above and below the frame are a row of zeros. The vectors start at the second pixel so that the left and
+// right neighbours are unaligned loads within the row, the first pixel and the rest of the row are done one by one.
+template <class S>
+void medianRows(const UINT16* depth, UINT16* target) {
+	for (int y = 0; y < DEPTH_H; y++) {
+		const UINT16* row = depth + y * DEPTH_W;
+		const UINT16* up = (y > 0) ? row - DEPTH_W : ZERO_ROW;
+		const UINT16* down = (y + 1 < DEPTH_H) ? row + DEPTH_W : ZERO_ROW;
+		UINT16* result = target + y * DEPTH_W;
+
+		result[0] = medianPixel(up, row, down, 0);
+		int x = 1;
+		for (; x + S::LANES < DEPTH_W; x += S::LANES) {
+			S::store(result + x, medianOf<S>(S::load(row + x), S::load(row + x - 1), S::load(row + x + 1), S::load(up + x), S::load(down + x)));
+		}
+		for (; x < DEPTH_W; x++) {
+			result[x] = medianPixel(up, row, down, x);
+		}
+	}
+}
+
+void medianRowsScalar(const UINT16* depth, UINT16* target) {
+	for (int y = 0; y < DEPTH_H; y++) {
+		const UINT16* row = depth + y * DEPTH_W;
+		const UINT16* up = (y > 0) ? row - DEPTH_W : ZERO_ROW;
+		const UINT16* down = (y + 1 < DEPTH_H) ? row + DEPTH_W : ZERO_ROW;
+		for (int x = 0; x < DEPTH_W; x++) {
+			target[y * DEPTH_W + x] = medianPixel(up, row, down, x);
+		}
+	}
+}
+
+// target must not be depth, the neighbours are read from the raw depth
+void DepthMedian::filter(int instructionSet, const UINT16* depth, UINT16* target)
+{
+	switch (min(instructionSet, getInstructionSet())) {
+	case MEDIAN_AVX512: medianRows<Avx512>(depth, target); break;
+	case MEDIAN_AVX2: medianRows<Avx2>(depth, target); break;
+	case MEDIAN_SSE2: medianRows<Sse2>(depth, target); break;
+	default: medianRowsScalar(depth, target); break;
+	}
+}
+
+// AVX2 and AVX-512 also need the OS to save their registers, which XCR0 tells
+int DepthMedian::getInstructionSet()
+{
+	static const int instructionSet = []() {
+		int info[4];
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		bool avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+		if (avx512 && (xcr0 & 0xE6) == 0xE6) {
+			return (int)MEDIAN_AVX512;
+		}
+		if (avx && avx2 && (xcr0 & 0x6) == 0x6) {
+			return (int)MEDIAN_AVX2;
+		}
+		return (int)MEDIAN_SSE2;
+	}();
+	return instructionSet;
+}
+
+const char* DepthMedian::getName(int instructionSet)
+{
+	const char* NAMES[4] = { "scalar", "SSE2", "AVX2", "AVX-512" };
+	return NAMES[instructionSet];
+}
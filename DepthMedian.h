@@ -0,0 +1,24 @@
+#ifndef DEPTH_MEDIAN_H
+#define DEPTH_MEDIAN_H
+
+#include <Windows.h>
+#include "Parameters.h"
+
+// Host version of the 5 pixel cross median that kernelFilterToDisparity takes of the raw Z16 depth, for the capture
+// threads. The result is the depth the conversion to disparity divides by, so the depth filter with its median off
+// gives the same bits from it as with its median on from the raw depth, except where the kernel divides by the mean
+// of two middle depths with an odd sum, which is rounded up here. Runs on 32, 16 or 8 pixels at a time with
+// AVX-512, AVX2 or SSE2. The filter is bound by memory and the unaligned neighbours of a 64 byte register cross a
+// cache line on every load, so AVX2 is used by default where the CPU has it, see Benchmark::depthFilter.
+class DepthMedian {
+public:
+	enum InstructionSet { MEDIAN_SCALAR = 0, MEDIAN_SSE2 = 1, MEDIAN_AVX2 = 2, MEDIAN_AVX512 = 3 };
+	static void filter(const UINT16* depth, UINT16* target) { filter(MEDIAN_AVX2, depth, target); }
+	// Runs with the instruction set or the widest one below it that the CPU supports
+	static void filter(int instructionSet, const UINT16* depth, UINT16* target);
+	// The widest instruction set the CPU and the OS support, chosen at the first call
+	static int getInstructionSet();
+	static const char* getName(int instructionSet);
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "DeviceScan.cuh"
+
+#define SCAN_THREADS 512
+#define SCAN_BLOCK (SCAN_THREADS * 2)
+
+// Work-efficient scan of SCAN_BLOCK elements per block, the block totals go to blockSums.
+// Block 0 always runs so that an empty input still produces a zero total.
+__global__ void kernelScanBlocks(int* data, int* size, int capacity, int* nextSize, int* blockSums) {
+	__shared__ int temp[SCAN_BLOCK];
+	int n = min(*size, capacity);
+	int blockOffset = blockIdx.x * SCAN_BLOCK;
+	if (blockIdx.x != 0 && blockOffset >= n) {
+		return;
+	}
+
+	int thid = threadIdx.x;
+	int ai = thid;
+	int bi = thid + SCAN_THREADS;
+	temp[ai] = (blockOffset + ai < n) ? data[blockOffset + ai] : 0;
+	temp[bi] = (blockOffset + bi < n) ? data[blockOffset + bi] : 0;
+
+	int offset = 1;
+	for (int d = SCAN_BLOCK >> 1; d > 0; d >>= 1) {
+		__syncthreads();
+		if (thid < d) {
+			int a = offset * (2 * thid + 1) - 1;
+			int b = offset * (2 * thid + 2) - 1;
+			temp[b] += temp[a];
+		}
+		offset *= 2;
+	}
+
+	if (thid == 0) {
+		blockSums[blockIdx.x] = temp[SCAN_BLOCK - 1];
+		temp[SCAN_BLOCK - 1] = 0;
+		if (blockIdx.x == 0 && nextSize != NULL) {
+			*nextSize = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
+		}
+	}
+
+	for (int d = 1; d < SCAN_BLOCK; d *= 2) {
+		offset >>= 1;
+		__syncthreads();
+		if (thid < d) {
+			int a = offset * (2 * thid + 1) - 1;
+			int b = offset * (2 * thid + 2) - 1;
+			int t = temp[a];
+			temp[a] = temp[b];
+			temp[b] += t;
+		}
+	}
+	__syncthreads();
+
+	if (blockOffset + ai < n) {
+		data[blockOffset + ai] = temp[ai];
+	}
+	if (blockOffset + bi < n) {
+		data[blockOffset + bi] = temp[bi];
+	}
+}
+
+__global__ void kernelScanAdd(int* data, int* size, int capacity, int* blockSums) {
+	int n = min(*size, capacity);
+	int blockOffset = blockIdx.x * SCAN_BLOCK;
+	if (blockIdx.x == 0 || blockOffset >= n) {
+		return;
+	}
+
+	int sum = blockSums[blockIdx.x];
+	for (int i = threadIdx.x; i < SCAN_BLOCK && blockOffset + i < n; i += SCAN_THREADS) {
+		data[blockOffset + i] += sum;
+	}
+}
+
+void DeviceScan::init(int capacity) {
+	this->capacity = capacity;
+	levels = 1;
+	for (int n = capacity; n > SCAN_BLOCK; n = (n + SCAN_BLOCK - 1) / SCAN_BLOCK) {
+		levels++;
+	}
+
+	levelBlocks = new int[levels];
+	levelSums_device = new int*[levels];
+	int n = capacity;
+	for (int i = 0; i < levels; i++) {
+		levelBlocks[i] = (n + SCAN_BLOCK - 1) / SCAN_BLOCK;
+		HANDLE_ERROR(cudaMalloc(&levelSums_device[i], levelBlocks[i] * sizeof(int)));
+		n = levelBlocks[i];
+	}
+	HANDLE_ERROR(cudaMalloc(&levelSize_device, levels * sizeof(int)));
+}
+
+void DeviceScan::release() {
+	for (int i = 0; i < levels; i++) {
+		HANDLE_ERROR(cudaFree(levelSums_device[i]));
+	}
+	HANDLE_ERROR(cudaFree(levelSize_device));
+	delete[] levelBlocks;
+	delete[] levelSums_device;
+}
+
+void DeviceScan::exclusiveScan(int* data, int* size_device, int* total_device) {
+	scanLevel(0, data, size_device, total_device);
+}
+
+void DeviceScan::scanLevel(int level, int* data, int* size_device, int* total_device) {
+	int levelCapacity = (level == 0) ? capacity : levelBlocks[level - 1];
+	if (level + 1 == levels) {
+		kernelScanBlocks << <1, SCAN_THREADS >> > (data, size_device, levelCapacity, NULL, total_device);
+		HANDLE_ERROR(cudaGetLastError());
+		return;
+	}
+
+	int* nextSize_device = levelSize_device + level + 1;
+	kernelScanBlocks << <levelBlocks[level], SCAN_THREADS >> > (data, size_device, levelCapacity, nextSize_device, levelSums_device[level]);
+	HANDLE_ERROR(cudaGetLastError());
+	scanLevel(level + 1, levelSums_device[level], nextSize_device, total_device);
+	kernelScanAdd << <levelBlocks[level], SCAN_THREADS >> > (data, size_device, levelCapacity, levelSums_device[level]);
+	HANDLE_ERROR(cudaGetLastError());
+}
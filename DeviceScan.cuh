@@ -0,0 +1,26 @@
+#ifndef DEVICE_SCAN_CUH
+#define DEVICE_SCAN_CUH
+
+#include "CudaHandleError.h"
+
+// Multi-level exclusive scan that stays on the GPU.
+// Buffers are allocated once for the largest size, the actual size is read from device memory,
+// so the scan can be queued behind the kernel that produces the data without a synchronization.
+class DeviceScan {
+public:
+	void init(int capacity);
+	void release();
+	// Scans the first min(*size_device, capacity) elements of data in place and writes their sum to total_device.
+	void exclusiveScan(int* data, int* size_device, int* total_device);
+
+private:
+	int capacity;
+	int levels;
+	int* levelBlocks;
+	int** levelSums_device;
+	int* levelSize_device;
+
+	void scanLevel(int level, int* data, int* size_device, int* total_device);
+};
+
+#endif
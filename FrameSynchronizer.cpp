@@ -0,0 +1,63 @@
+#include "FrameSynchronizer.h"
+#include <math.h>
+#include <string.h>
+
+FrameSynchronizer::FrameSynchronizer()
+{
+	spread = 0;
+	memset(dropped, 0, sizeof(dropped));
+}
+
+void FrameSynchronizer::select(int cameras, const double* timestamps, const int* counts, int* selected)
+{
+	double bestSpread = -1;
+	double bestAnchor = 0;
+	int candidate[MAX_CAMERAS];
+
+	// Every buffered frame is tried as anchor, the other cameras take their frame closest to it
+	for (int a = 0; a < cameras; a++) {
+		for (int k = 0; k < counts[a]; k++) {
+			double anchor = timestamps[a * CAPTURE_RING + k];
+			double minTime = anchor;
+			double maxTime = anchor;
+
+			for (int i = 0; i < cameras; i++) {
+				candidate[i] = -1;
+				double distance = 0;
+				for (int j = 0; j < counts[i]; j++) {
+					double d = fabs(timestamps[i * CAPTURE_RING + j] - anchor);
+					if (candidate[i] == -1 || d <= distance) {
+						candidate[i] = j;
+						distance = d;
+					}
+				}
+				if (candidate[i] != -1) {
+					double t = timestamps[i * CAPTURE_RING + candidate[i]];
+					minTime = fmin(minTime, t);
+					maxTime = fmax(maxTime, t);
+				}
+			}
+
+			double currSpread = maxTime - minTime;
+			if (bestSpread < 0 || currSpread < bestSpread || (currSpread == bestSpread && anchor > bestAnchor)) {
+				bestSpread = currSpread;
+				bestAnchor = anchor;
+				memcpy(selected, candidate, cameras * sizeof(int));
+			}
+		}
+	}
+
+	if (bestSpread < 0) {
+		for (int i = 0; i < cameras; i++) {
+			selected[i] = -1;
+		}
+		return;
+	}
+
+	spread = bestSpread;
+	for (int i = 0; i < cameras; i++) {
+		if (selected[i] > 0) {
+			dropped[i] += selected[i];
+		}
+	}
+}
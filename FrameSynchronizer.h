@@ -0,0 +1,21 @@
+#ifndef FRAME_SYNCHRONIZER_H
+#define FRAME_SYNCHRONIZER_H
+
+#include "Parameters.h"
+
+// Chooses one buffered frame per camera so that the spread of their timestamps is the smallest,
+// preferring the newest set among equal spreads. Buffered frames older than the chosen one are dropped.
+class FrameSynchronizer {
+private:
+	double spread;
+	int dropped[MAX_CAMERAS];
+public:
+	FrameSynchronizer();
+	// timestamps[i * CAPTURE_RING + j] is frame j of camera i, oldest first, counts[i] frames per camera.
+	// selected[i] is -1 for cameras without frames.
+	void select(int cameras, const double* timestamps, const int* counts, int* selected);
+	double getSpread() { return spread; }
+	int getDroppedFrames(int cameraId) { return dropped[cameraId]; }
+};
+
+#endif
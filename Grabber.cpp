@@ -0,0 +1,171 @@
+#include "Grabber.h"
+#include "Configuration.h"
+#include "Backend.h"
+
+Grabber::Grabber()
+{
+	depthFilter = new DepthFilter();
+	colorFilter = new ColorFilter();
+	alignColorMap = new AlignColorMap();
+	depthImages = new UINT16*[MAX_CAMERAS];
+	colorImages = new UINT8*[MAX_CAMERAS];
+	for (int i = 0; i < MAX_CAMERAS; i++) {
+		depthImages[i] = new UINT16[DEPTH_H * DEPTH_W];
+		colorImages[i] = new UINT8[2 * COLOR_H * COLOR_W];
+		memset(depthImages[i], 0, DEPTH_H * DEPTH_W * sizeof(UINT16));
+		memset(colorImages[i], 0, 2 * COLOR_H * COLOR_W * sizeof(UINT8));
+	}
+	colorImagesRGB = new RGBQUAD*[MAX_CAMERAS];
+	for (int i = 0; i < MAX_CAMERAS; i++) {
+		colorImagesRGB[i] = new RGBQUAD[COLOR_H * COLOR_W];
+	}
+	depth2color = new Transformation[MAX_CAMERAS];
+	color2depth = new Transformation[MAX_CAMERAS];
+	depthIntrinsics = new Intrinsics[MAX_CAMERAS];
+	colorIntrinsics = new Intrinsics[MAX_CAMERAS];
+	timestamps = new double[MAX_CAMERAS];
+	memset(timestamps, 0, MAX_CAMERAS * sizeof(double));
+	transmission = NULL;
+	recorder = NULL;
+}
+
+Grabber::~Grabber()
+{
+	if (recorder != NULL) {
+		delete recorder;
+	}
+	if (depthFilter != NULL) {
+		delete depthFilter;
+	}
+	if (colorFilter != NULL) {
+		delete colorFilter;
+	}
+	if (alignColorMap != NULL) {
+		delete alignColorMap;
+	}
+	if (depthImages != NULL) {
+		for (int i = 0; i < MAX_CAMERAS; i++) {
+			if (depthImages[i] != NULL) {
+				delete depthImages[i];
+			}
+		}
+		delete[] depthImages;
+	}
+	if (colorImages != NULL) {
+		for (int i = 0; i < MAX_CAMERAS; i++) {
+			if (colorImages[i] != NULL) {
+				delete colorImages[i];
+			}
+		}
+		delete[] colorImages;
+	}
+	if (colorImagesRGB != NULL) {
+		for (int i = 0; i < MAX_CAMERAS; i++) {
+			if (colorImagesRGB[i] != NULL) {
+				delete colorImagesRGB[i];
+			}
+		}
+		delete[] colorImagesRGB;
+	}
+	if (depth2color != NULL) {
+		delete[] depth2color;
+	}
+	if (color2depth != NULL) {
+		delete[] color2depth;
+	}
+	if (depthIntrinsics != NULL) {
+		delete[] depthIntrinsics;
+	}
+	if (colorIntrinsics != NULL) {
+		delete[] colorIntrinsics;
+	}
+	if (timestamps != NULL) {
+		delete[] timestamps;
+	}
+}
+
+int Grabber::getRGBD(float*& depthImages_device, RGBQUAD*& colorImages_device, Transformation* world2depth, Transformation* world2color, Intrinsics*& depthIntrinsics, Intrinsics*& colorIntrinsics)
+{
+	depthImages_device = depthFilter->getCurrFrame_device();
+	colorImages_device = colorFilter->getCurrFrame_device();
+	depthIntrinsics = this->depthIntrinsics;
+	colorIntrinsics = this->colorIntrinsics;
+	bool check[MAX_CAMERAS] = { false };
+
+	int cameras = grabFrames(check);
+
+	if (recorder != NULL) {
+		recorder->write(cameras, check, convertFactors.data(), timestamps, depthImages, colorImages, depthIntrinsics, colorIntrinsics, depth2color, color2depth);
+	}
+
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			depthFilter->setConvertFactor(i, depthIntrinsics[i].fx * convertFactors[i]);
+		}
+	}
+	depthFilter->process(cameras, check, depthImages);
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			colorFilter->process(i, colorImages[i]);
+		}
+	}
+
+	colorImages_device = alignColorMap->getAlignedColor_device(cameras, check, depthImages_device, colorImages_device, depthIntrinsics, colorIntrinsics, depth2color);
+	depthFilter->guide(cameras, check, colorImages_device);
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			world2depth[i] = color2depth[i] * world2color[i];
+			colorIntrinsics[i] = depthIntrinsics[i].zoom((float)COLOR_W / DEPTH_W, (float)COLOR_H / DEPTH_H);
+		}
+	}
+
+	if (transmission != NULL && transmission->isConnected()) {
+		transmission->prepareSendFrame(cameras, check, depthImages_device, colorImages_device, world2depth, depthIntrinsics, colorIntrinsics);
+	}
+
+	return cameras;
+}
+
+int Grabber::getRGB(RGBQUAD**& colorImages, Intrinsics*& colorIntrinsics)
+{
+	colorImages = this->colorImagesRGB;
+	colorIntrinsics = this->colorIntrinsics;
+	bool check[MAX_CAMERAS] = { false };
+
+	int cameras = grabFrames(check);
+
+	RGBQUAD* colorImages_device = colorFilter->getCurrFrame_device();
+	for (int i = 0; i < cameras; i++) {
+		if (check[i]) {
+			colorFilter->process(i, this->colorImages[i]);
+			Backend::copy(this->colorImagesRGB[i], colorImages_device + i * COLOR_W * COLOR_H, COLOR_W * COLOR_H * sizeof(RGBQUAD), cudaMemcpyDeviceToHost);
+		}
+	}
+
+	return cameras;
+}
+
+void Grabber::saveBackground() {
+	if (alignColorMap->isBackgroundOn()) {
+		alignColorMap->disableBackground();
+	} else {
+		alignColorMap->enableBackground(depthFilter->getCurrFrame_device());
+	}
+	Configuration::saveBackground(alignColorMap);
+}
+
+void Grabber::loadBackground()
+{
+	Configuration::loadBackground(alignColorMap);
+}
+
+void Grabber::record(const char* file)
+{
+	if (recorder != NULL) {
+		delete recorder;
+	}
+	recorder = new SessionWriter(file);
+	// Sessions keep the raw depth, the median runs when they are replayed. The capture rings drop the frames they
+	// filtered before this, see RealsenseGrabber::grabFrames.
+	depthFilter->setMedianOnCapture(false);
+}
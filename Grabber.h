@@ -0,0 +1,52 @@
+#ifndef GRABBER_H
+#define GRABBER_H
+
+#include <iostream>
+#include <vector>
+#include <Windows.h>
+#include "Parameters.h"
+#include "TsdfVolume.cuh"
+#include "DepthFilter.h"
+#include "ColorFilter.h"
+#include "AlignColorMap.h"
+#include "Transmission.h"
+#include "RecordedSession.h"
+
+// Filters, aligns and sends the raw frames of the cameras. The subclasses only provide the raw Z16 depth,
+// YUYV color, intrinsics and extrinsics of every device in grabFrames.
+class Grabber
+{
+private:
+	DepthFilter* depthFilter;
+	ColorFilter* colorFilter;
+	AlignColorMap* alignColorMap;
+	Transmission* transmission;
+	SessionWriter* recorder;
+
+protected:
+	std::vector<float> convertFactors;
+	UINT16** depthImages;
+	UINT8** colorImages;
+	RGBQUAD** colorImagesRGB;
+	Transformation* depth2color;
+	Transformation* color2depth;
+	Intrinsics* depthIntrinsics;
+	Intrinsics* colorIntrinsics;
+	double* timestamps;
+
+	// Fills the raw buffers of every device, check tells which devices delivered a frame. Returns the number of devices.
+	virtual int grabFrames(bool* check) = 0;
+
+public:
+	Grabber();
+	virtual ~Grabber();
+	int getRGBD(float*& depthImages_device, RGBQUAD*& colorImages_device, Transformation* world2depth, Transformation* world2color, Intrinsics*& depthIntrinscis, Intrinsics*& colorIntrinsics);
+	int getRGB(RGBQUAD**& colorImages, Intrinsics*& colorIntrinsics);
+	void saveBackground();
+	void loadBackground();
+	void setTransmission(Transmission* transmission) { this->transmission = transmission; }
+	DepthFilter* getDepthFilter() { return depthFilter; }
+	void record(const char* file);
+};
+
+#endif
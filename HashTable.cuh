@@ -0,0 +1,86 @@
+#ifndef HASH_TABLE_CUH
+#define HASH_TABLE_CUH
+
+#include "CudaHandleError.h"
+
+// Open addressing hash table in device memory, mapping UINT32 keys to consecutive ids.
+// Keys are inserted by one kernel and looked up by the following ones, so a value is never read before it is written.
+class HashTable {
+public:
+	static const UINT32 EMPTY = 0xffffffff;
+
+	UINT32* keys;
+	int* values;
+	int* count;
+	int capacity; // power of 2
+
+	void init(int capacity) {
+		this->capacity = capacity;
+		HANDLE_ERROR(cudaMalloc(&keys, capacity * sizeof(UINT32)));
+		HANDLE_ERROR(cudaMalloc(&values, capacity * sizeof(int)));
+		HANDLE_ERROR(cudaMalloc(&count, sizeof(int)));
+		clear();
+	}
+
+	void release() {
+		HANDLE_ERROR(cudaFree(keys));
+		HANDLE_ERROR(cudaFree(values));
+		HANDLE_ERROR(cudaFree(count));
+	}
+
+	void clear() {
+		HANDLE_ERROR(cudaMemset(keys, 0xff, capacity * sizeof(UINT32)));
+		HANDLE_ERROR(cudaMemset(count, 0, sizeof(int)));
+	}
+
+	int size() {
+		int result;
+		HANDLE_ERROR(cudaMemcpy(&result, count, sizeof(int), cudaMemcpyDeviceToHost));
+		return result;
+	}
+
+#ifdef __CUDACC__
+	__device__ __forceinline__ int hash(UINT32 key) {
+		return (key * 2654435761u) & (capacity - 1);
+	}
+
+	// Returns the new id if the key was not in the table yet, otherwise -1.
+	// Ids beyond maxCount are still counted but stored as missing.
+	__device__ int insert(UINT32 key, int maxCount) {
+		int slot = hash(key);
+		for (int i = 0; i < capacity; i++) {
+			UINT32 prev = keys[slot];
+			if (prev == EMPTY) {
+				prev = atomicCAS(&keys[slot], EMPTY, key);
+				if (prev == EMPTY) {
+					int id = atomicAdd(count, 1);
+					values[slot] = (id < maxCount) ? id : -1;
+					return id;
+				}
+			}
+			if (prev == key) {
+				return -1;
+			}
+			slot = (slot + 1) & (capacity - 1);
+		}
+		return -1;
+	}
+
+	__device__ int find(UINT32 key) {
+		int slot = hash(key);
+		for (int i = 0; i < capacity; i++) {
+			UINT32 curr = keys[slot];
+			if (curr == key) {
+				return values[slot];
+			}
+			if (curr == EMPTY) {
+				return -1;
+			}
+			slot = (slot + 1) & (capacity - 1);
+		}
+		return -1;
+	}
+#endif
+};
+
+#endif
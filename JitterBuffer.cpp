@@ -0,0 +1,77 @@
+#include "JitterBuffer.h"
+#include <math.h>
+
+namespace JitterBufferNamespace {
+	// Delay in frame intervals that covers the estimated jitter
+	const double JITTER_SCALE = 3.0;
+	const double GAIN = 1.0 / 16;
+	// A frame is overdue when it takes this many mean intervals longer than the previous one
+	const double LATE_SCALE = 1.5;
+}
+using namespace JitterBufferNamespace;
+
+JitterBuffer::JitterBuffer(int delay, int maxDelay)
+{
+	this->maxDelay = maxDelay;
+	this->delay = 0;
+	setDelay(delay);
+	lastTransit = 0;
+	lastArrival = 0;
+	started = false;
+	jitter = 0;
+	interval = 1000.0 / CAMERA_FPS;
+	adaptive = true;
+	quietFrames = 0;
+	historyFrames = 0;
+}
+
+void JitterBuffer::setDelay(int delay)
+{
+	this->delay = delay < 0 ? 0 : (delay > maxDelay ? maxDelay : delay);
+	quietFrames = 0;
+}
+
+void JitterBuffer::arrived(double sendTime, double arrivalTime)
+{
+	// The clocks of the two sides differ by a constant, which cancels out in the change of the transit time
+	double transit = arrivalTime - sendTime;
+	if (started) {
+		jitter = jitter + (fabs(transit - lastTransit) - jitter) * GAIN;
+		interval = interval + ((arrivalTime - lastArrival) - interval) * GAIN;
+	}
+	lastTransit = transit;
+	lastArrival = arrivalTime;
+	started = true;
+}
+
+int JitterBuffer::update(bool underrun, double time)
+{
+	if (adaptive) {
+		int needed = (int)ceil(JITTER_SCALE * jitter / fmax(interval, 1.0));
+		if (underrun && time - lastArrival > LATE_SCALE * interval) {
+			delay++;
+			quietFrames = 0;
+		} else if (++quietFrames >= SHRINK_FRAMES) {
+			if (delay > needed) {
+				delay--;
+			}
+			quietFrames = 0;
+		}
+		delay = delay < needed ? needed : delay;
+		delay = delay > maxDelay ? maxDelay : delay;
+	}
+
+	history[historyFrames % HISTORY_SIZE] = delay;
+	historyFrames++;
+	return delay;
+}
+
+int JitterBuffer::getHistory(int* delays, int size)
+{
+	int count = historyFrames < HISTORY_SIZE ? historyFrames : HISTORY_SIZE;
+	count = count < size ? count : size;
+	for (int i = 0; i < count; i++) {
+		delays[i] = history[(historyFrames - count + i) % HISTORY_SIZE];
+	}
+	return count;
+}
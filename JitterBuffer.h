@@ -0,0 +1,43 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <atomic>
+#include "Parameters.h"
+
+// Chooses how many remote frames are buffered before they are played. The receive thread reports the sender
+// timestamp and the arrival time of every frame, from which the interarrival jitter is estimated as in RFC 3550.
+// The render thread reports whether each frame underran: an underrun while the next frame is overdue grows the
+// delay by one frame (one that only comes from the remote sending fewer frames than are played does not), and after
+// SHRINK_FRAMES frames without underruns it shrinks by one frame as long as it stays above what the jitter needs.
+class JitterBuffer {
+private:
+	static const int HISTORY_SIZE = 300;
+	static const int SHRINK_FRAMES = 2 * CAMERA_FPS;
+	// Receive thread, all times in ms
+	double lastTransit;
+	bool started;
+	std::atomic<double> lastArrival;
+	std::atomic<double> jitter;
+	std::atomic<double> interval;
+	// Render thread
+	bool adaptive;
+	int delay;
+	int maxDelay;
+	int quietFrames;
+	int history[HISTORY_SIZE];
+	int historyFrames;
+
+public:
+	JitterBuffer(int delay, int maxDelay);
+	void setAdaptive(bool adaptive) { this->adaptive = adaptive; }
+	void setDelay(int delay);
+	void arrived(double sendTime, double arrivalTime);
+	// Called once per played frame with the current time in ms, returns the delay in frames to use from now on
+	int update(bool underrun, double time);
+	int getDelay() { return delay; }
+	double getJitter() { return jitter; }
+	// Copies the delays of up to size past frames, oldest first, and returns how many were copied
+	int getHistory(int* delays, int size);
+};
+
+#endif
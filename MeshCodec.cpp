@@ -0,0 +1,306 @@
+#include "MeshCodec.h"
+#include "DepthCodec.h"
+#include <math.h>
+
+namespace MeshCodecNamespace {
+	inline UINT16 zigzag16(INT16 r) {
+		return (UINT16)((r << 1) ^ (r >> 15));
+	}
+
+	inline INT16 unzigzag16(UINT16 v) {
+		return (INT16)((v >> 1) ^ -(INT16)(v & 1));
+	}
+
+	inline UINT32 zigzag32(INT32 r) {
+		return (UINT32)((r << 1) ^ (r >> 31));
+	}
+
+	inline INT32 unzigzag32(UINT32 v) {
+		return (INT32)((v >> 1) ^ -(INT32)(v & 1));
+	}
+
+	inline UINT16 toRGB565(uchar4 c) {
+		return ((c.x >> 3) << 11) | ((c.y >> 2) << 5) | (c.z >> 3);
+	}
+
+	inline uchar4 fromRGB565(UINT16 c) {
+		UINT8 r = (c >> 11) & 0x1F;
+		UINT8 g = (c >> 5) & 0x3F;
+		UINT8 b = c & 0x1F;
+		return make_uchar4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 0);
+	}
+
+	inline UINT16 quantize(float v, float origin, float scale) {
+		int q = (int)((v - origin) / scale + 0.5f);
+		return (UINT16)(q < 0 ? 0 : (q > 65535 ? 65535 : q));
+	}
+}
+using namespace MeshCodecNamespace;
+
+MeshCodec::MeshCodec()
+{
+	hasPrev = false;
+	memset(&prevHeader, 0, sizeof(MeshHeader));
+}
+
+int MeshCodec::wordCount(int vertexSize, int triSize)
+{
+#ifdef INDEXED_MESH
+	return vertexSize * VERTEX_WORDS + triSize * 3 * 2;
+#else
+	// The triangles are the vertices in threes, they carry no words of their own
+	(void)triSize;
+	return vertexSize * VERTEX_WORDS;
+#endif
+}
+
+void MeshCodec::getSizes(byte* mesh, int& vertexSize, int& triSize)
+{
+#ifdef INDEXED_MESH
+	vertexSize = *((int*)mesh);
+	triSize = *((int*)(mesh + 4));
+#else
+	triSize = *((int*)mesh);
+	vertexSize = triSize * 3;
+#endif
+}
+
+int MeshCodec::maxEncodedSize(byte* mesh)
+{
+	int vertexSize, triSize;
+	getSizes(mesh, vertexSize, triSize);
+	return sizeof(MeshHeader) + 3 * wordCount(vertexSize, triSize);
+}
+
+bool MeshCodec::isValid(const MeshHeader& header, int size)
+{
+#ifdef INDEXED_MESH
+	bool sizes = header.vertexSize >= 0 && header.vertexSize <= MAX_VERTEX && header.triSize >= 0 && header.triSize <= MAX_VERTEX / 3;
+#else
+	bool sizes = header.triSize >= 0 && header.triSize <= MAX_VERTEX / 3 && header.vertexSize == header.triSize * 3;
+#endif
+	return sizes && header.packedSize >= 0 && header.packedSize <= size - (int)sizeof(MeshHeader);
+}
+
+int MeshCodec::decodedSize(BYTE* data, int size)
+{
+	MeshHeader header;
+	if (size < (int)sizeof(MeshHeader)) {
+		return sizeof(MeshHeader);
+	}
+	memcpy(&header, data, sizeof(MeshHeader));
+	if (!isValid(header, size)) {
+		return sizeof(MeshHeader);
+	}
+	return sizeof(MeshHeader) + wordCount(header.vertexSize, header.triSize) * sizeof(UINT16);
+}
+
+int MeshCodec::encode(byte* mesh, bool allowDelta, BYTE* data)
+{
+	MeshHeader header;
+	memset(&header, 0, sizeof(MeshHeader));
+	getSizes(mesh, header.vertexSize, header.triSize);
+#ifdef INDEXED_MESH
+	MeshVertex* vertex = (MeshVertex*)(mesh + 8);
+	UINT32* index = (UINT32*)(vertex + header.vertexSize);
+#else
+	Vertex* vertex = (Vertex*)(mesh + 4);
+#endif
+
+	float3 minPos = make_float3(1e10f, 1e10f, 1e10f);
+	float3 maxPos = make_float3(-1e10f, -1e10f, -1e10f);
+	for (int i = 0; i < header.vertexSize; i++) {
+		float3 pos = vertex[i].pos;
+		minPos = make_float3(fminf(minPos.x, pos.x), fminf(minPos.y, pos.y), fminf(minPos.z, pos.z));
+		maxPos = make_float3(fmaxf(maxPos.x, pos.x), fmaxf(maxPos.y, pos.y), fmaxf(maxPos.z, pos.z));
+	}
+
+	if (header.vertexSize > 0) {
+		header.origin = minPos;
+		header.scale = make_float3(fmaxf(maxPos.x - minPos.x, 1e-6f) / 65535, fmaxf(maxPos.y - minPos.y, 1e-6f) / 65535, fmaxf(maxPos.z - minPos.z, 1e-6f) / 65535);
+	} else {
+		header.scale = make_float3(1, 1, 1);
+	}
+
+	int n = wordCount(header.vertexSize, header.triSize);
+	int indexOffset = header.vertexSize * VERTEX_WORDS;
+	residual.resize(n);
+	auto quantizeWords = [&](const MeshHeader& box, std::vector<UINT16>& target) {
+		target.resize(n);
+		#pragma omp parallel for
+		for (int i = 0; i < header.vertexSize; i++) {
+			UINT16* w = &target[i * VERTEX_WORDS];
+			w[0] = quantize(vertex[i].pos.x, box.origin.x, box.scale.x);
+			w[1] = quantize(vertex[i].pos.y, box.origin.y, box.scale.y);
+			w[2] = quantize(vertex[i].pos.z, box.origin.z, box.scale.z);
+			w[3] = toRGB565(vertex[i].color);
+#ifndef INDEXED_MESH
+			w[4] = toRGB565(vertex[i].color2);
+#endif
+		}
+#ifdef INDEXED_MESH
+		for (int j = 0; j < header.triSize * 3; j++) {
+			target[indexOffset + j * 2] = index[j] & 0xFFFF;
+			target[indexOffset + j * 2 + 1] = index[j] >> 16;
+		}
+#endif
+	};
+
+	// Marching cubes emits neighboring vertices next to each other, so each vertex is predicted from the one before
+	quantizeWords(header, words);
+	for (int i = 0; i < indexOffset; i++) {
+		residual[i] = zigzag16((INT16)(words[i] - (i >= VERTEX_WORDS ? words[i - VERTEX_WORDS] : 0)));
+	}
+#ifdef INDEXED_MESH
+	for (int j = 0; j < header.triSize * 3; j++) {
+		UINT32 r = zigzag32((INT32)(index[j] - (j > 0 ? index[j - 1] : 0)));
+		residual[indexOffset + j * 2] = r & 0xFFFF;
+		residual[indexOffset + j * 2 + 1] = r >> 16;
+	}
+#endif
+	header.packedSize = DepthCodec::pack(residual.data(), n, data + sizeof(MeshHeader));
+
+	// A delta frame subtracts vertex i of the previous frame, which only pays off while the volume emits the vertices
+	// in the same order. It is coded in the previous box so that unchanged vertices give zero residuals, and it is
+	// kept only when it packs smaller than the intra frame.
+	bool delta = allowDelta && hasPrev && header.vertexSize == prevHeader.vertexSize && header.triSize == prevHeader.triSize && header.vertexSize > 0;
+	if (delta) {
+		float3 prevMax = make_float3(prevHeader.origin.x + prevHeader.scale.x * 65535, prevHeader.origin.y + prevHeader.scale.y * 65535, prevHeader.origin.z + prevHeader.scale.z * 65535);
+		delta = minPos.x >= prevHeader.origin.x && minPos.y >= prevHeader.origin.y && minPos.z >= prevHeader.origin.z
+			&& maxPos.x <= prevMax.x && maxPos.y <= prevMax.y && maxPos.z <= prevMax.z;
+	}
+	if (delta) {
+		MeshHeader deltaHeader = header;
+		deltaHeader.delta = 1;
+		deltaHeader.origin = prevHeader.origin;
+		deltaHeader.scale = prevHeader.scale;
+		quantizeWords(deltaHeader, deltaWords);
+		for (int i = 0; i < n; i++) {
+			residual[i] = zigzag16((INT16)(deltaWords[i] - prevWords[i]));
+		}
+		packed.resize(3 * n);
+		deltaHeader.packedSize = DepthCodec::pack(residual.data(), n, packed.data());
+		if (deltaHeader.packedSize < header.packedSize) {
+			memcpy(data + sizeof(MeshHeader), packed.data(), deltaHeader.packedSize);
+			header = deltaHeader;
+			words.swap(deltaWords);
+		}
+	}
+	memcpy(data, &header, sizeof(MeshHeader));
+
+	prevWords.swap(words);
+	prevHeader = header;
+	hasPrev = true;
+	return sizeof(MeshHeader) + header.packedSize;
+}
+
+int MeshCodec::dropFrame(BYTE* quantized)
+{
+	MeshHeader header;
+	memset(&header, 0, sizeof(MeshHeader));
+	memcpy(quantized, &header, sizeof(MeshHeader));
+	hasPrev = false;
+	return -1;
+}
+
+int MeshCodec::decode(BYTE* data, int size, BYTE* quantized)
+{
+	MeshHeader header;
+	if (size < (int)sizeof(MeshHeader)) {
+		return dropFrame(quantized);
+	}
+	memcpy(&header, data, sizeof(MeshHeader));
+	if (!isValid(header, size)) {
+		return dropFrame(quantized);
+	}
+	int n = wordCount(header.vertexSize, header.triSize);
+	words.resize(n);
+	residual.resize(n);
+	if (DepthCodec::unpack(data + sizeof(MeshHeader), header.packedSize, n, residual.data()) < 0) {
+		return dropFrame(quantized);
+	}
+
+	if (header.delta) {
+		// A delta frame without its reference cannot be decoded, it is replaced by an empty mesh
+		if (!hasPrev || header.vertexSize != prevHeader.vertexSize || header.triSize != prevHeader.triSize) {
+			memset(&header, 0, sizeof(MeshHeader));
+			memcpy(quantized, &header, sizeof(MeshHeader));
+			hasPrev = false;
+			return sizeof(MeshHeader);
+		}
+		for (int i = 0; i < n; i++) {
+			words[i] = (UINT16)(prevWords[i] + unzigzag16(residual[i]));
+		}
+	} else {
+		int indexOffset = header.vertexSize * VERTEX_WORDS;
+		for (int i = 0; i < indexOffset; i++) {
+			words[i] = (UINT16)((i >= VERTEX_WORDS ? words[i - VERTEX_WORDS] : 0) + unzigzag16(residual[i]));
+		}
+#ifdef INDEXED_MESH
+		UINT32 prevIndex = 0;
+		for (int j = 0; j < header.triSize * 3; j++) {
+			UINT32 r = residual[indexOffset + j * 2] | ((UINT32)residual[indexOffset + j * 2 + 1] << 16);
+			UINT32 idx = prevIndex + unzigzag32(r);
+			if (idx >= (UINT32)header.vertexSize) {
+				return dropFrame(quantized);
+			}
+			words[indexOffset + j * 2] = idx & 0xFFFF;
+			words[indexOffset + j * 2 + 1] = idx >> 16;
+			prevIndex = idx;
+		}
+#endif
+	}
+
+	prevWords.swap(words);
+	prevHeader = header;
+	hasPrev = true;
+
+	header.delta = 0;
+	memcpy(quantized, &header, sizeof(MeshHeader));
+	memcpy(quantized + sizeof(MeshHeader), prevWords.data(), n * sizeof(UINT16));
+	return sizeof(MeshHeader) + n * sizeof(UINT16);
+}
+
+bool MeshCodec::merge(BYTE* quantized, byte* mesh)
+{
+	MeshHeader header;
+	memcpy(&header, quantized, sizeof(MeshHeader));
+	UINT16* w = (UINT16*)(quantized + sizeof(MeshHeader));
+	int vertexSize, triSize;
+	getSizes(mesh, vertexSize, triSize);
+
+#ifdef INDEXED_MESH
+	int totalVertex = vertexSize + header.vertexSize;
+	int totalTri = triSize + header.triSize;
+	if (totalVertex > MAX_VERTEX || totalTri * 3 > MAX_VERTEX) {
+		return false;
+	}
+	MeshVertex* vertex = (MeshVertex*)(mesh + 8);
+	// The local indices move behind the enlarged vertex array
+	memmove(vertex + totalVertex, vertex + vertexSize, triSize * 3 * sizeof(UINT32));
+	UINT32* index = (UINT32*)(vertex + totalVertex);
+	UINT16* remoteIndex = w + header.vertexSize * VERTEX_WORDS;
+	for (int j = 0; j < header.triSize * 3; j++) {
+		index[triSize * 3 + j] = vertexSize + (remoteIndex[j * 2] | ((UINT32)remoteIndex[j * 2 + 1] << 16));
+	}
+	*((int*)mesh) = totalVertex;
+	*((int*)(mesh + 4)) = totalTri;
+#else
+	if ((triSize + header.triSize) * 3 > MAX_VERTEX) {
+		return false;
+	}
+	Vertex* vertex = (Vertex*)(mesh + 4);
+	*((int*)mesh) = triSize + header.triSize;
+#endif
+
+	#pragma omp parallel for
+	for (int i = 0; i < header.vertexSize; i++) {
+		UINT16* v = w + i * VERTEX_WORDS;
+		vertex[vertexSize + i].pos = make_float3(header.origin.x + v[0] * header.scale.x, header.origin.y + v[1] * header.scale.y, header.origin.z + v[2] * header.scale.z);
+		vertex[vertexSize + i].color = fromRGB565(v[3]);
+#ifndef INDEXED_MESH
+		vertex[vertexSize + i].color2 = fromRGB565(v[4]);
+#endif
+	}
+	return true;
+}
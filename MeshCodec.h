@@ -0,0 +1,60 @@
+#ifndef MESH_CODEC_H
+#define MESH_CODEC_H
+
+#include <vector>
+#include <Windows.h>
+#include "Parameters.h"
+#include "Vertex.h"
+
+// Mesh buffers of TsdfVolume::integrate as 16 bit words: per vertex the position quantized to the bounding box
+// and RGB565 colors, then with INDEXED_MESH the indices as two words each. Frames are intra coded, or coded against
+// the previous frame when allowed, the topology sizes match, the box still fits and that packs smaller; the residuals
+// are packed with DepthCodec::pack. The encoder and the decoder each keep the previous frame, so the frames must be decoded
+// in the order they were encoded.
+struct MeshHeader {
+	INT32 vertexSize;
+	INT32 triSize;
+	INT32 delta;
+	INT32 packedSize;
+	float3 origin;
+	float3 scale;
+};
+
+class MeshCodec {
+private:
+#ifdef INDEXED_MESH
+	static const int VERTEX_WORDS = 4;
+#else
+	static const int VERTEX_WORDS = 5;
+#endif
+	std::vector<UINT16> words;
+	std::vector<UINT16> prevWords;
+	std::vector<UINT16> residual;
+	std::vector<UINT16> deltaWords;
+	std::vector<BYTE> packed;
+	MeshHeader prevHeader;
+	bool hasPrev;
+
+	static int wordCount(int vertexSize, int triSize);
+	static void getSizes(byte* mesh, int& vertexSize, int& triSize);
+	// Whether the sizes of a received header fit MAX_VERTEX and its packed words the size bytes of the frame
+	static bool isValid(const MeshHeader& header, int size);
+	int dropFrame(BYTE* quantized);
+public:
+	MeshCodec();
+	// Worst case size of an encoded mesh
+	static const int MAX_ENCODED_SIZE = sizeof(MeshHeader) + 3 * (MAX_VERTEX * VERTEX_WORDS + MAX_VERTEX * 2);
+	// Bound on the size encode writes for this mesh, and the size decode writes for this encoded frame of size bytes
+	static int maxEncodedSize(byte* mesh);
+	static int decodedSize(BYTE* data, int size);
+	// Writes the encoded mesh to data, returns its size
+	int encode(byte* mesh, bool allowDelta, BYTE* data);
+	// Decodes a frame of size bytes from encode into [MeshHeader][UINT16 words], which merge reads. Returns the size
+	// written, or -1 for a frame that is cut short, too large or has indices past its vertices. Such a frame is
+	// replaced by an empty mesh and the next delta frame is dropped as it has no reference.
+	int decode(BYTE* data, int size, BYTE* quantized);
+	// Appends a decoded mesh to a mesh buffer, false if the buffer has no room for it
+	static bool merge(BYTE* quantized, byte* mesh);
+};
+
+#endif
@@ -6,6 +6,7 @@
 //#define TRANSMISSION
 #define IS_SERVER true
 #define CALIBRATION true
+//#define BENCHMARK
 // Camera Parameters
 #define MAX_CAMERAS 8
 #if CALIBRATION == false
@@ -21,13 +22,25 @@
 	#define COLOR_H 1080
 	#define CAMERA_FPS 30
 #endif
+#define CAPTURE_RING 4
+#define CAPTURE_TIMEOUT 100
 // CUDA Parameters
 #define BLOCK_SIZE 16
 #define VOLUME 256
 #define MAX_VERTEX 1000000
+// Indexed Mesh
+//#define INDEXED_MESH
+#define EDGE_HASH_SIZE 2097152
+// Sparse Volume
+//#define SPARSE_VOLUME
+#define BRICK_SIZE 8
+#define MAX_BRICKS 16384
+#define BRICK_HASH_SIZE 32768
 // Transmission
 #define MAX_DELAY_FRAME 20
 #define FRAME_BUFFER_SIZE 30000000
-#define BUFF_SIZE 16384
+#define PEER_IP "192.168.1.1"
+#define PEER_PORT 1288
+#define ROI_TILE 16
 
 #endif
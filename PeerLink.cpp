@@ -0,0 +1,387 @@
+#include "PeerLink.h"
+#include "Backend.h"
+#include <iostream>
+#include <stdlib.h>
+#include <chrono>
+
+namespace PeerLinkNamespace {
+	inline double now() {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	const double STATS_GAIN = 1.0 / 16;
+	// As the smoothed round trip time of TCP
+	const double RTT_GAIN = 1.0 / 8;
+
+	inline void smooth(std::atomic<double>& value, double sample, double gain) {
+		value = value + (sample - value) * gain;
+	}
+}
+using namespace PeerLinkNamespace;
+
+bool PeerLink::start(const PeerAddress& address)
+{
+	if (address.isServer) {
+		std::cout << "listening on " << address.ip << ":" << address.port << std::endl;
+		return socket.listen(address.ip.c_str(), address.port);
+	}
+	else {
+		std::cout << "connecting to " << address.ip << ":" << address.port << std::endl;
+		return socket.connect(address.ip.c_str(), address.port);
+	}
+}
+
+void PeerLink::handshake(StreamFormat localFormat)
+{
+	const int MAGIC = 0x54445233;
+	int localMagic = MAGIC;
+	int remoteMagic = 0;
+	StreamFormat remoteFormat;
+	memset(&remoteFormat, 0, sizeof(StreamFormat));
+	format = localFormat;
+
+	Socket::Buffer hello[] = { { (char*)&localMagic, sizeof(int) }, { (char*)&localFormat, sizeof(StreamFormat) } };
+	socket.send(hello, 2);
+	socket.recv((char*)&remoteMagic, sizeof(int));
+	socket.recv((char*)&remoteFormat, sizeof(StreamFormat));
+	if (remoteMagic != MAGIC) {
+		std::cout << "handshake failed" << std::endl;
+		isConnected = false;
+		return;
+	}
+
+	format.depthCodec = min(localFormat.depthCodec, remoteFormat.depthCodec);
+	format.depthError = min(localFormat.depthError, remoteFormat.depthError);
+	format.colorCodec = min(localFormat.colorCodec, remoteFormat.colorCodec);
+	format.mesh = min(localFormat.mesh, remoteFormat.mesh);
+	format.meshDelta = min(localFormat.meshDelta, remoteFormat.meshDelta);
+	format.roi = min(localFormat.roi, remoteFormat.roi);
+	if (format.mesh) {
+		std::cout << "mesh mode, delta " << format.meshDelta << std::endl;
+	} else {
+		std::cout << "depth codec " << format.depthCodec << ", error " << format.depthError << ", color codec " << format.colorCodec << ", roi " << format.roi << std::endl;
+	}
+}
+
+void PeerLink::disconnect(const char* reason)
+{
+	if (reason != NULL && isConnected) {
+		std::cout << "disconnected: " << reason << std::endl;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isConnected = false;
+	}
+	socket.close();
+	sendSignal.notify_all();
+}
+
+void PeerLink::reserveBuffer(FrameBuffer& buffer, int size)
+{
+	if (buffer.capacity >= size) {
+		return;
+	}
+	// The contents are not kept. Some headroom so that slowly growing frames do not reallocate every time.
+	freeBuffer(buffer);
+	int capacity = size + size / 4;
+	buffer.data = (char*)(buffer.pinned ? Backend::allocHost(capacity) : malloc(capacity));
+	buffer.capacity = capacity;
+}
+
+void PeerLink::freeBuffer(FrameBuffer& buffer)
+{
+	if (buffer.pinned) {
+		Backend::freeHost(buffer.data);
+	} else {
+		free(buffer.data);
+	}
+	buffer.data = NULL;
+	buffer.capacity = 0;
+}
+
+PeerLink::PeerLink(const PeerAddress& address, int delayFrames, StreamFormat localFormat)
+	: jitterBuffer(delayFrames, MAX_DELAY_FRAME - 3)
+{
+	isConnected = start(address);
+	handshake(localFormat);
+
+	this->delayFrames = jitterBuffer.getDelay();
+	remoteFrames = 0;
+	readingFrame = -1;
+	recycledFrames = 0;
+	underruns = 0;
+	overruns = 0;
+	sendingData = NULL;
+	sendingSize = 0;
+	sendingTime = 0;
+	sendPending = false;
+	framesSent = 0;
+	lastSentBytes = 0;
+	bytesSent = 0;
+	lastSendWireTime = 0;
+	sendWireTime = 0;
+	throughput = 0;
+	framesReceived = 0;
+	lastReceivedBytes = 0;
+	bytesReceived = 0;
+	recvWireTime = 0;
+	roundTripTime = 0;
+	echoTime = 0;
+	echoArrival = 0;
+
+	// Everything is allocated on first use, sized by the frames that are actually received
+	for (int i = 0; i < MAX_DELAY_FRAME; i++) {
+		slots[i].sequence = -1;
+		slots[i].frame = NULL;
+		slots[i].size = 0;
+	}
+
+	if (!isConnected) {
+		socket.close();
+	}
+	running = true;
+	sendThread = std::thread(&PeerLink::sendLoop, this);
+	recvThread = std::thread(&PeerLink::recvLoop, this);
+}
+
+PeerLink::~PeerLink()
+{
+	running = false;
+	disconnect(NULL);
+	sendThread.join();
+	recvThread.join();
+
+	for (int i = 0; i < MAX_DELAY_FRAME; i++) {
+		if (slots[i].frame != NULL) {
+			pool.push_back(slots[i].frame);
+		}
+	}
+	for (int i = 0; i < (int)pool.size(); i++) {
+		freeBuffer(*pool[i]);
+		delete pool[i];
+	}
+}
+
+void PeerLink::setDelayFrames(int delayFrames)
+{
+	jitterBuffer.setDelay(delayFrames);
+	this->delayFrames = jitterBuffer.getDelay();
+}
+
+void PeerLink::sendLoop()
+{
+	while (running && isConnected) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			sendSignal.wait(lock, [this] { return sendPending || !isConnected; });
+			if (!isConnected) {
+				break;
+			}
+		}
+
+		double echo[2];
+		{
+			std::lock_guard<std::mutex> lock(echoMutex);
+			echo[0] = echoTime;
+			echo[1] = echoTime > 0 ? now() - echoArrival : 0;
+		}
+		// The header and the frame leave in one gathered write, straight from the frame buffer
+		Socket::Buffer frame[] = { { (char*)&sendingSize, sizeof(int) }, { (char*)&sendingTime, sizeof(double) }, { (char*)echo, 2 * sizeof(double) }, { sendingData, sendingSize } };
+		double start = now();
+		bool sent = socket.send(frame, 4);
+		double wireTime = now() - start;
+		if (sent) {
+			int bytes = sizeof(int) + 3 * sizeof(double) + sendingSize;
+			lastSentBytes = bytes;
+			bytesSent += bytes;
+			lastSendWireTime = wireTime;
+			smooth(sendWireTime, wireTime, STATS_GAIN);
+			// A frame that fits into the socket buffer leaves at once and tells nothing about the link
+			if (wireTime > 1) {
+				smooth(throughput, bytes * 8 / (wireTime * 1000), STATS_GAIN);
+			}
+			framesSent++;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			sendPending = false;
+		}
+		sendSignal.notify_all();
+		if (!sent) {
+			disconnect("send failed");
+		}
+	}
+
+	// A frame handed over just before the disconnect is dropped, waitSent must not wait for it
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		sendPending = false;
+	}
+	sendSignal.notify_all();
+}
+
+void PeerLink::recvLoop()
+{
+	while (running && isConnected) {
+		recvFrame();
+	}
+}
+
+void PeerLink::recvFrame()
+{
+	// Two frames beyond the delay may queue up before the receive thread waits for getFrame to move on
+	int frameId = remoteFrames.load(std::memory_order_relaxed);
+	while (isConnected && frameId - readingFrame.load(std::memory_order_acquire) >= delayFrames + 3) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if (!isConnected) {
+		return;
+	}
+
+	int reading = readingFrame.load(std::memory_order_acquire);
+	for (; recycledFrames < reading; recycledFrames++) {
+		FrameSlot& slot = slots[recycledFrames % MAX_DELAY_FRAME];
+		pool.push_back(slot.frame);
+		slot.frame = NULL;
+	}
+	FrameSlot& slot = slots[frameId % MAX_DELAY_FRAME];
+	if (slot.frame == NULL) {
+		if (pool.empty()) {
+			slot.frame = new FrameBuffer{ NULL, 0, true };
+		} else {
+			slot.frame = pool.back();
+			pool.pop_back();
+		}
+	}
+	FrameBuffer* frame = slot.frame;
+	slot.sequence.store(-1, std::memory_order_relaxed);
+
+	int len = 0;
+	double times[3] = { 0, 0, 0 };
+	bool received = socket.recv((char*)(&len), sizeof(int));
+	if (received && (len < 0 || len > FRAME_BUFFER_SIZE)) {
+		disconnect("invalid frame size");
+		return;
+	}
+	received = received && socket.recv((char*)times, 3 * sizeof(double));
+	double arrival = now();
+	if (received) {
+		jitterBuffer.arrived(times[0], arrival);
+		{
+			std::lock_guard<std::mutex> lock(echoMutex);
+			echoTime = times[0];
+			echoArrival = arrival;
+		}
+		// The echoed time is one of ours, so both clocks cancel out
+		if (times[1] > 0) {
+			double rtt = arrival - times[1] - times[2];
+			roundTripTime = roundTripTime > 0 ? roundTripTime + (rtt - roundTripTime) * RTT_GAIN : rtt;
+		}
+	}
+	if (received && format.mesh) {
+		// Delta frames depend on the previous one, so every mesh is decoded in arrival order
+		meshRecvBuffer.resize(len);
+		received = socket.recv((char*)meshRecvBuffer.data(), len);
+		if (received) {
+			reserveBuffer(*frame, MeshCodec::decodedSize(meshRecvBuffer.data(), len));
+			slot.size = meshDecoder.decode(meshRecvBuffer.data(), len, (BYTE*)frame->data);
+			if (slot.size < 0) {
+				// The frame was replaced by an empty mesh
+				std::cout << "invalid mesh frame, dropped" << std::endl;
+				slot.size = sizeof(MeshHeader);
+			}
+		}
+	} else if (received) {
+		reserveBuffer(*frame, len);
+		received = socket.recv(frame->data, len);
+		slot.size = len;
+	}
+	if (!received) {
+		disconnect("receive failed");
+		return;
+	}
+	int bytes = sizeof(int) + 3 * sizeof(double) + len;
+	lastReceivedBytes = bytes;
+	bytesReceived += bytes;
+	smooth(recvWireTime, now() - arrival, STATS_GAIN);
+	framesReceived++;
+
+	slot.sequence.store(frameId, std::memory_order_release);
+	remoteFrames.store(frameId + 1, std::memory_order_release);
+}
+
+char* PeerLink::acquireFrame(bool& repeated, int& size)
+{
+	int latest = remoteFrames.load(std::memory_order_acquire) - 1;
+	int current = readingFrame.load(std::memory_order_relaxed);
+	int frameId = current + 1;
+	if (current < 0 || latest - frameId > delayFrames) {
+		frameId = latest - delayFrames;
+	}
+	if (frameId < 0) {
+		// The first frames are still being buffered
+		repeated = false;
+		return NULL;
+	}
+
+	repeated = frameId > latest;
+	if (repeated) {
+		underruns++;
+		frameId = current;
+	} else {
+		if (current >= 0) {
+			overruns += frameId - current - 1;
+		}
+		readingFrame.store(frameId, std::memory_order_release);
+	}
+	delayFrames = jitterBuffer.update(repeated, now());
+
+	FrameSlot& slot = slots[frameId % MAX_DELAY_FRAME];
+	size = slot.size;
+	return slot.sequence.load(std::memory_order_acquire) == frameId ? slot.frame->data : NULL;
+}
+
+bool PeerLink::waitSent()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	bool blocked = sendPending;
+	// Also after a disconnect, until the send thread no longer reads the frame
+	sendSignal.wait(lock, [this] { return !sendPending; });
+	return blocked;
+}
+
+void PeerLink::post(const char* data, int size)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!isConnected) {
+			return;
+		}
+		sendingData = data;
+		sendingSize = size;
+		sendingTime = now();
+		sendPending = true;
+	}
+	sendSignal.notify_all();
+}
+
+void PeerLink::getStats(TransmissionStats& stats)
+{
+	stats.connected = isConnected;
+	stats.framesSent = framesSent;
+	stats.framesReceived = framesReceived;
+	stats.lastSentBytes = lastSentBytes;
+	stats.lastReceivedBytes = lastReceivedBytes;
+	stats.bytesSent = bytesSent;
+	stats.bytesReceived = bytesReceived;
+	stats.sendWireTime = sendWireTime;
+	stats.recvWireTime = recvWireTime;
+	stats.roundTripTime = roundTripTime;
+	stats.throughput = throughput;
+	stats.queuedFrames = max(0, remoteFrames - 1 - readingFrame);
+	stats.delayFrames = delayFrames;
+	stats.jitter = jitterBuffer.getJitter();
+	stats.underruns = underruns;
+	stats.overruns = overruns;
+}
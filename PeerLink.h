@@ -0,0 +1,153 @@
+#ifndef PEER_LINK_H
+#define PEER_LINK_H
+
+#include <Windows.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include "Socket.h"
+#include "Parameters.h"
+#include "MeshCodec.h"
+#include "JitterBuffer.h"
+
+// Encoding of the frames, each side proposes one in the handshake and the stricter of the two is used.
+struct StreamFormat {
+	int depthCodec;
+	int depthError; // in DEPTH_CODEC_UNIT, for DEPTH_LOSSY
+	int colorCodec;
+	int mesh; // send the local mesh instead of the RGB-D frames
+	int meshDelta;
+	int roi; // send only the tiles of the frames that reach the volume, see SparseFrame
+};
+
+// Link statistics, times in ms and throughput in Mbit/s. Plain data so that it can be passed through the DLL API.
+struct TransmissionStats {
+	int connected;
+	int framesSent;
+	int framesReceived;
+	int lastSentBytes;
+	int lastReceivedBytes;
+	long long bytesSent;
+	long long bytesReceived;
+	double sendWireTime; // how long a frame takes to leave
+	double recvWireTime; // from the header of a frame to its last byte
+	double roundTripTime;
+	double throughput; // of the send side while a frame is on the wire
+	double linkLoad; // share of the frame interval the link is busy sending
+	int qualityLevel; // 0 is the negotiated format, see RateController
+	int queuedFrames; // received frames that wait to be played
+	int delayFrames;
+	double jitter;
+	int underruns;
+	int overruns;
+};
+
+struct PeerAddress {
+	std::string ip;
+	int port;
+	bool isServer; // listen on ip:port instead of connecting to it
+};
+
+// Frame buffers that only grow, page-locked ones so that the uploads run as DMA
+struct FrameBuffer {
+	char* data;
+	int capacity;
+	bool pinned;
+};
+
+// The connection to one remote site. Frames go over the wire as [int size][double send time][double echo time]
+// [double echo delay][frame]. The echo is the send time of the last frame received from the peer and how long ago
+// it arrived, which gives the round trip time. The send thread writes frames owned by Transmission, the receive
+// thread fills a ring of MAX_DELAY_FRAME slots and acquireFrame reads the frame delayFrames behind the local one.
+class PeerLink {
+private:
+	// Single producer ring between the receive thread and acquireFrame. The receive thread writes frame remoteFrames
+	// into slot remoteFrames % MAX_DELAY_FRAME and publishes its id in sequence; it never writes the slot of
+	// readingFrame, which acquireFrame holds and only moves forward.
+	struct FrameSlot {
+		std::atomic<int> sequence;
+		FrameBuffer* frame;
+		// The bytes of the frame in it
+		int size;
+	};
+
+	Socket socket;
+	std::atomic<bool> running;
+	std::thread sendThread;
+	std::thread recvThread;
+	// Guards the send handoff, the receive side is lock free
+	std::mutex mutex;
+	std::condition_variable sendSignal;
+	StreamFormat format;
+
+	bool start(const PeerAddress& address);
+	void handshake(StreamFormat localFormat);
+	void disconnect(const char* reason);
+	void sendLoop();
+	void recvLoop();
+	void recvFrame();
+
+	std::atomic<int> delayFrames;
+	JitterBuffer jitterBuffer;
+	FrameSlot slots[MAX_DELAY_FRAME];
+	std::atomic<int> remoteFrames;
+	std::atomic<int> readingFrame;
+	std::atomic<int> underruns;
+	std::atomic<int> overruns;
+	// Buffers of the frames behind readingFrame, only touched by the receive thread
+	std::vector<FrameBuffer*> pool;
+	int recycledFrames;
+	// The frame the send thread is writing, it stays valid until waitSent returns
+	const char* sendingData;
+	int sendingSize;
+	double sendingTime;
+	bool sendPending;
+	// Statistics, each written by one thread
+	std::atomic<int> framesSent;
+	std::atomic<int> lastSentBytes;
+	std::atomic<long long> bytesSent;
+	std::atomic<double> lastSendWireTime;
+	std::atomic<double> sendWireTime;
+	std::atomic<double> throughput;
+	std::atomic<int> framesReceived;
+	std::atomic<int> lastReceivedBytes;
+	std::atomic<long long> bytesReceived;
+	std::atomic<double> recvWireTime;
+	std::atomic<double> roundTripTime;
+	// Echo of the last received frame, from the receive thread to the send thread
+	std::mutex echoMutex;
+	double echoTime;
+	double echoArrival;
+	MeshCodec meshDecoder;
+	std::vector<BYTE> meshRecvBuffer;
+
+public:
+	// Blocks until the peer is connected and the formats are negotiated, or the connection failed
+	PeerLink(const PeerAddress& address, int delayFrames, StreamFormat localFormat);
+	~PeerLink();
+	std::atomic<bool> isConnected;
+	StreamFormat getFormat() { return format; }
+	void close(const char* reason) { disconnect(reason); }
+	static void reserveBuffer(FrameBuffer& buffer, int size);
+	static void freeBuffer(FrameBuffer& buffer);
+
+	// Waits for the previous frame to leave and returns whether it had to wait, then post hands over the next one
+	bool waitSent();
+	void post(const char* data, int size);
+	double getLastSendWireTime() { return lastSendWireTime; }
+
+	// A fixed delay, or the initial one when the delay adapts to the jitter of the remote frames
+	void setDelayFrames(int delayFrames);
+	void setAdaptiveDelay(bool adaptive) { jitterBuffer.setAdaptive(adaptive); }
+	int getDelayHistory(int* delays, int size) { return jitterBuffer.getHistory(delays, size); }
+	// Plays the received frames in order and never waits. Playback jumps ahead when it falls more than delayFrames
+	// behind the latest frame, skipped frames count as overruns. An underrun repeats the previous frame because the
+	// next one has not arrived. NULL while the first frames are buffered. size is the length of the frame.
+	char* acquireFrame(bool& repeated, int& size);
+	void getStats(TransmissionStats& stats);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "RateController.h"
+#include "Transmission.h"
+
+namespace RateControllerNamespace {
+	const double GAIN = 1.0 / 16;
+	// One DEPTH_CODEC_UNIT step is the finest lossy error, larger ones are capped at 16 mm
+	const int MAX_DEPTH_ERROR = (int)(0.016f / DEPTH_CODEC_UNIT);
+}
+using namespace RateControllerNamespace;
+
+const double RateController::HIGH_LOAD = 0.8;
+const double RateController::LOW_LOAD = 0.4;
+
+RateController::RateController()
+{
+	levels = 1;
+	level = 0;
+	enabled = true;
+	quietFrames = 0;
+	settleFrames = 0;
+	wireTime = 0;
+	interval = 1000.0 / CAMERA_FPS;
+	depthCodec[0] = DepthCodec::DEPTH_LOSSLESS;
+	depthError[0] = 0;
+	colorCodec[0] = ColorCodec::COLOR_YUV420;
+}
+
+void RateController::reset(const StreamFormat& format)
+{
+	depthCodec[0] = format.depthCodec;
+	depthError[0] = format.depthError;
+	colorCodec[0] = format.colorCodec;
+	levels = 1;
+	while (levels < MAX_LEVELS) {
+		int i = levels;
+		depthCodec[i] = depthCodec[i - 1];
+		depthError[i] = depthError[i - 1];
+		colorCodec[i] = colorCodec[i - 1];
+		if (colorCodec[i] < ColorCodec::COLOR_YUV420) {
+			colorCodec[i]++;
+		} else if (depthCodec[i] < DepthCodec::DEPTH_LOSSY) {
+			depthCodec[i]++;
+		} else if (depthError[i] < MAX_DEPTH_ERROR) {
+			depthError[i] = min(2 * depthError[i], MAX_DEPTH_ERROR);
+		} else {
+			break;
+		}
+		// DEPTH_LOSSY without an error is lossless
+		if (depthCodec[i] == DepthCodec::DEPTH_LOSSY && depthError[i] <= 0) {
+			depthError[i] = 1;
+		}
+		levels++;
+	}
+	level = 0;
+	quietFrames = 0;
+	settleFrames = 0;
+}
+
+void RateController::setEnabled(bool enabled)
+{
+	this->enabled = enabled;
+	if (!enabled) {
+		level = 0;
+	}
+}
+
+void RateController::update(double frameWireTime, double frameInterval, bool blocked)
+{
+	wireTime = wireTime + (frameWireTime - wireTime) * GAIN;
+	interval = interval + (frameInterval - interval) * GAIN;
+	if (!enabled) {
+		return;
+	}
+	if (settleFrames > 0) {
+		settleFrames--;
+		return;
+	}
+
+	double load = getLoad();
+	if ((blocked || load > HIGH_LOAD) && level < levels - 1) {
+		level++;
+		quietFrames = 0;
+		settleFrames = SETTLE_FRAMES;
+	} else if (load < LOW_LOAD && !blocked) {
+		if (++quietFrames >= RAISE_FRAMES && level > 0) {
+			level--;
+			quietFrames = 0;
+			settleFrames = SETTLE_FRAMES;
+		}
+	} else {
+		quietFrames = 0;
+	}
+}
+
+void RateController::apply(StreamFormat& format)
+{
+	format.depthCodec = depthCodec[level];
+	format.depthError = depthError[level];
+	format.colorCodec = colorCodec[level];
+}
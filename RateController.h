@@ -0,0 +1,46 @@
+#ifndef RATE_CONTROLLER_H
+#define RATE_CONTROLLER_H
+
+#include "Parameters.h"
+
+struct StreamFormat;
+
+// Lowers the quality of the sent frames when the link cannot keep up. The send thread reports how long each frame
+// took to leave, which grows once the socket buffer is full; the render thread reports the frame interval and whether
+// sendFrame had to wait for the previous frame. A link that is busy more than HIGH_LOAD of the frame interval, or a
+// wait, steps the quality down one level; after RAISE_FRAMES frames below LOW_LOAD it steps back up. The levels start
+// at the negotiated format and trade color first, then depth: 4:2:2 to 4:2:0, lossless to lossy depth, then a doubled
+// depth error per level.
+class RateController {
+private:
+	static const int MAX_LEVELS = 8;
+	static const int RAISE_FRAMES = 2 * CAMERA_FPS;
+	// Frames after a change before the load is judged again, the smoothed times need a while to follow
+	static const int SETTLE_FRAMES = CAMERA_FPS / 2;
+	static const double HIGH_LOAD;
+	static const double LOW_LOAD;
+	int depthCodec[MAX_LEVELS];
+	int depthError[MAX_LEVELS];
+	int colorCodec[MAX_LEVELS];
+	int levels;
+	int level;
+	bool enabled;
+	int quietFrames;
+	int settleFrames;
+	double wireTime;
+	double interval;
+
+public:
+	RateController();
+	// Builds the levels below the negotiated format and starts at the top one
+	void reset(const StreamFormat& format);
+	void setEnabled(bool enabled);
+	// Called once per sent frame with the wire time of the last frame and the time since the previous call, in ms
+	void update(double frameWireTime, double frameInterval, bool blocked);
+	// Writes the codecs of the current level into format
+	void apply(StreamFormat& format);
+	int getLevel() { return level; }
+	double getLoad() { return wireTime / (interval > 1 ? interval : 1); }
+};
+
+#endif
@@ -1,86 +1,45 @@
 #include "RealsenseGrabber.h"
-#include "Timer.h"
-#include "Configuration.h"
+#include "DepthMedian.h"
 #include "librealsense2/hpp/rs_sensor.hpp"
 #include "librealsense2/hpp/rs_processing.hpp"
 
 RealsenseGrabber::RealsenseGrabber()
 {
-	depthFilter = new DepthFilter();
-	colorFilter = new ColorFilter();
-	alignColorMap = new AlignColorMap();
-	depthImages = new UINT16*[MAX_CAMERAS];
-	colorImages = new UINT8*[MAX_CAMERAS];
-	for (int i = 0; i < MAX_CAMERAS; i++) {
-		depthImages[i] = new UINT16[DEPTH_H * DEPTH_W];
-		colorImages[i] = new UINT8[2 * COLOR_H * COLOR_W];
-		memset(depthImages[i], 0, DEPTH_H * DEPTH_W * sizeof(UINT16));
-		memset(colorImages[i], 0, 2 * COLOR_H * COLOR_W * sizeof(UINT8));
-	}
-	colorImagesRGB = new RGBQUAD*[MAX_CAMERAS];
-	for (int i = 0; i < MAX_CAMERAS; i++) {
-		colorImagesRGB[i] = new RGBQUAD[COLOR_H * COLOR_W];
-	}
-	depth2color = new Transformation[MAX_CAMERAS];
-	color2depth = new Transformation[MAX_CAMERAS];
-	depthIntrinsics = new Intrinsics[MAX_CAMERAS];
-	colorIntrinsics = new Intrinsics[MAX_CAMERAS];
-	transmission = NULL;
-
+	capturing = true;
+	getDepthFilter()->setMedianOnCapture(true);
 	rs2::context context;
 	rs2::device_list deviceList = context.query_devices();
 	for (int i = 0; i < deviceList.size(); i++) {
 		enableDevice(deviceList[i]);
 		std::cout << "Device " << i << " open." << std::endl;
 	}
-}
 
-RealsenseGrabber::~RealsenseGrabber()
-{
-	if (depthFilter != NULL) {
-		delete depthFilter;
-	}
-	if (colorFilter != NULL) {
-		delete colorFilter;
-	}
-	if (alignColorMap != NULL) {
-		delete alignColorMap;
-	}
-	if (depthImages != NULL) {
-		for (int i = 0; i < MAX_CAMERAS; i++) {
-			if (depthImages[i] != NULL) {
-				delete depthImages[i];
-			}
+	for (int i = 0; i < devices.size(); i++) {
+		CaptureRing* ring = new CaptureRing();
+		for (int j = 0; j < CAPTURE_RING; j++) {
+			ring->slots[j].depth = new UINT16[DEPTH_H * DEPTH_W];
+			ring->slots[j].color = new UINT8[2 * COLOR_H * COLOR_W];
 		}
-		delete[] depthImages;
+		ring->head = 0;
+		ring->tail = 0;
+		ring->dropped = 0;
+		rings.push_back(ring);
 	}
-	if (colorImages != NULL) {
-		for (int i = 0; i < MAX_CAMERAS; i++) {
-			if (colorImages[i] != NULL) {
-				delete colorImages[i];
-			}
-		}
-		delete[] colorImages;
+	for (int i = 0; i < devices.size(); i++) {
+		rings[i]->thread = std::thread(&RealsenseGrabber::capture, this, i);
 	}
-	if (colorImagesRGB != NULL) {
-		for (int i = 0; i < MAX_CAMERAS; i++) {
-			if (colorImagesRGB[i] != NULL) {
-				delete colorImagesRGB[i];
-			}
+}
+
+RealsenseGrabber::~RealsenseGrabber()
+{
+	capturing = false;
+	for (int i = 0; i < rings.size(); i++) {
+		rings[i]->thread.join();
+		for (int j = 0; j < CAPTURE_RING; j++) {
+			delete[] rings[i]->slots[j].depth;
+			delete[] rings[i]->slots[j].color;
 		}
-		delete[] colorImagesRGB;
-	}
-	if (depth2color != NULL) {
-		delete[] depth2color;
-	}
-	if (color2depth != NULL) {
-		delete[] color2depth;
-	}
-	if (depthIntrinsics != NULL) {
-		delete[] depthIntrinsics;
-	}
-	if (colorIntrinsics != NULL) {
-		delete[] colorIntrinsics;
+		delete rings[i];
 	}
 	for (int i = 0; i < devices.size(); i++) {
 		devices[i].stop();
@@ -104,6 +63,10 @@ void RealsenseGrabber::enableDevice(rs2::device device)
 	
 	std::vector<rs2::sensor> sensors = device.query_sensors();
 	for (int i = 0; i < sensors.size(); i++) {
+		// Timestamps in the host clock domain, so that the frames of different devices can be compared
+		if (sensors[i].supports(RS2_OPTION_GLOBAL_TIME_ENABLED)) {
+			sensors[i].set_option(RS2_OPTION_GLOBAL_TIME_ENABLED, 1);
+		}
 		if (strcmp(sensors[i].get_info(RS2_CAMERA_INFO_NAME), "Stereo Module") == 0) {
 			sensors[i].set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, 0);
 			float depth_unit = sensors[i].get_option(RS2_OPTION_DEPTH_UNITS);
@@ -125,129 +88,132 @@ void RealsenseGrabber::enableDevice(rs2::device device)
 	devices.push_back(pipeline);
 }
 
-int RealsenseGrabber::getRGBD(float*& depthImages_device, RGBQUAD*& colorImages_device, Transformation* world2depth, Transformation* world2color, Intrinsics*& depthIntrinsics, Intrinsics*& colorIntrinsics)
+void RealsenseGrabber::capture(int deviceId)
 {
-	depthImages_device = depthFilter->getCurrFrame_device();
-	colorImages_device = colorFilter->getCurrFrame_device();
-	depthIntrinsics = this->depthIntrinsics;
-	colorIntrinsics = this->colorIntrinsics;
-	bool check[MAX_CAMERAS] = { false };
-
-	for (int deviceId = 0; deviceId < devices.size(); deviceId++) {
-		rs2::pipeline pipeline = devices[deviceId];
-		rs2::frameset frameset = pipeline.wait_for_frames();
-		check[deviceId] = (frameset.size() == 2);
+	rs2::pipeline pipeline = devices[deviceId];
+	CaptureRing* ring = rings[deviceId];
+
+	while (capturing) {
+		rs2::frameset frameset;
+		try {
+			frameset = pipeline.wait_for_frames(CAPTURE_TIMEOUT * 10);
+		} catch (const rs2::error&) {
+			continue;
+		}
 
-		if (check[deviceId] == false) {
+		if (frameset.size() != 2) {
 			std::cout << deviceId << " Failed" << std::endl;
+			continue;
 		}
 
-		if (check[deviceId]) {
-			rs2::stream_profile depthProfile;
-			rs2::stream_profile colorProfile;
-
-			for (int i = 0; i < frameset.size(); i++) {
-				rs2::frame frame = frameset[i];
-				rs2::stream_profile profile = frame.get_profile();
-				rs2_intrinsics intrinsics = profile.as<rs2::video_stream_profile>().get_intrinsics();
-
-				if (profile.stream_type() == RS2_STREAM_DEPTH) {
-					depthProfile = profile;
-					depthIntrinsics[deviceId].fx = intrinsics.fx;
-					depthIntrinsics[deviceId].fy = intrinsics.fy;
-					depthIntrinsics[deviceId].ppx = intrinsics.ppx;
-					depthIntrinsics[deviceId].ppy = intrinsics.ppy;
-					memcpy(depthImages[deviceId], frame.get_data(), DEPTH_H * DEPTH_W * sizeof(UINT16));
-				}
-				if (profile.stream_type() == RS2_STREAM_COLOR) {
-					colorProfile = profile;
-					colorIntrinsics[deviceId].fx = intrinsics.fx;
-					colorIntrinsics[deviceId].fy = intrinsics.fy;
-					colorIntrinsics[deviceId].ppx = intrinsics.ppx;
-					colorIntrinsics[deviceId].ppy = intrinsics.ppy;
-					memcpy(colorImages[deviceId], frame.get_data(), 2 * COLOR_H * COLOR_W * sizeof(UINT8));
+		// The ring is full when grabFrames falls behind, the frame is dropped then
+		int head = ring->head.load(std::memory_order_relaxed);
+		if (head - ring->tail.load(std::memory_order_acquire) >= CAPTURE_RING) {
+			ring->dropped++;
+			continue;
+		}
+
+		CapturedFrame& slot = ring->slots[head % CAPTURE_RING];
+		rs2::stream_profile depthProfile;
+		rs2::stream_profile colorProfile;
+
+		for (int i = 0; i < frameset.size(); i++) {
+			rs2::frame frame = frameset[i];
+			rs2::stream_profile profile = frame.get_profile();
+			rs2_intrinsics intrinsics = profile.as<rs2::video_stream_profile>().get_intrinsics();
+
+			if (profile.stream_type() == RS2_STREAM_DEPTH) {
+				depthProfile = profile;
+				slot.depthIntrinsics.fx = intrinsics.fx;
+				slot.depthIntrinsics.fy = intrinsics.fy;
+				slot.depthIntrinsics.ppx = intrinsics.ppx;
+				slot.depthIntrinsics.ppy = intrinsics.ppy;
+				slot.timestamp = frame.get_timestamp();
+				// The median runs here on the thread of the device rather than for all devices on the GPU
+				slot.medianFiltered = getDepthFilter()->isMedianOnCapture();
+				if (slot.medianFiltered) {
+					DepthMedian::filter((const UINT16*)frame.get_data(), slot.depth);
+				} else {
+					memcpy(slot.depth, frame.get_data(), DEPTH_H * DEPTH_W * sizeof(UINT16));
 				}
 			}
-
-			rs2_extrinsics d2cExtrinsics = depthProfile.get_extrinsics_to(colorProfile);
-			depth2color[deviceId] = Transformation(d2cExtrinsics.rotation, d2cExtrinsics.translation);
-			rs2_extrinsics c2dExtrinsics = colorProfile.get_extrinsics_to(depthProfile);
-			color2depth[deviceId] = Transformation(c2dExtrinsics.rotation, c2dExtrinsics.translation);
-		}
-	}
-	
-	for (int i = 0; i < devices.size(); i++) {
-		if (check[i]) {
-			depthFilter->setConvertFactor(i, depthIntrinsics[i].fx * convertFactors[i]);
-			depthFilter->process(i, depthImages[i]);
-			colorFilter->process(i, colorImages[i]);
+			if (profile.stream_type() == RS2_STREAM_COLOR) {
+				colorProfile = profile;
+				slot.colorIntrinsics.fx = intrinsics.fx;
+				slot.colorIntrinsics.fy = intrinsics.fy;
+				slot.colorIntrinsics.ppx = intrinsics.ppx;
+				slot.colorIntrinsics.ppy = intrinsics.ppy;
+				memcpy(slot.color, frame.get_data(), 2 * COLOR_H * COLOR_W * sizeof(UINT8));
+			}
 		}
-	}
 
-	colorImages_device = alignColorMap->getAlignedColor_device(devices.size(), check, depthImages_device, colorImages_device, depthIntrinsics, colorIntrinsics, depth2color);
-	for (int i = 0; i < devices.size(); i++) {
-		if (check[i]) {
-			world2depth[i] = color2depth[i] * world2color[i];
-			colorIntrinsics[i] = depthIntrinsics[i].zoom((float)COLOR_W / DEPTH_W, (float)COLOR_H / DEPTH_H);
-		}
-	}
+		rs2_extrinsics d2cExtrinsics = depthProfile.get_extrinsics_to(colorProfile);
+		slot.depth2color = Transformation(d2cExtrinsics.rotation, d2cExtrinsics.translation);
+		rs2_extrinsics c2dExtrinsics = colorProfile.get_extrinsics_to(depthProfile);
+		slot.color2depth = Transformation(c2dExtrinsics.rotation, c2dExtrinsics.translation);
 
-	if (transmission != NULL && transmission->isConnected) {
-		transmission->prepareSendFrame(devices.size(), check, depthImages_device, colorImages_device, world2depth, depthIntrinsics, colorIntrinsics);
+		ring->head.store(head + 1, std::memory_order_release);
 	}
-
-	return devices.size();
 }
 
-int RealsenseGrabber::getRGB(RGBQUAD**& colorImages, Intrinsics*& colorIntrinsics)
+// Waits up to CAPTURE_TIMEOUT ms until every device has a new frame, then takes the buffered frames with the
+// closest timestamps. The buffers of the slot are swapped with the raw images instead of copied. Frames captured with
+// the median on capture set otherwise than now, such as the ones buffered before record turned it off, are dropped so
+// that the depth filter and the recording never take a filtered frame for a raw one.
+int RealsenseGrabber::grabFrames(bool* check)
 {
-	colorImages = this->colorImagesRGB;
-	colorIntrinsics = this->colorIntrinsics;
-	bool check[MAX_CAMERAS];
+	bool medianOnCapture = getDepthFilter()->isMedianOnCapture();
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CAPTURE_TIMEOUT);
+	int tail[MAX_CAMERAS];
+	int counts[MAX_CAMERAS];
+	int selected[MAX_CAMERAS];
+	double frameTimestamps[MAX_CAMERAS * CAPTURE_RING];
 
 	for (int deviceId = 0; deviceId < devices.size(); deviceId++) {
-		rs2::pipeline pipeline = devices[deviceId];
-		rs2::frameset frameset = pipeline.wait_for_frames();
-		check[deviceId] = (frameset.size() == 2);
-
-		if (check[deviceId]) {
-			for (int i = 0; i < frameset.size(); i++) {
-				rs2::frame frame = frameset[i];
-				rs2::stream_profile profile = frame.get_profile();
-				rs2_intrinsics intrinsics = profile.as<rs2::video_stream_profile>().get_intrinsics();
-
-				if (profile.stream_type() == RS2_STREAM_COLOR) {
-					colorIntrinsics[deviceId].fx = intrinsics.fx;
-					colorIntrinsics[deviceId].fy = intrinsics.fy;
-					colorIntrinsics[deviceId].ppx = intrinsics.ppx;
-					colorIntrinsics[deviceId].ppy = intrinsics.ppy;
-					memcpy(this->colorImages[deviceId], frame.get_data(), 2 * COLOR_W * COLOR_H * sizeof(UINT8));
-				}
+		CaptureRing* ring = rings[deviceId];
+		tail[deviceId] = ring->tail.load(std::memory_order_relaxed);
+		int head = ring->head.load(std::memory_order_acquire);
+		while (true) {
+			while (head != tail[deviceId] && ring->slots[tail[deviceId] % CAPTURE_RING].medianFiltered != medianOnCapture) {
+				tail[deviceId]++;
+				ring->dropped++;
+			}
+			if (head != tail[deviceId] || std::chrono::steady_clock::now() >= deadline) {
+				break;
 			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			head = ring->head.load(std::memory_order_acquire);
 		}
-	}
-
-	RGBQUAD* colorImages_device = colorFilter->getCurrFrame_device();
-	for (int i = 0; i < devices.size(); i++) {
-		if (check[i]) {
-			colorFilter->process(i, this->colorImages[i]);
-			cudaMemcpy(this->colorImagesRGB[i], colorImages_device + i * COLOR_W * COLOR_H, COLOR_W * COLOR_H * sizeof(RGBQUAD), cudaMemcpyDeviceToHost);
+		ring->tail.store(tail[deviceId], std::memory_order_release);
+		counts[deviceId] = head - tail[deviceId];
+		for (int j = 0; j < counts[deviceId]; j++) {
+			frameTimestamps[deviceId * CAPTURE_RING + j] = ring->slots[(tail[deviceId] + j) % CAPTURE_RING].timestamp;
 		}
 	}
 
-	return devices.size();
-}
+	synchronizer.select(devices.size(), frameTimestamps, counts, selected);
+
+	for (int deviceId = 0; deviceId < devices.size(); deviceId++) {
+		CaptureRing* ring = rings[deviceId];
+		check[deviceId] = (selected[deviceId] != -1);
+
+		if (check[deviceId] == false) {
+			std::cout << deviceId << " Failed" << std::endl;
+		}
 
-void RealsenseGrabber::saveBackground() {
-	if (alignColorMap->isBackgroundOn()) {
-		alignColorMap->disableBackground();
-	} else {
-		alignColorMap->enableBackground(depthFilter->getCurrFrame_device());
+		if (check[deviceId]) {
+			int frameId = tail[deviceId] + selected[deviceId];
+			CapturedFrame& slot = ring->slots[frameId % CAPTURE_RING];
+			std::swap(depthImages[deviceId], slot.depth);
+			std::swap(colorImages[deviceId], slot.color);
+			depthIntrinsics[deviceId] = slot.depthIntrinsics;
+			colorIntrinsics[deviceId] = slot.colorIntrinsics;
+			depth2color[deviceId] = slot.depth2color;
+			color2depth[deviceId] = slot.color2depth;
+			timestamps[deviceId] = slot.timestamp;
+			ring->tail.store(frameId + 1, std::memory_order_release);
+		}
 	}
-	Configuration::saveBackground(alignColorMap);
-}
 
-void RealsenseGrabber::loadBackground()
-{
-	Configuration::loadBackground(alignColorMap);
+	return devices.size();
 }
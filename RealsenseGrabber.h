@@ -5,48 +5,52 @@
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <map>
 #include <Windows.h>
-#include "Parameters.h"
-#include "TsdfVolume.cuh"
-#include "DepthFilter.h"
-#include "ColorFilter.h"
-#include "AlignColorMap.h"
-#include "Transmission.h"
+#include "Grabber.h"
+#include "FrameSynchronizer.h"
 
-class RealsenseGrabber
+class RealsenseGrabber : public Grabber
 {
 private:
-	struct ViewPort {
-		rs2::pipeline pipe;
-		rs2::pipeline_profile profile;
+	struct CapturedFrame {
+		UINT16* depth;
+		UINT8* color;
+		Intrinsics depthIntrinsics;
+		Intrinsics colorIntrinsics;
+		Transformation depth2color;
+		Transformation color2depth;
+		double timestamp;
+		// Whether the depth went through DepthMedian on capture
+		bool medianFiltered;
+	};
+	// Single producer ring filled by the capture thread of one device. head counts the published frames,
+	// tail the frames released by grabFrames; the capture thread only writes slot head while head - tail < CAPTURE_RING.
+	struct CaptureRing {
+		CapturedFrame slots[CAPTURE_RING];
+		std::atomic<int> head;
+		std::atomic<int> tail;
+		std::atomic<int> dropped;
+		std::thread thread;
 	};
 	std::vector<rs2::pipeline> devices;
-	std::vector<float> convertFactors;
-
-	DepthFilter* depthFilter;
-	ColorFilter* colorFilter;
-	AlignColorMap* alignColorMap;
+	std::vector<CaptureRing*> rings;
+	std::atomic<bool> capturing;
+	FrameSynchronizer synchronizer;
 
 	void enableDevice(rs2::device device);
+	void capture(int deviceId);
 
-	UINT16** depthImages;
-	UINT8** colorImages;
-	RGBQUAD** colorImagesRGB;
-	Transformation* depth2color;
-	Transformation* color2depth;
-	Intrinsics* depthIntrinsics;
-	Intrinsics* colorIntrinsics;
-	Transmission* transmission;
+protected:
+	int grabFrames(bool* check);
 
 public:
 	RealsenseGrabber();
 	~RealsenseGrabber();
-	int getRGBD(float*& depthImages_device, RGBQUAD*& colorImages_device, Transformation* world2depth, Transformation* world2color, Intrinsics*& depthIntrinscis, Intrinsics*& colorIntrinsics);
-	int getRGB(RGBQUAD**& colorImages, Intrinsics*& colorIntrinsics);
-	void saveBackground();
-	void loadBackground();
-	void setTransmission(Transmission* transmission) { this->transmission = transmission; }
+	// Timestamp spread of the last frame set in ms, and the frames skipped per device by the ring and the synchronizer
+	double getSyncSpread() { return synchronizer.getSpread(); }
+	int getDroppedFrames(int deviceId) { return synchronizer.getDroppedFrames(deviceId) + rings[deviceId]->dropped; }
 };
 
 #endif
@@ -0,0 +1,143 @@
+#include "RecordedSession.h"
+#include <iostream>
+
+SessionWriter::SessionWriter(const char* fileName)
+{
+	memset(&header, 0, sizeof(SessionHeader));
+	header.magic = SESSION_MAGIC;
+	header.version = SESSION_VERSION;
+	header.depthW = DEPTH_W;
+	header.depthH = DEPTH_H;
+	header.colorW = COLOR_W;
+	header.colorH = COLOR_H;
+
+	file = fopen(fileName, "wb");
+	if (file == NULL) {
+		std::cout << "Cannot create session " << fileName << std::endl;
+		return;
+	}
+	fwrite(&header, sizeof(SessionHeader), 1, file);
+	std::cout << "Recording session " << fileName << std::endl;
+}
+
+SessionWriter::~SessionWriter()
+{
+	if (file != NULL) {
+		fseek(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(SessionHeader), 1, file);
+		fclose(file);
+		std::cout << "Session saved, " << header.frames << " frames." << std::endl;
+	}
+}
+
+void SessionWriter::write(int cameras, bool* check, float* convertFactors, double* timestamps, UINT16** depthImages, UINT8** colorImages, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics, Transformation* depth2color, Transformation* color2depth)
+{
+	if (file == NULL) {
+		return;
+	}
+
+	// The camera count is fixed by the first frame and the header is written again right away,
+	// so a session that is not closed properly can still be replayed.
+	if (header.frames == 0) {
+		header.cameras = cameras;
+		memcpy(header.convertFactors, convertFactors, cameras * sizeof(float));
+		fseek(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(SessionHeader), 1, file);
+		fseek(file, 0, SEEK_END);
+	}
+
+	for (int i = 0; i < header.cameras; i++) {
+		DeviceFrameHeader device;
+		memset(&device, 0, sizeof(DeviceFrameHeader));
+		device.valid = (i < cameras && check[i]);
+		device.timestamp = timestamps[i];
+		device.depthIntrinsics = depthIntrinsics[i];
+		device.colorIntrinsics = colorIntrinsics[i];
+		device.depth2color = depth2color[i];
+		device.color2depth = color2depth[i];
+		fwrite(&device, sizeof(DeviceFrameHeader), 1, file);
+		fwrite(depthImages[i], sizeof(UINT16), DEPTH_W * DEPTH_H, file);
+		fwrite(colorImages[i], sizeof(UINT8), 2 * COLOR_W * COLOR_H, file);
+	}
+	header.frames++;
+}
+
+SessionReader::SessionReader(const char* fileName)
+{
+	mapping = NULL;
+	view = NULL;
+	frame = NULL;
+	memset(&header, 0, sizeof(SessionHeader));
+
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	granularity = systemInfo.dwAllocationGranularity;
+
+	file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		std::cout << "Cannot open session " << fileName << std::endl;
+		return;
+	}
+
+	LARGE_INTEGER size;
+	DWORD bytes = 0;
+	GetFileSizeEx(file, &size);
+	fileSize = size.QuadPart;
+	ReadFile(file, &header, sizeof(SessionHeader), &bytes, NULL);
+	if (bytes != sizeof(SessionHeader) || header.magic != SESSION_MAGIC || header.version != SESSION_VERSION) {
+		std::cout << "Invalid session " << fileName << std::endl;
+		return;
+	}
+	if (header.depthW != DEPTH_W || header.depthH != DEPTH_H || header.colorW != COLOR_W || header.colorH != COLOR_H) {
+		std::cout << "Session " << fileName << " was recorded with different stream sizes" << std::endl;
+		return;
+	}
+	if (header.cameras <= 0 || header.cameras > MAX_CAMERAS) {
+		std::cout << "Session " << fileName << " is empty" << std::endl;
+		return;
+	}
+
+	// The frame count in the header is only updated when the recording is closed
+	header.frames = (int)((fileSize - sizeof(SessionHeader)) / (header.cameras * DEVICE_FRAME_SIZE));
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		std::cout << "Cannot map session " << fileName << std::endl;
+		return;
+	}
+	std::cout << "Replaying session " << fileName << ", " << header.cameras << " cameras, " << header.frames << " frames." << std::endl;
+}
+
+SessionReader::~SessionReader()
+{
+	if (view != NULL) {
+		UnmapViewOfFile(view);
+	}
+	if (mapping != NULL) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+}
+
+bool SessionReader::seek(int frameId)
+{
+	if (mapping == NULL || frameId < 0 || frameId >= header.frames) {
+		return false;
+	}
+
+	INT64 frameSize = header.cameras * DEVICE_FRAME_SIZE;
+	INT64 offset = sizeof(SessionHeader) + frameId * frameSize;
+	INT64 alignedOffset = offset - offset % granularity;
+
+	if (view != NULL) {
+		UnmapViewOfFile(view);
+	}
+	view = (BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(alignedOffset >> 32), (DWORD)(alignedOffset & 0xFFFFFFFF), (SIZE_T)(offset - alignedOffset + frameSize));
+	if (view == NULL) {
+		frame = NULL;
+		return false;
+	}
+	frame = view + (offset - alignedOffset);
+	return true;
+}
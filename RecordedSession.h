@@ -0,0 +1,69 @@
+#ifndef RECORDED_SESSION_H
+#define RECORDED_SESSION_H
+
+#include <stdio.h>
+#include <Windows.h>
+#include "Parameters.h"
+#include "TsdfVolume.cuh"
+
+// A recorded session is a header followed by fixed size frames. Every frame holds one record per device:
+// [DeviceFrameHeader][UINT16 depth * DEPTH_W * DEPTH_H][UINT8 yuyv * 2 * COLOR_W * COLOR_H]
+#define SESSION_MAGIC 0x44424752
+#define SESSION_VERSION 1
+
+struct SessionHeader {
+	UINT32 magic;
+	UINT32 version;
+	INT32 cameras;
+	INT32 frames;
+	INT32 depthW, depthH;
+	INT32 colorW, colorH;
+	float convertFactors[MAX_CAMERAS];
+};
+
+struct DeviceFrameHeader {
+	INT32 valid;
+	INT32 reserved;
+	double timestamp; // ms, as reported by the camera
+	Intrinsics depthIntrinsics;
+	Intrinsics colorIntrinsics;
+	Transformation depth2color;
+	Transformation color2depth;
+};
+
+#define DEVICE_FRAME_SIZE (sizeof(DeviceFrameHeader) + DEPTH_W * DEPTH_H * sizeof(UINT16) + 2 * COLOR_W * COLOR_H * sizeof(UINT8))
+
+class SessionWriter {
+private:
+	FILE* file;
+	SessionHeader header;
+public:
+	SessionWriter(const char* fileName);
+	~SessionWriter();
+	void write(int cameras, bool* check, float* convertFactors, double* timestamps, UINT16** depthImages, UINT8** colorImages, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics, Transformation* depth2color, Transformation* color2depth);
+};
+
+// Maps one frame of the session at a time, so the reader streams through files larger than the memory.
+class SessionReader {
+private:
+	HANDLE file;
+	HANDLE mapping;
+	SessionHeader header;
+	INT64 fileSize;
+	DWORD granularity;
+	BYTE* view;
+	BYTE* frame;
+public:
+	SessionReader(const char* fileName);
+	~SessionReader();
+	bool isOpen() { return mapping != NULL; }
+	int getCameras() { return header.cameras; }
+	int getFrames() { return header.frames; }
+	float getConvertFactor(int deviceId) { return header.convertFactors[deviceId]; }
+	bool seek(int frameId);
+	DeviceFrameHeader* getHeader(int deviceId) { return (DeviceFrameHeader*)(frame + deviceId * DEVICE_FRAME_SIZE); }
+	UINT16* getDepth(int deviceId) { return (UINT16*)(frame + deviceId * DEVICE_FRAME_SIZE + sizeof(DeviceFrameHeader)); }
+	UINT8* getColor(int deviceId) { return (UINT8*)getDepth(deviceId) + DEPTH_W * DEPTH_H * sizeof(UINT16); }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "ReplayGrabber.h"
+#include <thread>
+
+ReplayGrabber::ReplayGrabber(const char* fileName, bool realTime)
+{
+	this->realTime = realTime;
+	frameId = 0;
+	reader = new SessionReader(fileName);
+	if (reader->isOpen()) {
+		for (int i = 0; i < reader->getCameras(); i++) {
+			convertFactors.push_back(reader->getConvertFactor(i));
+		}
+	}
+}
+
+ReplayGrabber::~ReplayGrabber()
+{
+	if (reader != NULL) {
+		delete reader;
+	}
+}
+
+int ReplayGrabber::grabFrames(bool* check)
+{
+	if (!reader->isOpen() || reader->getFrames() == 0) {
+		return 0;
+	}
+
+	if (frameId == reader->getFrames()) {
+		frameId = 0;
+	}
+	if (!reader->seek(frameId)) {
+		std::cout << "Cannot read frame " << frameId << std::endl;
+		return 0;
+	}
+
+	int cameras = reader->getCameras();
+	for (int deviceId = 0; deviceId < cameras; deviceId++) {
+		DeviceFrameHeader* header = reader->getHeader(deviceId);
+		check[deviceId] = (header->valid != 0);
+
+		if (check[deviceId]) {
+			depthIntrinsics[deviceId] = header->depthIntrinsics;
+			colorIntrinsics[deviceId] = header->colorIntrinsics;
+			depth2color[deviceId] = header->depth2color;
+			color2depth[deviceId] = header->color2depth;
+			timestamps[deviceId] = header->timestamp;
+			memcpy(depthImages[deviceId], reader->getDepth(deviceId), DEPTH_H * DEPTH_W * sizeof(UINT16));
+			memcpy(colorImages[deviceId], reader->getColor(deviceId), 2 * COLOR_H * COLOR_W * sizeof(UINT8));
+		}
+	}
+
+	// Frames are released at the time offset they were captured at, relative to the first frame of the loop
+	if (realTime) {
+		double timestamp = reader->getHeader(0)->timestamp;
+		if (frameId == 0) {
+			firstTimestamp = timestamp;
+			startTime = std::chrono::steady_clock::now();
+		} else {
+			std::this_thread::sleep_until(startTime + std::chrono::microseconds((INT64)((timestamp - firstTimestamp) * 1000)));
+		}
+	}
+
+	frameId++;
+	return cameras;
+}
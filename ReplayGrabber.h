@@ -0,0 +1,27 @@
+#ifndef REPLAY_GRABBER_H
+#define REPLAY_GRABBER_H
+
+#include <chrono>
+#include "Grabber.h"
+#include "RecordedSession.h"
+
+// Plays a session recorded with Grabber::record in place of the cameras. With realTime the frames are paced
+// by their timestamps, otherwise they are delivered as fast as the pipeline consumes them. The session loops.
+class ReplayGrabber : public Grabber
+{
+private:
+	SessionReader* reader;
+	bool realTime;
+	int frameId;
+	double firstTimestamp;
+	std::chrono::steady_clock::time_point startTime;
+
+protected:
+	int grabFrames(bool* check);
+
+public:
+	ReplayGrabber(const char* fileName, bool realTime);
+	~ReplayGrabber();
+};
+
+#endif
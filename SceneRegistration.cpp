@@ -2,7 +2,7 @@
 #include "Timer.h"
 #include "Parameters.h"
 
-void SceneRegistration::setOrigin(int cameras, RealsenseGrabber* grabber, Transformation* world2color) {
+void SceneRegistration::setOrigin(int cameras, Grabber* grabber, Transformation* world2color) {
 	const cv::Size BOARD_SIZE = cv::Size(9, 6);
 	const int BOARD_NUM = BOARD_SIZE.width * BOARD_SIZE.height;
 	const float GRID_SIZE = 0.02513f;
@@ -84,7 +84,7 @@ void SceneRegistration::setOrigin(int cameras, RealsenseGrabber* grabber, Transf
 }
 
 
-void SceneRegistration::align(int cameras, RealsenseGrabber* grabber, Transformation* world2color, int targetId)
+void SceneRegistration::align(int cameras, Grabber* grabber, Transformation* world2color, int targetId)
 {
 	if (targetId <= 0 || targetId >= cameras) {
 		return;
@@ -245,7 +245,7 @@ void SceneRegistration::align(int cameras, RealsenseGrabber* grabber, Transforma
 	cv::destroyAllWindows();
 }
 
-void SceneRegistration::align(int cameras, RealsenseGrabber* grabber, Transformation* world2color)
+void SceneRegistration::align(int cameras, Grabber* grabber, Transformation* world2color)
 {
 	world2color[0].setIdentity();
 	for (int targetId = 1; targetId < cameras; targetId++) {
@@ -7,15 +7,15 @@
 #include <vector>
 #include <Windows.h>
 #include "TsdfVolume.cuh"
-#include "RealsenseGrabber.h"
+#include "Grabber.h"
 #include "Configuration.h"
 
 class SceneRegistration {
 private:
 public:
-	static void setOrigin(int cameras, RealsenseGrabber* grabber, Transformation* world2color);
-	static void align(int cameras, RealsenseGrabber* grabber, Transformation* world2color, int targetId);
-	static void align(int cameras, RealsenseGrabber* grabber, Transformation* world2color);
+	static void setOrigin(int cameras, Grabber* grabber, Transformation* world2color);
+	static void align(int cameras, Grabber* grabber, Transformation* world2color, int targetId);
+	static void align(int cameras, Grabber* grabber, Transformation* world2color);
 	static void adjust(int cameras, Transformation* world2color, char cmd);
 };
 
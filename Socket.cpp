@@ -0,0 +1,321 @@
+#include "Socket.h"
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <string.h>
+
+#ifdef _WIN32
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace SocketNamespace {
+	const intptr_t INVALID_HANDLE = -1;
+	const int SOCKET_BUFFER_SIZE = 8 * 1024 * 1024;
+	const int CONNECT_RETRIES = 100;
+
+#ifdef _WIN32
+	typedef WSABUF IoBuffer;
+	typedef WSAPOLLFD PollFd;
+
+	inline void setBuffer(IoBuffer& buffer, const char* data, int size) {
+		buffer.buf = (char*)data;
+		buffer.len = size;
+	}
+
+	inline int bufferSize(IoBuffer& buffer) {
+		return buffer.len;
+	}
+
+	inline void advanceBuffer(IoBuffer& buffer, int size) {
+		buffer.buf += size;
+		buffer.len -= size;
+	}
+
+	inline int sendBuffers(intptr_t sock, IoBuffer* buffers, int count) {
+		DWORD sent = 0;
+		return WSASend((SOCKET)sock, buffers, count, &sent, 0, NULL, NULL) == 0 ? (int)sent : -1;
+	}
+
+	inline int pollOne(PollFd* fd, int timeout) {
+		return WSAPoll(fd, 1, timeout);
+	}
+
+	inline bool retryLater() {
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+	}
+
+	inline bool interrupted() {
+		return WSAGetLastError() == WSAEINTR;
+	}
+
+	inline void closeHandle(intptr_t sock) {
+		closesocket((SOCKET)sock);
+	}
+
+	inline void setNonBlocking(intptr_t sock) {
+		u_long mode = 1;
+		ioctlsocket((SOCKET)sock, FIONBIO, &mode);
+	}
+#else
+	typedef struct iovec IoBuffer;
+	typedef struct pollfd PollFd;
+
+	inline void setBuffer(IoBuffer& buffer, const char* data, int size) {
+		buffer.iov_base = (void*)data;
+		buffer.iov_len = size;
+	}
+
+	inline int bufferSize(IoBuffer& buffer) {
+		return (int)buffer.iov_len;
+	}
+
+	inline void advanceBuffer(IoBuffer& buffer, int size) {
+		buffer.iov_base = (char*)buffer.iov_base + size;
+		buffer.iov_len -= size;
+	}
+
+	inline int sendBuffers(intptr_t sock, IoBuffer* buffers, int count) {
+		// sendmsg is writev with flags, MSG_NOSIGNAL keeps a closed peer from raising SIGPIPE
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = buffers;
+		msg.msg_iovlen = count;
+		return (int)sendmsg((int)sock, &msg, MSG_NOSIGNAL);
+	}
+
+	inline int pollOne(PollFd* fd, int timeout) {
+		return poll(fd, 1, timeout);
+	}
+
+	inline bool retryLater() {
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	}
+
+	inline bool interrupted() {
+		return errno == EINTR;
+	}
+
+	inline void closeHandle(intptr_t sock) {
+		::close((int)sock);
+	}
+
+	inline void setNonBlocking(intptr_t sock) {
+		fcntl((int)sock, F_SETFL, fcntl((int)sock, F_GETFL, 0) | O_NONBLOCK);
+	}
+#endif
+
+	inline sockaddr_in makeAddress(const char* ip, int port) {
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = inet_addr(ip);
+		addr.sin_port = htons(port);
+		return addr;
+	}
+}
+using namespace SocketNamespace;
+
+Socket::Socket()
+{
+	sock = INVALID_HANDLE;
+	connected = false;
+}
+
+Socket::~Socket()
+{
+	close();
+	if (sock != INVALID_HANDLE) {
+		closeHandle(sock);
+	}
+}
+
+bool Socket::setup()
+{
+#ifdef _WIN32
+	static bool started = false;
+	if (!started) {
+		WSADATA wsaData;
+		started = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+	}
+	return started;
+#else
+	return true;
+#endif
+}
+
+void Socket::configure()
+{
+	int on = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(int));
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*)&SOCKET_BUFFER_SIZE, sizeof(int));
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&SOCKET_BUFFER_SIZE, sizeof(int));
+#ifdef SO_NOSIGPIPE
+	setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&on, sizeof(int));
+#endif
+	setNonBlocking(sock);
+	connected = true;
+}
+
+bool Socket::listen(const char* ip, int port)
+{
+	if (!setup()) {
+		return false;
+	}
+	sockaddr_in addr = makeAddress(ip, port);
+	intptr_t server = socket(AF_INET, SOCK_STREAM, 0);
+	if (server == INVALID_HANDLE) {
+		return false;
+	}
+	int on = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(int));
+	if (bind(server, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(server, 1) != 0) {
+		std::cout << "cannot listen on " << ip << ":" << port << std::endl;
+		closeHandle(server);
+		return false;
+	}
+	sock = accept(server, NULL, NULL);
+	closeHandle(server);
+	if (sock == INVALID_HANDLE) {
+		return false;
+	}
+	configure();
+	return true;
+}
+
+bool Socket::connect(const char* ip, int port)
+{
+	if (!setup()) {
+		return false;
+	}
+	// The peer may still be starting, so the connection is retried for a while
+	sockaddr_in addr = makeAddress(ip, port);
+	for (int i = 0; i < CONNECT_RETRIES; i++) {
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock == INVALID_HANDLE) {
+			return false;
+		}
+		if (::connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0) {
+			configure();
+			return true;
+		}
+		closeHandle(sock);
+		sock = INVALID_HANDLE;
+		std::this_thread::sleep_for(std::chrono::milliseconds(POLL_TIMEOUT));
+	}
+	std::cout << "cannot connect to " << ip << ":" << port << std::endl;
+	return false;
+}
+
+void Socket::close()
+{
+	// The handle is only released by the destructor, so that a thread still polling it never sees a reused one
+	if (connected.exchange(false)) {
+#ifdef _WIN32
+		shutdown((SOCKET)sock, SD_BOTH);
+#else
+		shutdown((int)sock, SHUT_RDWR);
+#endif
+	}
+}
+
+bool Socket::wait(bool write)
+{
+	PollFd fd;
+	fd.fd = sock;
+	fd.events = write ? POLLOUT : POLLIN;
+	while (connected) {
+		fd.revents = 0;
+		int ret = pollOne(&fd, POLL_TIMEOUT);
+		if (ret > 0) {
+			// Errors and hang ups are reported by the following send or recv
+			return true;
+		}
+		if (ret < 0 && !interrupted()) {
+			close();
+			return false;
+		}
+	}
+	return false;
+}
+
+bool Socket::send(const Buffer* buffers, int count)
+{
+	IoBuffer io[MAX_BUFFERS];
+	count = count < MAX_BUFFERS ? count : MAX_BUFFERS;
+	for (int i = 0; i < count; i++) {
+		setBuffer(io[i], buffers[i].data, buffers[i].size);
+	}
+
+	int first = 0;
+	while (first < count && bufferSize(io[first]) == 0) {
+		first++;
+	}
+	while (first < count) {
+		if (!connected) {
+			return false;
+		}
+		int ret = sendBuffers(sock, io + first, count - first);
+		if (ret > 0) {
+			while (first < count && ret >= bufferSize(io[first])) {
+				ret -= bufferSize(io[first]);
+				first++;
+			}
+			if (first < count) {
+				advanceBuffer(io[first], ret);
+			}
+		} else if (ret < 0 && retryLater()) {
+			if (!wait(true)) {
+				return false;
+			}
+		} else {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Socket::send(const char* data, int size)
+{
+	Buffer buffer = { data, size };
+	return send(&buffer, 1);
+}
+
+bool Socket::recv(char* data, int size)
+{
+	int offset = 0;
+	while (offset < size) {
+		if (!connected) {
+			return false;
+		}
+		int ret = (int)::recv(sock, data + offset, size - offset, 0);
+		if (ret > 0) {
+			offset += ret;
+		} else if (ret < 0 && retryLater()) {
+			if (!wait(false)) {
+				return false;
+			}
+		} else {
+			// 0 means the peer closed the connection
+			close();
+			return false;
+		}
+	}
+	return true;
+}
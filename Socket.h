@@ -0,0 +1,42 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <stdint.h>
+#include <atomic>
+
+// TCP stream on Winsock or POSIX sockets. The socket is non-blocking: send and recv wait with poll until the
+// whole request went through, so one thread can send while another one receives, and close from any thread
+// makes both of them return within POLL_TIMEOUT. The platform headers stay in Socket.cpp because winsock2.h
+// has to come before Windows.h.
+class Socket {
+public:
+	struct Buffer {
+		const char* data;
+		int size;
+	};
+
+private:
+	static const int POLL_TIMEOUT = 100;
+	static const int MAX_BUFFERS = 16;
+	intptr_t sock;
+	std::atomic<bool> connected;
+
+	static bool setup();
+	void configure();
+	bool wait(bool write);
+
+public:
+	Socket();
+	~Socket();
+	// Both block until a peer is connected, false on failure
+	bool listen(const char* ip, int port);
+	bool connect(const char* ip, int port);
+	void close();
+	bool isConnected() { return connected; }
+	// Gathers up to MAX_BUFFERS buffers into as few system calls as the socket buffer allows
+	bool send(const Buffer* buffers, int count);
+	bool send(const char* data, int size);
+	bool recv(char* data, int size);
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "SparseFrame.h"
+#include "Backend.h"
+#include <math.h>
+
+extern "C" void cudaSparseFrameInit(float*& depthTiles_device, RGBQUAD*& colorTiles_device, INT16*& tileSlots_device);
+extern "C" void cudaSparseFrameClean(float*& depthTiles_device, RGBQUAD*& colorTiles_device, INT16*& tileSlots_device);
+extern "C" void cudaScatterTiles(INT16* tileSlots_device, float* depthTiles_device, RGBQUAD* colorTiles_device, float* depth_device, RGBQUAD* color_device);
+extern "C" void cpuScatterTiles(INT16* tileSlots, float* depthTiles, RGBQUAD* colorTiles, float* depth, RGBQUAD* color);
+
+SparseFrame::SparseFrame()
+{
+	depthTiles_device = NULL;
+	colorTiles_device = NULL;
+	tileSlots_device = NULL;
+	// One slot map per camera, the uploads of a camera may still be pending while the next one is prepared
+	tileSlots = (INT16*)Backend::allocHost(MAX_CAMERAS * ROI_TILES * sizeof(INT16));
+	if (!Backend::isCpu()) {
+		cudaSparseFrameInit(depthTiles_device, colorTiles_device, tileSlots_device);
+	}
+}
+
+SparseFrame::~SparseFrame()
+{
+	if (!Backend::isCpu()) {
+		cudaSparseFrameClean(depthTiles_device, colorTiles_device, tileSlots_device);
+	}
+	Backend::freeHost(tileSlots);
+}
+
+int SparseFrame::selectTiles(float* depth, Transformation world2depth, Intrinsics depthIntrinsics, float3 volumeMin, float3 volumeMax, UINT16* tiles)
+{
+	// The rectangle the volume projects to, the whole image when a corner is behind the camera
+	float minX = 0, minY = 0, maxX = DEPTH_W - 1, maxY = DEPTH_H - 1;
+	bool behind = false;
+	float3 corners[8];
+	for (int i = 0; i < 8; i++) {
+		corners[i] = make_float3((i & 1) ? volumeMax.x : volumeMin.x, (i & 2) ? volumeMax.y : volumeMin.y, (i & 4) ? volumeMax.z : volumeMin.z);
+		behind |= world2depth.translate(corners[i]).z < 0.01f;
+	}
+	if (!behind) {
+		minX = minY = 1e10f;
+		maxX = maxY = -1e10f;
+		for (int i = 0; i < 8; i++) {
+			float3 pos = world2depth.translate(corners[i]);
+			float x = pos.x * depthIntrinsics.fx / pos.z + depthIntrinsics.ppx;
+			float y = pos.y * depthIntrinsics.fy / pos.z + depthIntrinsics.ppy;
+			minX = min(minX, x);
+			minY = min(minY, y);
+			maxX = max(maxX, x);
+			maxY = max(maxY, y);
+		}
+		minX = max(minX, 0.0f);
+		minY = max(minY, 0.0f);
+		maxX = min(maxX, DEPTH_W - 1.0f);
+		maxY = min(maxY, DEPTH_H - 1.0f);
+		if (minX > maxX || minY > maxY) {
+			return 0;
+		}
+	}
+
+	// One tile of margin for the truncation band around the surface
+	int tx0 = max(0, (int)minX / ROI_TILE - 1);
+	int ty0 = max(0, (int)minY / ROI_TILE - 1);
+	int tx1 = min(ROI_TILES_X - 1, (int)maxX / ROI_TILE + 1);
+	int ty1 = min(ROI_TILES_Y - 1, (int)maxY / ROI_TILE + 1);
+	int count = 0;
+	for (int ty = ty0; ty <= ty1; ty++) {
+		for (int tx = tx0; tx <= tx1; tx++) {
+			bool valid = false;
+			for (int y = 0; y < ROI_TILE && !valid; y++) {
+				float* row = depth + (ty * ROI_TILE + y) * DEPTH_W + tx * ROI_TILE;
+				for (int x = 0; x < ROI_TILE; x++) {
+					if (row[x] > 0) {
+						valid = true;
+						break;
+					}
+				}
+			}
+			if (valid) {
+				tiles[count++] = ty * ROI_TILES_X + tx;
+			}
+		}
+	}
+	return count;
+}
+
+void SparseFrame::gatherTiles(int tileCount, UINT16* tiles, float* depth, RGBQUAD* color, float* depthTiles, RGBQUAD* colorTiles)
+{
+	#pragma omp parallel for
+	for (int k = 0; k < tileCount; k++) {
+		int tx = tiles[k] % ROI_TILES_X;
+		int ty = tiles[k] / ROI_TILES_X;
+		for (int y = 0; y < ROI_TILE; y++) {
+			memcpy(depthTiles + (k * ROI_TILE + y) * ROI_TILE, depth + (ty * ROI_TILE + y) * DEPTH_W + tx * ROI_TILE, ROI_TILE * sizeof(float));
+		}
+		for (int y = 0; y < ROI_COLOR_TILE_H; y++) {
+			memcpy(colorTiles + (k * ROI_COLOR_TILE_H + y) * ROI_COLOR_TILE_W, color + (ty * ROI_COLOR_TILE_H + y) * COLOR_W + tx * ROI_COLOR_TILE_W, ROI_COLOR_TILE_W * sizeof(RGBQUAD));
+		}
+	}
+}
+
+void SparseFrame::scatterTiles(int cameraId, int tileCount, UINT16* tiles, float* depthTiles, RGBQUAD* colorTiles, float* depth_device, RGBQUAD* color_device)
+{
+	INT16* slots = tileSlots + cameraId * ROI_TILES;
+	for (int i = 0; i < ROI_TILES; i++) {
+		slots[i] = -1;
+	}
+	for (int k = 0; k < tileCount; k++) {
+		slots[tiles[k]] = k;
+	}
+
+	if (Backend::isCpu()) {
+		cpuScatterTiles(slots, depthTiles, colorTiles, depth_device, color_device);
+	} else {
+		// The tile buffers on the device are shared by the cameras, the stream keeps the uploads behind the previous scatter
+		Backend::copyAsync(tileSlots_device, slots, ROI_TILES * sizeof(INT16), cudaMemcpyHostToDevice);
+		Backend::copyAsync(depthTiles_device, depthTiles, tileCount * ROI_TILE * ROI_TILE * sizeof(float), cudaMemcpyHostToDevice);
+		Backend::copyAsync(colorTiles_device, colorTiles, tileCount * ROI_COLOR_TILE_W * ROI_COLOR_TILE_H * sizeof(RGBQUAD), cudaMemcpyHostToDevice);
+		cudaScatterTiles(tileSlots_device, depthTiles_device, colorTiles_device, depth_device, color_device);
+	}
+}
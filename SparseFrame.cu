@@ -0,0 +1,49 @@
+#include "CudaHandleError.h"
+#include "Parameters.h"
+#include "SparseFrame.h"
+
+__global__ void kernelScatterDepthTiles(INT16* tileSlots, float* depthTiles, float* depth) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x < DEPTH_W && y < DEPTH_H) {
+		int slot = tileSlots[(y / ROI_TILE) * ROI_TILES_X + x / ROI_TILE];
+		depth[y * DEPTH_W + x] = (slot < 0) ? 0 : depthTiles[(slot * ROI_TILE + y % ROI_TILE) * ROI_TILE + x % ROI_TILE];
+	}
+}
+
+__global__ void kernelScatterColorTiles(INT16* tileSlots, uchar4* colorTiles, uchar4* color) {
+	int x = blockIdx.x * blockDim.x + threadIdx.x;
+	int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+	if (x < COLOR_W && y < COLOR_H) {
+		int slot = tileSlots[(y / ROI_COLOR_TILE_H) * ROI_TILES_X + x / ROI_COLOR_TILE_W];
+		color[y * COLOR_W + x] = (slot < 0) ? make_uchar4(0, 0, 0, 0) : colorTiles[(slot * ROI_COLOR_TILE_H + y % ROI_COLOR_TILE_H) * ROI_COLOR_TILE_W + x % ROI_COLOR_TILE_W];
+	}
+}
+
+extern "C"
+void cudaSparseFrameInit(float*& depthTiles_device, RGBQUAD*& colorTiles_device, INT16*& tileSlots_device) {
+	HANDLE_ERROR(cudaMalloc(&depthTiles_device, DEPTH_H * DEPTH_W * sizeof(float)));
+	HANDLE_ERROR(cudaMalloc(&colorTiles_device, COLOR_H * COLOR_W * sizeof(RGBQUAD)));
+	HANDLE_ERROR(cudaMalloc(&tileSlots_device, ROI_TILES * sizeof(INT16)));
+}
+
+extern "C"
+void cudaSparseFrameClean(float*& depthTiles_device, RGBQUAD*& colorTiles_device, INT16*& tileSlots_device) {
+	HANDLE_ERROR(cudaFree(depthTiles_device));
+	HANDLE_ERROR(cudaFree(colorTiles_device));
+	HANDLE_ERROR(cudaFree(tileSlots_device));
+}
+
+extern "C"
+void cudaScatterTiles(INT16* tileSlots_device, float* depthTiles_device, RGBQUAD* colorTiles_device, float* depth_device, RGBQUAD* color_device)
+{
+	dim3 threadsPerBlock = dim3(BLOCK_SIZE, BLOCK_SIZE);
+	dim3 depthBlocks = dim3((DEPTH_W + BLOCK_SIZE - 1) / BLOCK_SIZE, (DEPTH_H + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	dim3 colorBlocks = dim3((COLOR_W + BLOCK_SIZE - 1) / BLOCK_SIZE, (COLOR_H + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+	kernelScatterDepthTiles << <depthBlocks, threadsPerBlock >> > (tileSlots_device, depthTiles_device, depth_device);
+	kernelScatterColorTiles << <colorBlocks, threadsPerBlock >> > (tileSlots_device, (uchar4*)colorTiles_device, (uchar4*)color_device);
+	cudaGetLastError();
+}
@@ -0,0 +1,35 @@
+#ifndef SPARSE_FRAME_H
+#define SPARSE_FRAME_H
+
+#include <Windows.h>
+#include "Parameters.h"
+#include "TsdfVolume.cuh"
+
+// Frames cut into tiles of ROI_TILE x ROI_TILE depth pixels and the matching tiles of the aligned color map.
+// Only the tiles that the volume projects onto and that hold valid depth are sent. They are stored one below
+// the other, so that the tiles of a frame form a tile wide image for DepthCodec and ColorCodec.
+// DEPTH_W, DEPTH_H, COLOR_W and COLOR_H must be multiples of the tile grid.
+#define ROI_TILES_X (DEPTH_W / ROI_TILE)
+#define ROI_TILES_Y (DEPTH_H / ROI_TILE)
+#define ROI_TILES (ROI_TILES_X * ROI_TILES_Y)
+#define ROI_COLOR_TILE_W (COLOR_W / ROI_TILES_X)
+#define ROI_COLOR_TILE_H (COLOR_H / ROI_TILES_Y)
+
+class SparseFrame
+{
+	float* depthTiles_device;
+	RGBQUAD* colorTiles_device;
+	INT16* tileSlots_device;
+	// Position of every tile in the tile images, -1 for the tiles that were not sent
+	INT16* tileSlots;
+public:
+	SparseFrame();
+	~SparseFrame();
+	// Lists the tiles of a frame to send and returns their count
+	static int selectTiles(float* depth, Transformation world2depth, Intrinsics depthIntrinsics, float3 volumeMin, float3 volumeMax, UINT16* tiles);
+	static void gatherTiles(int tileCount, UINT16* tiles, float* depth, RGBQUAD* color, float* depthTiles, RGBQUAD* colorTiles);
+	// Rebuilds the full frames on the device from tile images in host memory, missing tiles are zero
+	void scatterTiles(int cameraId, int tileCount, UINT16* tiles, float* depthTiles, RGBQUAD* colorTiles, float* depth_device, RGBQUAD* color_device);
+};
+
+#endif
@@ -0,0 +1,27 @@
+#include <Windows.h>
+#include "Parameters.h"
+#include "SparseFrame.h"
+
+// CPU reference of SparseFrame.cu
+extern "C"
+void cpuScatterTiles(INT16* tileSlots, float* depthTiles, RGBQUAD* colorTiles, float* depth, RGBQUAD* color) {
+	#pragma omp parallel for
+	for (int y = 0; y < DEPTH_H; y++) {
+		for (int x = 0; x < DEPTH_W; x++) {
+			int slot = tileSlots[(y / ROI_TILE) * ROI_TILES_X + x / ROI_TILE];
+			depth[y * DEPTH_W + x] = (slot < 0) ? 0 : depthTiles[(slot * ROI_TILE + y % ROI_TILE) * ROI_TILE + x % ROI_TILE];
+		}
+	}
+
+	#pragma omp parallel for
+	for (int y = 0; y < COLOR_H; y++) {
+		for (int x = 0; x < COLOR_W; x++) {
+			int slot = tileSlots[(y / ROI_COLOR_TILE_H) * ROI_TILES_X + x / ROI_COLOR_TILE_W];
+			if (slot < 0) {
+				memset(color + y * COLOR_W + x, 0, sizeof(RGBQUAD));
+			} else {
+				color[y * COLOR_W + x] = colorTiles[(slot * ROI_COLOR_TILE_H + y % ROI_COLOR_TILE_H) * ROI_COLOR_TILE_W + x % ROI_COLOR_TILE_W];
+			}
+		}
+	}
+}
@@ -1,188 +1,385 @@
 #include "Transmission.h"
 #include "Parameters.h"
 #include "Timer.h"
+#include "Backend.h"
 #include <iostream>
+#include <stdlib.h>
+#include <chrono>
 
-/*bool Transmission::isServer()
-{
-	char hostname[260];
-	int ret = gethostname(hostname, sizeof(hostname));
-	if (ret == -1) {
-		return false;
-	}
-	struct hostent *host = gethostbyname(hostname);
-	if (NULL == host) {
-		return false;
+namespace TransmissionNamespace {
+	inline double now() {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
 	}
-	in_addr* addr_list = (in_addr*)*host->h_addr_list;
-	char* hostIP = inet_ntoa(addr_list[0]);
-	return strcmp(hostIP, IP) == 0;
-}*/
+}
+using namespace TransmissionNamespace;
 
-void Transmission::start(bool isServer)
+int Transmission::maxFrameSize(int cameras)
 {
-	WSAStartup(MAKEWORD(2, 2), &wsaData);
+	// The raw formats are the largest ones both for depth and color
+	int camera = 3 * sizeof(int) + ROI_TILES * sizeof(UINT16) + DEPTH_W * DEPTH_H * sizeof(float) + COLOR_W * COLOR_H * sizeof(RGBQUAD) + sizeof(Transformation) + 2 * sizeof(Intrinsics);
+	return sizeof(StreamFormat) + sizeof(int) + cameras * sizeof(bool) + cameras * camera;
+}
 
-	memset(&sockAddr, 0, sizeof(sockAddr));
-	sockAddr.sin_family = PF_INET;
-	sockAddr.sin_addr.s_addr = inet_addr(IP);
-	sockAddr.sin_port = htons(port);
+void Transmission::reserveStaging(int cameras)
+{
+	while ((int)depthHost.size() < cameras) {
+		depthHost.push_back((float*)Backend::allocHost(DEPTH_H * DEPTH_W * sizeof(float)));
+		colorHost.push_back((RGBQUAD*)Backend::allocHost(COLOR_H * COLOR_W * sizeof(RGBQUAD)));
+	}
+}
 
-	if (isServer) {
-		std::cout << "server" << std::endl;
-		SOCKET sockSrv = socket(PF_INET, SOCK_STREAM, 0);
-		bind(sockSrv, (SOCKADDR*)&sockAddr, sizeof(SOCKADDR));
-		listen(sockSrv, 20);
-		int len = sizeof(SOCKADDR);
-		sock = accept(sockSrv, (SOCKADDR*)&sockAddr, &len);
-		closesocket(sockSrv);
+Transmission::Transmission(const std::vector<PeerAddress>& addresses, int delayFrames, StreamFormat format)
+{
+	// A site may listen for one peer while another one connects to it, so the links are set up in parallel
+	peers.resize(addresses.size(), NULL);
+	std::vector<std::thread> connecting;
+	for (int i = 0; i < (int)addresses.size(); i++) {
+		connecting.push_back(std::thread([this, &addresses, delayFrames, format, i] {
+			peers[i] = new PeerLink(addresses[i], delayFrames, format);
+		}));
 	}
-	else {
-		std::cout << "client" << std::endl;
-		sock = socket(AF_INET, SOCK_STREAM, 0);
-		connect(sock, (SOCKADDR*)&sockAddr, sizeof(sockAddr));
+	for (int i = 0; i < (int)connecting.size(); i++) {
+		connecting[i].join();
 	}
 
-	isConnected = true;
+	this->format = format;
+	for (int i = 0; i < (int)peers.size(); i++) {
+		if (peers[i]->isConnected) {
+			StreamFormat peerFormat = peers[i]->getFormat();
+			this->format.depthCodec = min(this->format.depthCodec, peerFormat.depthCodec);
+			this->format.depthError = min(this->format.depthError, peerFormat.depthError);
+			this->format.colorCodec = min(this->format.colorCodec, peerFormat.colorCodec);
+			this->format.mesh = min(this->format.mesh, peerFormat.mesh);
+			this->format.meshDelta = min(this->format.meshDelta, peerFormat.meshDelta);
+			this->format.roi = min(this->format.roi, peerFormat.roi);
+		}
+	}
+	// A peer decodes meshes or RGB-D frames as negotiated with this site alone
+	for (int i = 0; i < (int)peers.size(); i++) {
+		if (peers[i]->isConnected && peers[i]->getFormat().mesh != this->format.mesh) {
+			peers[i]->close("mesh mode differs from the other sites");
+		}
+	}
+	rateController.reset(this->format);
 
-	/*int nSendBuf = 128 * 1024 * 1024;
-	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char*)&nSendBuf, sizeof(int));
-	int nRecvBuf = 128 * 1024 * 1024;
-	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&nRecvBuf, sizeof(int));*/
+	lastCameras.resize(peers.size(), 0);
+	lastDepthImages.resize(peers.size(), NULL);
+	lastSendFrame = 0;
+	sendOffset = 0;
+	// Until setRegionOfInterest every tile with valid depth is sent
+	regionMin = make_float3(-1e10f, -1e10f, -1e10f);
+	regionMax = make_float3(1e10f, 1e10f, 1e10f);
+	sendTiles = NULL;
+	depthTilesHost = NULL;
+	colorTilesHost = NULL;
+	// Allocated on first use, sized by the frames that are actually sent
+	sendBuffer = { NULL, 0, false };
+	sendingBuffer = { NULL, 0, false };
 }
 
-void Transmission::sendData(char* data, int tot)
+Transmission::~Transmission()
 {
-	int offset = 0;
-	while (isConnected && offset != tot) {
-		int len = min(BUFF_SIZE, tot - offset);
-		int ret = send(sock, data + offset, len, 0);
-		if (ret > 0) {
-			offset += ret;
-		}
-		else if (ret == -1) {
-			isConnected = false;
-		}
+	for (int i = 0; i < (int)peers.size(); i++) {
+		delete peers[i];
 	}
+	PeerLink::freeBuffer(sendBuffer);
+	PeerLink::freeBuffer(sendingBuffer);
+	for (int i = 0; i < (int)depthHost.size(); i++) {
+		Backend::freeHost(depthHost[i]);
+		Backend::freeHost(colorHost[i]);
+	}
+	delete[] sendTiles;
+	delete[] depthTilesHost;
+	delete[] colorTilesHost;
 }
 
-void Transmission::recvData(char* data, int tot)
+bool Transmission::isConnected()
 {
-	int offset = 0;
-	while (isConnected && offset != tot) {
-		int len = min(BUFF_SIZE, tot - offset);
-		int ret = recv(sock, data + offset, len, 0);
-		if (ret > 0) {
-			offset += ret;
-		}
-		else if (ret == -1) {
-			isConnected = false;
+	for (int i = 0; i < (int)peers.size(); i++) {
+		if (peers[i]->isConnected) {
+			return true;
 		}
 	}
+	return false;
 }
 
-Transmission::Transmission(bool isServer, int delayFrames)
+void Transmission::setDelayFrames(int delayFrames)
 {
-	start(isServer);
-	
-	this->delayFrames = delayFrames;
-	localFrames = 0;
-	remoteFrames = 0;
-
-	buffer = new char*[MAX_DELAY_FRAME];
-	for (int i = 0; i < MAX_DELAY_FRAME; i++) {
-		buffer[i] = new char[FRAME_BUFFER_SIZE];
-		memset(buffer[i], 0, FRAME_BUFFER_SIZE);
+	for (int i = 0; i < (int)peers.size(); i++) {
+		peers[i]->setDelayFrames(delayFrames);
 	}
-	sendBuffer = new char[FRAME_BUFFER_SIZE];
-	memset(sendBuffer, 0, FRAME_BUFFER_SIZE);
-}	
+}
 
-Transmission::~Transmission()
+void Transmission::setAdaptiveDelay(bool adaptive)
 {
-	closesocket(sock);
-	WSACleanup();
-
-	if (buffer != NULL) {
-		for (int i = 0; i < MAX_DELAY_FRAME; i++) {
-			if (buffer[i] != NULL) {
-				delete[] buffer[i];
-			}
-		}
-		delete[] buffer;
-	}
-	if (sendBuffer != NULL) {
-		delete[] sendBuffer;
+	for (int i = 0; i < (int)peers.size(); i++) {
+		peers[i]->setAdaptiveDelay(adaptive);
 	}
 }
 
-void Transmission::recvFrame()
+void Transmission::getStats(int peer, TransmissionStats& stats)
+{
+	peers[peer]->getStats(stats);
+	stats.linkLoad = rateController.getLoad();
+	stats.qualityLevel = rateController.getLevel();
+}
+
+void Transmission::setRegionOfInterest(float3 volumeMin, float3 volumeMax)
 {
-	int len = 0;
-	recvData((char*)(&len), sizeof(int));
-	recvData(buffer[remoteFrames % MAX_DELAY_FRAME], len);
-	remoteFrames++;
+	regionMin = volumeMin;
+	regionMax = volumeMax;
 }
 
 void Transmission::prepareSendFrame(int cameras, bool* check, float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics)
 {
+	if (isMeshMode()) {
+		return;
+	}
+	PeerLink::reserveBuffer(sendBuffer, maxFrameSize(cameras));
+	reserveStaging(1);
+	if (format.roi && sendTiles == NULL) {
+		sendTiles = new UINT16[ROI_TILES];
+		depthTilesHost = new float[DEPTH_H * DEPTH_W];
+		colorTilesHost = new RGBQUAD[COLOR_H * COLOR_W];
+	}
+	StreamFormat frameFormat = format;
+	rateController.apply(frameFormat);
+	char* data = sendBuffer.data;
 	sendOffset = 0;
-	memcpy(sendBuffer + sendOffset, &cameras, sizeof(int));
+	memcpy(data + sendOffset, &frameFormat, sizeof(StreamFormat));
+	sendOffset += sizeof(StreamFormat);
+	memcpy(data + sendOffset, &cameras, sizeof(int));
 	sendOffset += sizeof(int);
-	memcpy(sendBuffer + sendOffset, check, cameras * sizeof(bool));
+	memcpy(data + sendOffset, check, cameras * sizeof(bool));
 	sendOffset += cameras * sizeof(bool);
 	for (int i = 0; i < cameras; i++) {
 		if (check[i]) {
-			cudaMemcpy(sendBuffer + sendOffset, depthImages_device + i * DEPTH_H * DEPTH_W, DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyDeviceToHost);
-			sendOffset += DEPTH_H * DEPTH_W * sizeof(float);
-			cudaMemcpy(sendBuffer + sendOffset, colorImages_device + i * COLOR_H * COLOR_W, COLOR_H * COLOR_W * sizeof(RGBQUAD), cudaMemcpyDeviceToHost);
-			sendOffset += COLOR_H * COLOR_W * sizeof(RGBQUAD);
-			memcpy(sendBuffer + sendOffset, world2depth + i, sizeof(Transformation));
+			Backend::copy(depthHost[0], depthImages_device + i * DEPTH_H * DEPTH_W, DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyDeviceToHost);
+			Backend::copy(colorHost[0], colorImages_device + i * COLOR_H * COLOR_W, COLOR_H * COLOR_W * sizeof(RGBQUAD), cudaMemcpyDeviceToHost);
+			float* depth = depthHost[0];
+			RGBQUAD* color = colorHost[0];
+			int depthW = DEPTH_W, depthH = DEPTH_H, colorW = COLOR_W, colorH = COLOR_H;
+			if (format.roi) {
+				int tileCount = SparseFrame::selectTiles(depthHost[0], world2depth[i], depthIntrinsics[i], regionMin, regionMax, sendTiles);
+				SparseFrame::gatherTiles(tileCount, sendTiles, depthHost[0], colorHost[0], depthTilesHost, colorTilesHost);
+				memcpy(data + sendOffset, &tileCount, sizeof(int));
+				sendOffset += sizeof(int);
+				memcpy(data + sendOffset, sendTiles, tileCount * sizeof(UINT16));
+				sendOffset += tileCount * sizeof(UINT16);
+				depth = depthTilesHost;
+				color = colorTilesHost;
+				depthW = ROI_TILE;
+				depthH = ROI_TILE * tileCount;
+				colorW = ROI_COLOR_TILE_W;
+				colorH = ROI_COLOR_TILE_H * tileCount;
+			}
+			int depthSize = DepthCodec::encode(frameFormat.depthCodec, frameFormat.depthError, depthW, depthH, depth, (BYTE*)data + sendOffset + sizeof(int));
+			memcpy(data + sendOffset, &depthSize, sizeof(int));
+			sendOffset += sizeof(int) + depthSize;
+			int colorSize = ColorCodec::encode(frameFormat.colorCodec, colorW, colorH, color, (BYTE*)data + sendOffset + sizeof(int));
+			memcpy(data + sendOffset, &colorSize, sizeof(int));
+			sendOffset += sizeof(int) + colorSize;
+			memcpy(data + sendOffset, world2depth + i, sizeof(Transformation));
 			sendOffset += sizeof(Transformation);
-			memcpy(sendBuffer + sendOffset, depthIntrinsics + i, sizeof(Intrinsics));
+			memcpy(data + sendOffset, depthIntrinsics + i, sizeof(Intrinsics));
 			sendOffset += sizeof(Intrinsics);
-			memcpy(sendBuffer + sendOffset, colorIntrinsics + i, sizeof(Intrinsics));
+			memcpy(data + sendOffset, colorIntrinsics + i, sizeof(Intrinsics));
 			sendOffset += sizeof(Intrinsics);
 		}
 	}
 }
 
 void Transmission::sendFrame() {
-	sendData((char*)(&sendOffset), sizeof(int));
-	sendData(sendBuffer, sendOffset);
+	// Waits for the previous frame to leave on every link, then hands the prepared one to all send threads
+	double time = now();
+	bool blocked = false;
+	for (int i = 0; i < (int)peers.size(); i++) {
+		blocked = peers[i]->waitSent() || blocked;
+	}
+	std::swap(sendBuffer, sendingBuffer);
+	double wireTime = 0;
+	for (int i = 0; i < (int)peers.size(); i++) {
+		if (peers[i]->isConnected) {
+			peers[i]->post(sendingBuffer.data, sendOffset);
+			wireTime = max(wireTime, peers[i]->getLastSendWireTime());
+		}
+	}
+
+	// The quality of the next frame follows the load of the slowest link
+	if (lastSendFrame > 0) {
+		rateController.update(wireTime, time - lastSendFrame, blocked);
+	}
+	lastSendFrame = time;
 }
 
-int Transmission::getFrame(float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics)
+int Transmission::playFrame(int peer, int first, int maxCameras, float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics)
 {
-	if (localFrames - delayFrames < 0) {
-		localFrames++;
+	bool repeated;
+	int frameSize;
+	char* recvBuffer = peers[peer]->acquireFrame(repeated, frameSize);
+	if (recvBuffer == NULL) {
 		return 0;
 	}
+	float* firstDepth_device = depthImages_device + first * DEPTH_H * DEPTH_W;
+	if (repeated && firstDepth_device == lastDepthImages[peer]) {
+		return lastCameras[peer];
+	}
 	int cameras = 0;
 	bool check[MAX_CAMERAS];
-	char* recvBuffer = buffer[(localFrames - delayFrames) % MAX_DELAY_FRAME];
-	localFrames++;
+	UINT16 tiles[ROI_TILES];
 
+	// Everything read from the frame comes from the wire, a field that does not fit in the frame drops it
 	int offset = 0;
+	auto fits = [&](int bytes) { return bytes >= 0 && bytes <= frameSize - offset; };
+	auto reject = [&]() {
+		std::cout << "invalid frame from site " << peer << ", dropped" << std::endl;
+		lastCameras[peer] = 0;
+		lastDepthImages[peer] = NULL;
+		return 0;
+	};
+	StreamFormat frameFormat;
+	if (!fits(sizeof(StreamFormat) + sizeof(int))) {
+		return reject();
+	}
+	memcpy(&frameFormat, recvBuffer + offset, sizeof(StreamFormat));
+	offset += sizeof(StreamFormat);
+	// RateController moves the codecs anywhere up to DEPTH_LOSSY and COLOR_YUV420, the cropping and the mode stay
+	// as negotiated with the peer
+	StreamFormat linkFormat = peers[peer]->getFormat();
+	if (frameFormat.depthCodec < DepthCodec::DEPTH_RAW || frameFormat.depthCodec > DepthCodec::DEPTH_LOSSY
+		|| frameFormat.depthError < 0 || frameFormat.depthError > 65535
+		|| frameFormat.colorCodec < ColorCodec::COLOR_RAW || frameFormat.colorCodec > ColorCodec::COLOR_YUV420
+		|| (frameFormat.roi != 0 && linkFormat.roi == 0) || frameFormat.mesh != linkFormat.mesh) {
+		return reject();
+	}
 	memcpy(&cameras, recvBuffer + offset, sizeof(int));
 	offset += sizeof(int);
+	if (cameras < 0 || cameras > MAX_CAMERAS || !fits(cameras * sizeof(bool))) {
+		return reject();
+	}
 	memcpy(check, recvBuffer + offset, cameras * sizeof(bool));
 	offset += cameras * sizeof(bool);
+	// The cameras that do not fit behind the ones of the other sites are dropped
+	cameras = min(cameras, maxCameras);
+	reserveStaging(first + cameras);
 	for (int i = 0; i < cameras; i++) {
 		if (check[i]) {
-			cudaMemcpy(depthImages_device + i * DEPTH_H * DEPTH_W, recvBuffer + offset, DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyHostToDevice);
-			offset += DEPTH_H * DEPTH_W * sizeof(float);
-			cudaMemcpy(colorImages_device + i * COLOR_H * COLOR_W, recvBuffer + offset, COLOR_H * COLOR_W * sizeof(RGBQUAD), cudaMemcpyHostToDevice);
-			offset += COLOR_H * COLOR_W * sizeof(RGBQUAD);
-			memcpy(world2depth + i, recvBuffer + offset, sizeof(Transformation));
+			int camera = first + i;
+			float* depth_device = depthImages_device + camera * DEPTH_H * DEPTH_W;
+			RGBQUAD* color_device = colorImages_device + camera * COLOR_H * COLOR_W;
+			int tileCount = 0;
+			if (frameFormat.roi) {
+				if (!fits(sizeof(int))) {
+					return reject();
+				}
+				memcpy(&tileCount, recvBuffer + offset, sizeof(int));
+				offset += sizeof(int);
+				if (tileCount < 0 || tileCount > ROI_TILES || !fits(tileCount * sizeof(UINT16))) {
+					return reject();
+				}
+				memcpy(tiles, recvBuffer + offset, tileCount * sizeof(UINT16));
+				offset += tileCount * sizeof(UINT16);
+				for (int t = 0; t < tileCount; t++) {
+					if (tiles[t] >= ROI_TILES) {
+						return reject();
+					}
+				}
+			}
+			int depthSize = 0;
+			if (!fits(sizeof(int))) {
+				return reject();
+			}
+			memcpy(&depthSize, recvBuffer + offset, sizeof(int));
+			offset += sizeof(int);
+			if (!fits(depthSize)) {
+				return reject();
+			}
+			if (frameFormat.roi) {
+				if (DepthCodec::decode(frameFormat.depthCodec, frameFormat.depthError, ROI_TILE, ROI_TILE * tileCount, (BYTE*)recvBuffer + offset, depthSize, depthHost[camera]) < 0) {
+					return reject();
+				}
+			} else {
+				if (DepthCodec::decode(frameFormat.depthCodec, frameFormat.depthError, (BYTE*)recvBuffer + offset, depthSize, depthHost[camera]) < 0) {
+					return reject();
+				}
+				Backend::copyAsync(depth_device, depthHost[camera], DEPTH_H * DEPTH_W * sizeof(float), cudaMemcpyHostToDevice);
+			}
+			offset += depthSize;
+			int colorSize = 0;
+			if (!fits(sizeof(int))) {
+				return reject();
+			}
+			memcpy(&colorSize, recvBuffer + offset, sizeof(int));
+			offset += sizeof(int);
+			if (!fits(colorSize + sizeof(Transformation) + 2 * sizeof(Intrinsics))) {
+				return reject();
+			}
+			if (frameFormat.roi) {
+				// Only the tiles are uploaded, the rest of the frame is cleared on the device
+				if (ColorCodec::decode(frameFormat.colorCodec, ROI_COLOR_TILE_W, ROI_COLOR_TILE_H * tileCount, (BYTE*)recvBuffer + offset, colorSize, colorHost[camera]) < 0) {
+					return reject();
+				}
+				sparseFrame.scatterTiles(camera, tileCount, tiles, depthHost[camera], colorHost[camera], depth_device, color_device);
+			} else {
+				if (ColorCodec::decode(frameFormat.colorCodec, (BYTE*)recvBuffer + offset, colorSize, colorHost[camera]) < 0) {
+					return reject();
+				}
+				Backend::copyAsync(color_device, colorHost[camera], COLOR_H * COLOR_W * sizeof(RGBQUAD), cudaMemcpyHostToDevice);
+			}
+			offset += colorSize;
+			memcpy(world2depth + camera, recvBuffer + offset, sizeof(Transformation));
 			offset += sizeof(Transformation);
-			memcpy(depthIntrinsics + i, recvBuffer + offset, sizeof(Intrinsics));
+			memcpy(depthIntrinsics + camera, recvBuffer + offset, sizeof(Intrinsics));
 			offset += sizeof(Intrinsics);
-			memcpy(colorIntrinsics + i, recvBuffer + offset, sizeof(Intrinsics));
+			memcpy(colorIntrinsics + camera, recvBuffer + offset, sizeof(Intrinsics));
 			offset += sizeof(Intrinsics);
 		}
 	}
+	lastCameras[peer] = cameras;
+	lastDepthImages[peer] = firstDepth_device;
 
 	return cameras;
 }
 
+int Transmission::getFrame(int maxCameras, float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics)
+{
+	int cameras = 0;
+	// The frames of a site that left are not repeated
+	for (int i = 0; i < (int)peers.size(); i++) {
+		if (!peers[i]->isConnected) {
+			continue;
+		}
+		cameras += playFrame(i, cameras, maxCameras - cameras, depthImages_device, colorImages_device, world2depth, depthIntrinsics, colorIntrinsics);
+	}
+	Backend::synchronize();
+	return cameras;
+}
+
+void Transmission::prepareSendMesh(byte* mesh)
+{
+	PeerLink::reserveBuffer(sendBuffer, MeshCodec::maxEncodedSize(mesh));
+	sendOffset = meshEncoder.encode(mesh, format.meshDelta != 0, (BYTE*)sendBuffer.data);
+}
+
+bool Transmission::getMesh(byte* mesh)
+{
+	// The local mesh is rebuilt every frame, so a repeated remote mesh is merged again
+	bool merged = false;
+	for (int i = 0; i < (int)peers.size(); i++) {
+		if (!peers[i]->isConnected) {
+			continue;
+		}
+		bool repeated;
+		int frameSize;
+		char* recvBuffer = peers[i]->acquireFrame(repeated, frameSize);
+		if (recvBuffer == NULL) {
+			continue;
+		}
+		if (MeshCodec::merge((BYTE*)recvBuffer, mesh)) {
+			merged = true;
+		} else {
+			std::cout << "vertex size limit exceeded, remote mesh dropped" << std::endl;
+		}
+	}
+	return merged;
+}
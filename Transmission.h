@@ -1,40 +1,79 @@
 #ifndef TRANSMISSION_H
 #define TRANSMISSION_H
 
-#define _WINSOCK_DEPRECATED_NO_WARNINGS 
 #include <Windows.h>
+#include <vector>
+#include "Parameters.h"
 #include "TsdfVolume.cuh"
+#include "DepthCodec.h"
+#include "ColorCodec.h"
+#include "MeshCodec.h"
+#include "PeerLink.h"
+#include "SparseFrame.h"
+#include "RateController.h"
 
+// Session with any number of remote sites, one PeerLink each. A frame is encoded once and the same buffer is sent to
+// every peer. The frames of the peers are played into consecutive cameras behind the local ones.
+// An RGB-D frame starts with the StreamFormat it is coded with, RateController may lower it below the negotiated one.
+// With roi a camera starts with [int tileCount][UINT16 tiles[tileCount]] and its depth and color maps are the tile
+// images of SparseFrame.
 class Transmission {
-public:
-	const char* IP = "192.168.1.1";
-	const int port = 1288;
-
-	WSADATA wsaData;
-	sockaddr_in sockAddr;
-	SOCKET sock;
-
-	//bool isServer();
-	void start(bool isServer);
-	void sendData(char* data, int tot);
-	void recvData(char* data, int tot);
+private:
+	static int maxFrameSize(int cameras);
+	void reserveStaging(int cameras);
+	// Decodes the current frame of a peer into the cameras from first on and returns how many it wrote
+	int playFrame(int peer, int first, int maxCameras, float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
 
-	int delayFrames;
-	char** buffer;
+	std::vector<PeerLink*> peers;
+	// The stricter of the formats negotiated with each peer, every peer can decode it
+	StreamFormat format;
 	int sendOffset;
-	char* sendBuffer;
-	int localFrames;
-	int remoteFrames;
+	FrameBuffer sendBuffer;
+	// The frame the send threads are writing, sendBuffer is prepared meanwhile and swapped in by sendFrame
+	FrameBuffer sendingBuffer;
+	// Page-locked staging per camera, the upload of one camera overlaps the decoding of the next
+	std::vector<float*> depthHost;
+	std::vector<RGBQUAD*> colorHost;
+	SparseFrame sparseFrame;
+	float3 regionMin;
+	float3 regionMax;
+	UINT16* sendTiles;
+	float* depthTilesHost;
+	RGBQUAD* colorTilesHost;
+	// What the last getFrame uploaded per peer, a repeated frame is already on the device
+	std::vector<int> lastCameras;
+	std::vector<float*> lastDepthImages;
+	RateController rateController;
+	double lastSendFrame;
+	MeshCodec meshEncoder;
 
 public:
-	Transmission(bool isServer, int delayFrames);
+	// Connects to all peers at once, so that the sites may start in any order
+	Transmission(const std::vector<PeerAddress>& addresses, int delayFrames, StreamFormat format);
 	~Transmission();
-	bool isConnected;
-	void setDelayFrames(int delayFrames) { this->delayFrames = delayFrames; }
-	void recvFrame();
+	// True while at least one peer is connected
+	bool isConnected();
+	int getPeerCount() { return (int)peers.size(); }
+	// A fixed delay, or the initial one when the delay adapts to the jitter of the remote frames, for every peer
+	void setDelayFrames(int delayFrames);
+	void setAdaptiveDelay(bool adaptive);
+	int getDelayHistory(int peer, int* delays, int size) { return peers[peer]->getDelayHistory(delays, size); }
+	StreamFormat getFormat() { return format; }
+	// Lowering the quality when a link is congested is on by default, the slowest link sets the quality for all
+	void setRateControl(bool enabled) { rateController.setEnabled(enabled); }
+	void getStats(int peer, TransmissionStats& stats);
+	// The world space box the remote sites fuse, the frames are cropped to it when the stream format allows roi
+	void setRegionOfInterest(float3 volumeMin, float3 volumeMax);
 	void prepareSendFrame(int cameras, bool* check, float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
+	// Waits until every peer has sent the previous frame, so that mesh delta frames reach all of them
 	void sendFrame();
-	int getFrame(float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
+	// Writes the frames of all peers, at most maxCameras cameras, and returns how many were written. Never waits,
+	// see PeerLink::acquireFrame.
+	int getFrame(int maxCameras, float* depthImages_device, RGBQUAD* colorImages_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
+	bool isMeshMode() { return format.mesh != 0; }
+	void prepareSendMesh(byte* mesh);
+	// Appends the meshes of all peers, false when none was appended
+	bool getMesh(byte* mesh);
 };
 
 #endif
@@ -2,29 +2,108 @@
 #include <pcl/point_cloud.h>
 #include <pcl/conversions.h>
 #include "Timer.h"
+#include "Backend.h"
 
 extern "C" void cudaInitVolume(float sizeX, float sizeY, float sizeZ, float centerX, float centerY, float centerZ);
 extern "C" void cudaReleaseVolume();
+extern "C" void cudaSetTemporalFusion(bool enable, float maxWeight, float decay);
+#ifdef INDEXED_MESH
+extern "C" void cudaIntegrate(int cameras, int localCameras, int& vertexSize, int& triSize, MeshVertex* vertex, float* depth_device, RGBQUAD* color_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
+#else
 extern "C" void cudaIntegrate(int cameras, int localCameras, int& triSize, Vertex* vertex, float* depth_device, RGBQUAD* color_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
+#endif
+extern "C" void cpuInitVolume(float sizeX, float sizeY, float sizeZ, float centerX, float centerY, float centerZ);
+extern "C" void cpuReleaseVolume();
+extern "C" void cpuSetTemporalFusion(bool enable, float maxWeight, float decay);
+#ifdef INDEXED_MESH
+extern "C" void cpuIntegrate(int cameras, int localCameras, int& vertexSize, int& triSize, MeshVertex* vertex, float* depth, RGBQUAD* color, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
+#else
+extern "C" void cpuIntegrate(int cameras, int localCameras, int& triSize, Vertex* vertex, float* depth, RGBQUAD* color, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
+#endif
 
 TsdfVolume::TsdfVolume(float sizeX, float sizeY, float sizeZ, float centerX, float centerY, float centerZ)
 {
-	cudaInitVolume(sizeX, sizeY, sizeZ, centerX, centerY, centerZ);
+	minBounds = make_float3(centerX - sizeX * 0.5f, centerY - sizeY * 0.5f, centerZ - sizeZ * 0.5f);
+	maxBounds = make_float3(centerX + sizeX * 0.5f, centerY + sizeY * 0.5f, centerZ + sizeZ * 0.5f);
+	if (Backend::isCpu()) {
+		cpuInitVolume(sizeX, sizeY, sizeZ, centerX, centerY, centerZ);
+	} else {
+		cudaInitVolume(sizeX, sizeY, sizeZ, centerX, centerY, centerZ);
+	}
 }
 
 TsdfVolume::~TsdfVolume()
 {
-	cudaReleaseVolume();
+	if (Backend::isCpu()) {
+		cpuReleaseVolume();
+	} else {
+		cudaReleaseVolume();
+	}
+}
+
+void TsdfVolume::setTemporalFusion(bool enable, float maxWeight, float decay)
+{
+	if (Backend::isCpu()) {
+		cpuSetTemporalFusion(enable, maxWeight, decay);
+	} else {
+		cudaSetTemporalFusion(enable, maxWeight, decay);
+	}
 }
 
 void TsdfVolume::integrate(byte* result, int cameras, int localCameras, float* depth_device, RGBQUAD* color_device,Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics)
 {
+#ifdef INDEXED_MESH
+	MeshVertex* vertex = (MeshVertex*)(result + 8);
+	if (Backend::isCpu()) {
+		cpuIntegrate(cameras, localCameras, *((int*)result), *((int*)(result + 4)), vertex, depth_device, color_device, world2depth, depthIntrinsics, colorIntrinsics);
+	} else {
+		cudaIntegrate(cameras, localCameras, *((int*)result), *((int*)(result + 4)), vertex, depth_device, color_device, world2depth, depthIntrinsics, colorIntrinsics);
+	}
+#else
 	Vertex* vertex = (Vertex*)(result + 4);
-	cudaIntegrate(cameras, localCameras, *((int*)result), vertex, depth_device, color_device, world2depth, depthIntrinsics, colorIntrinsics);
+	if (Backend::isCpu()) {
+		cpuIntegrate(cameras, localCameras, *((int*)result), vertex, depth_device, color_device, world2depth, depthIntrinsics, colorIntrinsics);
+	} else {
+		cudaIntegrate(cameras, localCameras, *((int*)result), vertex, depth_device, color_device, world2depth, depthIntrinsics, colorIntrinsics);
+	}
+#endif
 }
 
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr TsdfVolume::getPointCloudFromMesh(byte* buffer)
 {
+#ifdef INDEXED_MESH
+	int vertexSize = *((int*)buffer);
+	int triSize = *((int*)(buffer + 4));
+	MeshVertex* vertex = (MeshVertex*)(buffer + 8);
+	UINT32* index = (UINT32*)(vertex + vertexSize);
+
+	int n = triSize * 3;
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>());
+	cloud->resize(vertexSize + n);
+
+	for (int i = 0; i < vertexSize; i++) {
+		cloud->points[i].x = vertex[i].pos.x;
+		cloud->points[i].y = vertex[i].pos.y;
+		cloud->points[i].z = vertex[i].pos.z;
+		cloud->points[i].r = vertex[i].color.x;
+		cloud->points[i].g = vertex[i].color.y;
+		cloud->points[i].b = vertex[i].color.z;
+	}
+	for (int i = 0; i < n; i++) {
+		int j = i + 1;
+		if (j % 3 == 0) {
+			j -= 3;
+		}
+		MeshVertex& v1 = vertex[index[i]];
+		MeshVertex& v2 = vertex[index[j]];
+		cloud->points[vertexSize + i].x = (v1.pos.x + v2.pos.x) * 0.5;
+		cloud->points[vertexSize + i].y = (v1.pos.y + v2.pos.y) * 0.5;
+		cloud->points[vertexSize + i].z = (v1.pos.z + v2.pos.z) * 0.5;
+		cloud->points[vertexSize + i].r = (v1.color.x + v2.color.x) / 2;
+		cloud->points[vertexSize + i].g = (v1.color.y + v2.color.y) / 2;
+		cloud->points[vertexSize + i].b = (v1.color.z + v2.color.z) / 2;
+	}
+#else
 	int size = *((int*)buffer);
 	Vertex* vertex = (Vertex*)(buffer + 4);
 
@@ -50,6 +129,7 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr TsdfVolume::getPointCloudFromMesh(byte* b
 		cloud->points[n + i].g = vertex[i].color2.y;
 		cloud->points[n + i].b = vertex[i].color2.z;
 	}
+#endif
 
 	return cloud;
 }
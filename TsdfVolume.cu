@@ -6,6 +6,14 @@
 #include "Vertex.h"
 #include "Parameters.h"
 #include "TsdfVolume.cuh"
+#include "HashTable.cuh"
+#include "DeviceScan.cuh"
+
+#define BRICK_VOXELS (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE)
+#define BRICKS_PER_AXIS (VOLUME / BRICK_SIZE)
+#define INTEGRATE_TILE 32
+// Every active cube emits at least one triangle
+#define MAX_ACTIVE_CUBES (MAX_VERTEX / 3)
 
 namespace tsdf {
 	float3 size;
@@ -21,6 +29,40 @@ namespace tsdf {
 	Vertex* vertex_device;
 	int* count_device;
 	UINT8* triBin_device;
+	UINT32* cornerKey_device;
+
+	// Cubes crossed by the surface, appended by the classify kernels
+	int* activeSize_device;
+	UINT32* activeCube_device;
+	UINT8* activeIndex_device;
+
+	// Sizes stay on the device until the mesh is copied back at the end of the frame
+	DeviceScan triScan;
+	int* triSize_device;
+	int* meshSize_host;
+
+#ifdef SPARSE_VOLUME
+	// volume_device and volumeBin_device hold MAX_BRICKS bricks of BRICK_VOXELS voxels
+	HashTable brickHash;
+	UINT32* brickList_device;
+	Transformation* depth2world_device;
+	int bricks = 0;
+#endif
+
+	// Temporal fusion keeps a running weight per voxel, NULL when every frame is rebuilt
+	float* volumeWeight_device = NULL;
+	float maxWeight;
+	float decay;
+
+#ifdef INDEXED_MESH
+	// Triangle corners hold the key of the cube edge their vertex lies on, edgeHash maps keys to vertex ids
+	HashTable edgeHash;
+	UINT32* vertexKey_device;
+	UINT32* index_device;
+	MeshVertex* meshVertex_device;
+	UINT8* vertexBin_device;
+	float3* normal_device;
+#endif
 }
 using namespace tsdf;
 
@@ -40,8 +82,81 @@ CUDA_CALLABLE_MEMBER __forceinline__ int devicePid(int x, int y) {
 CUDA_CALLABLE_MEMBER __forceinline__ int deviceVid(int x, int y, int z) {
 	return (x & 15) | ((y & 15) << 4) | ((z & 15) << 8) | ((x >> 4) << 12) | ((y >> 4) << 17) | ((z >> 4) << 22);
 }
+#else
+CUDA_CALLABLE_MEMBER __forceinline__ int devicePid(int x, int y) {
+	return x + y * VOLUME;
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ int deviceVid(int x, int y, int z) {
+	return x + (y + z * VOLUME) * VOLUME;
+}
 #endif
 
+CUDA_CALLABLE_MEMBER __forceinline__ UINT32 deviceBrickKey(int bx, int by, int bz) {
+	return bx + (by + bz * BRICKS_PER_AXIS) * BRICKS_PER_AXIS;
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ int3 deviceBrickOrigin(UINT32 key) {
+	return make_int3(key % BRICKS_PER_AXIS * BRICK_SIZE, key / BRICKS_PER_AXIS % BRICKS_PER_AXIS * BRICK_SIZE, key / BRICKS_PER_AXIS / BRICKS_PER_AXIS * BRICK_SIZE);
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ int deviceBrickVid(int x, int y, int z) {
+	return x + (y + z * BRICK_SIZE) * BRICK_SIZE;
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ UINT32 deviceLinearVid(int x, int y, int z) {
+	return (UINT32)x + ((UINT32)y + (UINT32)z * VOLUME) * VOLUME;
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ int3 deviceLinearPos(UINT32 vid) {
+	return make_int3(vid % VOLUME, vid / VOLUME % VOLUME, vid / VOLUME / VOLUME);
+}
+
+CUDA_CALLABLE_MEMBER __forceinline__ UINT32 deviceEdgeKey(int x, int y, int z, int axis) {
+	return deviceLinearVid(x, y, z) * 3 + axis;
+}
+
+class DenseVolume {
+public:
+	float* tsdf;
+	UINT8* bin;
+
+	__device__ __forceinline__ float get(int x, int y, int z) {
+		return tsdf[deviceVid(x, y, z)];
+	}
+
+	__device__ __forceinline__ UINT8 getBin(int x, int y, int z) {
+		return bin[deviceVid(x, y, z)];
+	}
+};
+
+class SparseVolume {
+public:
+	HashTable hash;
+	float* tsdf;
+	UINT8* bin;
+
+	__device__ __forceinline__ int find(int x, int y, int z) {
+		if (x < 0 || y < 0 || z < 0 || x >= VOLUME || y >= VOLUME || z >= VOLUME) {
+			return -1;
+		}
+		int brick = hash.find(deviceBrickKey(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE));
+		if (brick < 0) {
+			return -1;
+		}
+		return brick * BRICK_VOXELS + deviceBrickVid(x % BRICK_SIZE, y % BRICK_SIZE, z % BRICK_SIZE);
+	}
+
+	__device__ __forceinline__ float get(int x, int y, int z) {
+		int id = find(x, y, z);
+		return (id < 0) ? -1 : tsdf[id];
+	}
+
+	__device__ __forceinline__ UINT8 getBin(int x, int y, int z) {
+		int id = find(x, y, z);
+		return (id < 0) ? 0 : bin[id];
+	}
+};
 
 extern "C"
 void cudaInitVolume(float sizeX, float sizeY, float sizeZ, float centerX, float centerY, float centerZ) {
@@ -49,14 +164,38 @@ void cudaInitVolume(float sizeX, float sizeY, float sizeZ, float centerX, float
 	center = make_float3(centerX, centerY, centerZ);
 	volumeSize = size * (1.0 / VOLUME);
 	offset = center - size * 0.5;
+#ifdef SPARSE_VOLUME
+	HANDLE_ERROR(cudaMalloc(&volume_device, MAX_BRICKS * BRICK_VOXELS * sizeof(float)));
+	HANDLE_ERROR(cudaMalloc(&volumeBin_device, MAX_BRICKS * BRICK_VOXELS * sizeof(UINT8)));
+	HANDLE_ERROR(cudaMalloc(&brickList_device, MAX_BRICKS * sizeof(UINT32)));
+	HANDLE_ERROR(cudaMalloc(&depth2world_device, MAX_CAMERAS * sizeof(Transformation)));
+	brickHash.init(BRICK_HASH_SIZE);
+#else
 	HANDLE_ERROR(cudaMalloc(&volume_device, VOLUME * VOLUME * VOLUME * sizeof(float)));
 	HANDLE_ERROR(cudaMalloc(&volumeBin_device, VOLUME * VOLUME * VOLUME * sizeof(UINT8)));
+#endif
+	HANDLE_ERROR(cudaMalloc(&count_device, MAX_ACTIVE_CUBES * sizeof(int)));
+	HANDLE_ERROR(cudaMalloc(&activeSize_device, sizeof(int)));
+	HANDLE_ERROR(cudaMalloc(&triSize_device, sizeof(int)));
+	HANDLE_ERROR(cudaHostAlloc(&meshSize_host, 3 * sizeof(int), cudaHostAllocDefault));
+	triScan.init(MAX_ACTIVE_CUBES);
+	HANDLE_ERROR(cudaMalloc(&activeCube_device, MAX_ACTIVE_CUBES * sizeof(UINT32)));
+	HANDLE_ERROR(cudaMalloc(&activeIndex_device, MAX_ACTIVE_CUBES * sizeof(UINT8)));
 	HANDLE_ERROR(cudaMalloc(&world2depth_device, MAX_CAMERAS * sizeof(Transformation)));
 	HANDLE_ERROR(cudaMalloc(&depthIntrinsics_device, MAX_CAMERAS * sizeof(Intrinsics)));
 	HANDLE_ERROR(cudaMalloc(&colorIntrinsics_device, MAX_CAMERAS * sizeof(Intrinsics)));
+#ifdef INDEXED_MESH
+	HANDLE_ERROR(cudaMalloc(&cornerKey_device, MAX_VERTEX * sizeof(UINT32)));
+	HANDLE_ERROR(cudaMalloc(&vertexKey_device, MAX_VERTEX * sizeof(UINT32)));
+	HANDLE_ERROR(cudaMalloc(&index_device, MAX_VERTEX * sizeof(UINT32)));
+	HANDLE_ERROR(cudaMalloc(&meshVertex_device, MAX_VERTEX * sizeof(MeshVertex)));
+	HANDLE_ERROR(cudaMalloc(&vertexBin_device, MAX_VERTEX * sizeof(UINT8)));
+	HANDLE_ERROR(cudaMalloc(&normal_device, MAX_VERTEX * sizeof(float3)));
+	edgeHash.init(EDGE_HASH_SIZE);
+#else
 	HANDLE_ERROR(cudaMalloc(&vertex_device, MAX_VERTEX * sizeof(Vertex)));
-	HANDLE_ERROR(cudaMalloc(&count_device, VOLUME * VOLUME * sizeof(int)));
 	HANDLE_ERROR(cudaMalloc(&triBin_device, MAX_VERTEX / 3 * sizeof(UINT8)));
+#endif
 }
 
 extern "C"
@@ -66,20 +205,207 @@ void cudaReleaseVolume() {
 	HANDLE_ERROR(cudaFree(world2depth_device));
 	HANDLE_ERROR(cudaFree(depthIntrinsics_device));
 	HANDLE_ERROR(cudaFree(colorIntrinsics_device));
-	HANDLE_ERROR(cudaFree(vertex_device));
 	HANDLE_ERROR(cudaFree(count_device));
+	HANDLE_ERROR(cudaFree(activeSize_device));
+	HANDLE_ERROR(cudaFree(triSize_device));
+	HANDLE_ERROR(cudaFreeHost(meshSize_host));
+	triScan.release();
+	HANDLE_ERROR(cudaFree(activeCube_device));
+	HANDLE_ERROR(cudaFree(activeIndex_device));
+#ifdef INDEXED_MESH
+	HANDLE_ERROR(cudaFree(cornerKey_device));
+	HANDLE_ERROR(cudaFree(vertexKey_device));
+	HANDLE_ERROR(cudaFree(index_device));
+	HANDLE_ERROR(cudaFree(meshVertex_device));
+	HANDLE_ERROR(cudaFree(vertexBin_device));
+	HANDLE_ERROR(cudaFree(normal_device));
+	edgeHash.release();
+#else
+	HANDLE_ERROR(cudaFree(vertex_device));
 	HANDLE_ERROR(cudaFree(triBin_device));
+#endif
+#ifdef SPARSE_VOLUME
+	HANDLE_ERROR(cudaFree(brickList_device));
+	HANDLE_ERROR(cudaFree(depth2world_device));
+	brickHash.release();
+#endif
+	if (volumeWeight_device != NULL) {
+		HANDLE_ERROR(cudaFree(volumeWeight_device));
+		volumeWeight_device = NULL;
+	}
+}
+
+extern "C"
+void cudaSetTemporalFusion(bool enable, float maxWeight, float decay) {
+#ifdef SPARSE_VOLUME
+	const int VOXELS = MAX_BRICKS * BRICK_VOXELS;
+#else
+	const int VOXELS = VOLUME * VOLUME * VOLUME;
+#endif
+	tsdf::maxWeight = maxWeight;
+	tsdf::decay = decay;
+	if (enable && volumeWeight_device == NULL) {
+		HANDLE_ERROR(cudaMalloc(&volumeWeight_device, VOXELS * sizeof(float)));
+		HANDLE_ERROR(cudaMemset(volumeWeight_device, 0, VOXELS * sizeof(float)));
+#ifdef SPARSE_VOLUME
+		bricks = 0;
+		brickHash.clear();
+#endif
+	}
+	if (!enable && volumeWeight_device != NULL) {
+		HANDLE_ERROR(cudaFree(volumeWeight_device));
+		volumeWeight_device = NULL;
+	}
+}
+
+__device__ __forceinline__ float deviceTruncation(float3 volumeSize) {
+	return 3.0 * max(volumeSize.x, max(volumeSize.y, volumeSize.z));
+}
+
+__device__ __forceinline__ float deviceCalnTsdf(float3 pos, Intrinsics intrinsics, float* depthMap, float trancDist) {
+	float tsdf = -1;
+	int2 pixel = intrinsics.translate(pos);
+
+	if (pos.z > 0 && 0 <= pixel.x && pixel.x < DEPTH_W && 0 <= pixel.y && pixel.y < DEPTH_H) {
+		float depth = depthMap[pixel.y * DEPTH_W + pixel.x];
+
+		if (depth != 0) {
+			float sdf = depth - pos.z;
+
+			if (sdf >= -trancDist) {
+				tsdf = sdf / trancDist;
+			}
+		}
+	}
+	return tsdf;
+}
+
+// Local and remote cameras are fused separately, the surface closer to the viewer wins.
+// With volumeWeight the result is blended into the running average of the previous frames,
+// voxels that are not observed fade out with decay and are dropped below the weight of one frame.
+__device__ __forceinline__ void deviceWriteVoxel(float* volume, UINT8* volumeBin, float* volumeWeight, int id, int cameras, int localCameras, float tsdf, float weight, float remoteTsdf, float remoteWeight, UINT8 bin, float maxWeight, float decay) {
+	UINT8 localBin = (1 << localCameras) - 1;
+	UINT8 remoteBin = (1 << cameras) - (1 << localCameras);
+	float frameTsdf = -1;
+	UINT8 frameBin = 0;
+	if (bin != 0) {
+		if (remoteWeight == 0) {
+			frameTsdf = tsdf / weight;
+			frameBin = bin;
+		} else {
+			remoteTsdf = remoteTsdf / remoteWeight;
+			if (weight == 0) {
+				frameTsdf = remoteTsdf;
+				frameBin = bin;
+			} else {
+				float localTsdf = tsdf / weight;
+				if (localTsdf < remoteTsdf) {
+					frameTsdf = localTsdf;
+					frameBin = bin & localBin;
+				} else {
+					frameTsdf = remoteTsdf;
+					frameBin = bin & remoteBin;
+				}
+			}
+		}
+	}
+
+	if (volumeWeight == NULL) {
+		volume[id] = frameTsdf;
+		volumeBin[id] = frameBin;
+		return;
+	}
+
+	float w = volumeWeight[id] * decay;
+	if (frameBin != 0) {
+		volume[id] = (w == 0) ? frameTsdf : (volume[id] * w + frameTsdf) / (w + 1);
+		volumeBin[id] = frameBin;
+		volumeWeight[id] = min(w + 1, maxWeight);
+	} else if (w < 1) {
+		volume[id] = -1;
+		volumeBin[id] = 0;
+		volumeWeight[id] = 0;
+	} else {
+		volumeWeight[id] = w;
+	}
 }
 
-__global__ void kernelIntegrateDepth(int cameras, int localCameras, float* volume, UINT8* volumeBin, Transformation* transformation, Intrinsics* intrinsics, float* depthMap, float3 volumeSize, float3 offset) {
+// One thread per z-tile of a column, the projected position of every camera is kept in registers
+// and stepped along z exactly like the column-wise loop did, so the result is bit-identical.
+__global__ void kernelIntegrateDepth(int cameras, int localCameras, float* volume, UINT8* volumeBin, float* volumeWeight, Transformation* transformation, Intrinsics* intrinsics, float* depthMap, float3 volumeSize, float3 offset, float maxWeight, float decay) {
 	int x = threadIdx.x + blockIdx.x * blockDim.x;
 	int y = threadIdx.y + blockIdx.y * blockDim.y;
+	int z0 = blockIdx.z * INTEGRATE_TILE;
+
+	__shared__ Intrinsics intrinsics_shared[MAX_CAMERAS];
+	__shared__ float3 deltaZ_shared[MAX_CAMERAS];
+	int tid = threadIdx.x + threadIdx.y * blockDim.x;
+	if (tid < cameras) {
+		intrinsics_shared[tid] = intrinsics[tid];
+		deltaZ_shared[tid] = transformation[tid].deltaZ() * volumeSize;
+	}
+	__syncthreads();
 
 	if (x >= VOLUME || y >= VOLUME) {
 		return;
 	}
 
-	const float TRANC_DIST_M = 3.0 * max(volumeSize.x, max(volumeSize.y, volumeSize.z));
+	const float TRANC_DIST_M = deviceTruncation(volumeSize);
+
+	float3 pos[MAX_CAMERAS];
+	#pragma unroll
+	for (int i = 0; i < MAX_CAMERAS; i++) {
+		if (i < cameras) {
+			float3 ori = make_float3(x, y, -1) * volumeSize + offset;
+			pos[i] = transformation[i].translate(ori);
+			for (int z = 0; z < z0; z++) {
+				pos[i] = pos[i] + deltaZ_shared[i];
+			}
+		}
+	}
+
+	for (int z = z0; z < z0 + INTEGRATE_TILE; z++) {
+		float tsdf = 0;
+		float weight = 0;
+		float remoteTsdf = 0;
+		float remoteWeight = 0;
+		UINT8 bin = 0;
+
+		#pragma unroll
+		for (int i = 0; i < MAX_CAMERAS; i++) {
+			if (i < cameras) {
+				pos[i] = pos[i] + deltaZ_shared[i];
+				float t = deviceCalnTsdf(pos[i], intrinsics_shared[i], depthMap + i * DEPTH_H * DEPTH_W, TRANC_DIST_M);
+
+				if (t != -1) {
+					float w = 1.0 / module(pos[i]);
+					if (i < localCameras) {
+						tsdf += t * w;
+						weight += w;
+					} else {
+						remoteTsdf += t * w;
+						remoteWeight += w;
+					}
+					bin |= (1 << i);
+				}
+			}
+		}
+
+		deviceWriteVoxel(volume, volumeBin, volumeWeight, deviceVid(x, y, z), cameras, localCameras, tsdf, weight, remoteTsdf, remoteWeight, bin, maxWeight, decay);
+	}
+}
+
+#ifdef BENCHMARK
+// Column-per-thread integration replaced by kernelIntegrateDepth, kept as reference for the benchmark.
+__global__ void kernelIntegrateDepthColumn(int cameras, int localCameras, float* volume, UINT8* volumeBin, float* volumeWeight, Transformation* transformation, Intrinsics* intrinsics, float* depthMap, float3 volumeSize, float3 offset, float maxWeight, float decay) {
+	int x = threadIdx.x + blockIdx.x * blockDim.x;
+	int y = threadIdx.y + blockIdx.y * blockDim.y;
+
+	if (x >= VOLUME || y >= VOLUME) {
+		return;
+	}
+
+	const float TRANC_DIST_M = deviceTruncation(volumeSize);
 
 	struct VolumePara {
 		float tsdf = 0;
@@ -95,21 +421,8 @@ __global__ void kernelIntegrateDepth(int cameras, int localCameras, float* volum
 		float3 deltaZ = transformation[i].deltaZ() * volumeSize;
 
 		for (int z = 0; z < VOLUME; z++) {
-			float tsdf = -1;
 			pos = pos + deltaZ;
-			int2 pixel = intrinsics[i].translate(pos);
-
-			if (pos.z > 0 && 0 <= pixel.x && pixel.x < DEPTH_W && 0 <= pixel.y && pixel.y < DEPTH_H) {
-				float depth = depthMap[(i * DEPTH_H + pixel.y) * DEPTH_W + pixel.x];
-
-				if (depth != 0) {
-					float sdf = depth - pos.z;
-
-					if (sdf >= -TRANC_DIST_M) {
-						tsdf = sdf / TRANC_DIST_M;
-					}
-				}
-			}
+			float tsdf = deviceCalnTsdf(pos, intrinsics[i], depthMap + i * DEPTH_H * DEPTH_W, TRANC_DIST_M);
 
 			if (tsdf != -1) {
 				float w = 1.0 / module(pos);
@@ -125,83 +438,129 @@ __global__ void kernelIntegrateDepth(int cameras, int localCameras, float* volum
 		}
 	}
 
-	UINT8 localBin = (1 << localCameras) - 1;
-	UINT8 remoteBin = (1 << cameras) - (1 << localCameras);
 	for (int z = 0; z < VOLUME; z++) {
-		int id = deviceVid(x, y, z);
-		if (volumePara[z].bin != 0) {
-			if (volumePara[z].remoteWeight == 0) {
-				volume[id] = volumePara[z].tsdf / volumePara[z].weight;
-				volumeBin[id] = volumePara[z].bin;
-			} else {
-				float remoteTsdf = volumePara[z].remoteTsdf / volumePara[z].remoteWeight;
-				if (volumePara[z].weight == 0) {
-					volume[id] = remoteTsdf;
-					volumeBin[id] = volumePara[z].bin;
-				} else {
-					float localTsdf = volumePara[z].tsdf / volumePara[z].weight;
-					if (localTsdf < remoteTsdf) {
-						volume[id] = localTsdf;
-						volumeBin[id] = volumePara[z].bin & localBin;
-					} else {
-						volume[id] = remoteTsdf;
-						volumeBin[id] = volumePara[z].bin & remoteBin;
-					}
+		deviceWriteVoxel(volume, volumeBin, volumeWeight, deviceVid(x, y, z), cameras, localCameras, volumePara[z].tsdf, volumePara[z].weight, volumePara[z].remoteTsdf, volumePara[z].remoteWeight, volumePara[z].bin, maxWeight, decay);
+	}
+}
+#endif
+
+__global__ void kernelAllocateBricks(HashTable hash, UINT32* brickList, Transformation* depth2world, Intrinsics* intrinsics, float* depthMap, float3 volumeSize, float3 offset) {
+	int x = threadIdx.x + blockIdx.x * blockDim.x;
+	int y = threadIdx.y + blockIdx.y * blockDim.y;
+	int i = blockIdx.z;
+
+	if (x >= DEPTH_W || y >= DEPTH_H) {
+		return;
+	}
+
+	float depth = depthMap[(i * DEPTH_H + y) * DEPTH_W + x];
+	if (depth == 0) {
+		return;
+	}
+
+	const float TRANC_DIST_M = deviceTruncation(volumeSize);
+	const float step = min(volumeSize.x, min(volumeSize.y, volumeSize.z));
+	float3 ray = intrinsics[i].deproject(make_float2(x + 0.5f, y + 0.5f), 1);
+
+	UINT32 lastKey = HashTable::EMPTY;
+	for (float d = depth - TRANC_DIST_M; d <= depth + TRANC_DIST_M; d += step) {
+		float3 pos = depth2world[i].translate(ray * d) - offset;
+		int vx = floor(pos.x / volumeSize.x);
+		int vy = floor(pos.y / volumeSize.y);
+		int vz = floor(pos.z / volumeSize.z);
+
+		if (0 <= vx && vx < VOLUME && 0 <= vy && vy < VOLUME && 0 <= vz && vz < VOLUME) {
+			UINT32 key = deviceBrickKey(vx / BRICK_SIZE, vy / BRICK_SIZE, vz / BRICK_SIZE);
+			if (key != lastKey) {
+				int id = hash.insert(key, MAX_BRICKS);
+				if (0 <= id && id < MAX_BRICKS) {
+					brickList[id] = key;
 				}
+				lastKey = key;
 			}
-		} else {
-			volume[id] = -1;
-			volumeBin[id] = 0;
 		}
 	}
 }
 
-__device__ __forceinline__ UINT16 deviceGetCubeIndex(float* volume, int x, int y, int z) {
-	if (x + 1 >= VOLUME) return 0;
-	if (y + 1 >= VOLUME) return 0;
-	if (z + 1 >= VOLUME) return 0;
-	if (volume[deviceVid(x + 0, y + 0, z + 0)] == -1) return 0;
-	if (volume[deviceVid(x + 1, y + 0, z + 0)] == -1) return 0;
-	if (volume[deviceVid(x + 0, y + 1, z + 0)] == -1) return 0;
-	if (volume[deviceVid(x + 1, y + 1, z + 0)] == -1) return 0;
-	if (volume[deviceVid(x + 0, y + 0, z + 1)] == -1) return 0;
-	if (volume[deviceVid(x + 1, y + 0, z + 1)] == -1) return 0;
-	if (volume[deviceVid(x + 0, y + 1, z + 1)] == -1) return 0;
-	if (volume[deviceVid(x + 1, y + 1, z + 1)] == -1) return 0;
-	UINT16 index = 0;
-	if (volume[deviceVid(x + 0, y + 0, z + 0)] < 0) index |= 1;
-	if (volume[deviceVid(x + 1, y + 0, z + 0)] < 0) index |= 2;
-	if (volume[deviceVid(x + 0, y + 1, z + 0)] < 0) index |= 8;
-	if (volume[deviceVid(x + 1, y + 1, z + 0)] < 0) index |= 4;
-	if (volume[deviceVid(x + 0, y + 0, z + 1)] < 0) index |= 16;
-	if (volume[deviceVid(x + 1, y + 0, z + 1)] < 0) index |= 32;
-	if (volume[deviceVid(x + 0, y + 1, z + 1)] < 0) index |= 128;
-	if (volume[deviceVid(x + 1, y + 1, z + 1)] < 0) index |= 64;
+// One block per brick, one thread per voxel.
+__global__ void kernelIntegrateBricks(int cameras, int localCameras, UINT32* brickList, float* volume, UINT8* volumeBin, float* volumeWeight, Transformation* transformation, Intrinsics* intrinsics, float* depthMap, float3 volumeSize, float3 offset, float maxWeight, float decay) {
+	int3 origin = deviceBrickOrigin(brickList[blockIdx.x]);
+	int x = origin.x + threadIdx.x;
+	int y = origin.y + threadIdx.y;
+	int z = origin.z + threadIdx.z;
+
+	const float TRANC_DIST_M = deviceTruncation(volumeSize);
+	float3 ori = make_float3(x, y, z) * volumeSize + offset;
+
+	float tsdf = 0;
+	float weight = 0;
+	float remoteTsdf = 0;
+	float remoteWeight = 0;
+	UINT8 bin = 0;
+	for (int i = 0; i < cameras; i++) {
+		float3 pos = transformation[i].translate(ori);
+		float t = deviceCalnTsdf(pos, intrinsics[i], depthMap + i * DEPTH_H * DEPTH_W, TRANC_DIST_M);
+
+		if (t != -1) {
+			float w = 1.0 / module(pos);
+			if (i < localCameras) {
+				tsdf += t * w;
+				weight += w;
+			} else {
+				remoteTsdf += t * w;
+				remoteWeight += w;
+			}
+			bin |= (1 << i);
+		}
+	}
+
+	int id = blockIdx.x * BRICK_VOXELS + deviceBrickVid(threadIdx.x, threadIdx.y, threadIdx.z);
+	deviceWriteVoxel(volume, volumeBin, volumeWeight, id, cameras, localCameras, tsdf, weight, remoteTsdf, remoteWeight, bin, maxWeight, decay);
+}
+
+__device__ __forceinline__ UINT8 deviceCubeIndex(float v0[4], float v1[4]) {
+	for (int i = 0; i < 4; i++) {
+		if (v0[i] == -1 || v1[i] == -1) return 0;
+	}
+	UINT8 index = 0;
+	for (int i = 0; i < 4; i++) {
+		if (v0[i] < 0) index |= (1 << i);
+		if (v1[i] < 0) index |= (16 << i);
+	}
 	return index;
 }
 
-__global__ void kernelMarchingCubesCount(float* volume, int* count) {
-	int x = threadIdx.x + blockIdx.x * blockDim.x;
-	int y = threadIdx.y + blockIdx.y * blockDim.y;
+// The corners of a cube face in the order of the cube index bits.
+template<class Volume>
+__device__ __forceinline__ void deviceGetCubeFace(Volume volume, int x, int y, int z, float v[4]) {
+	v[0] = volume.get(x + 0, y + 0, z);
+	v[1] = volume.get(x + 1, y + 0, z);
+	v[2] = volume.get(x + 1, y + 1, z);
+	v[3] = volume.get(x + 0, y + 1, z);
+}
 
-	int cnt = 0;
-	for (int z = 0; z + 1 < VOLUME; z++) {
-		cnt += triNumber_device[deviceGetCubeIndex(volume, x, y, z)];
-	}
-	count[devicePid(x, y)] = cnt;
+template<class Volume>
+__device__ __forceinline__ UINT8 deviceGetCubeIndex(Volume volume, int x, int y, int z) {
+	if (x + 1 >= VOLUME) return 0;
+	if (y + 1 >= VOLUME) return 0;
+	if (z + 1 >= VOLUME) return 0;
+	float v0[4], v1[4];
+	deviceGetCubeFace(volume, x, y, z + 0, v0);
+	deviceGetCubeFace(volume, x, y, z + 1, v1);
+	return deviceCubeIndex(v0, v1);
 }
 
-__device__ __forceinline__ float3 deviceCalnEdgePoint(float* volume, int x, int y, int z, int dx, int dy, int dz) {
-	float v1 = volume[deviceVid(x, y, z)];
-	float v2 = volume[deviceVid(x + dx, y + dy, z + dz)];
-	if ((v1 < 0) ^ (v2 < 0)) {
-		float k =  v1 / (v1 - v2);
-		return make_float3(x + k * dx, y + k * dy, z + k * dz);
+__device__ __forceinline__ void deviceAppendCube(int* activeSize, UINT32* activeCube, UINT8* activeIndex, int* activeTri, int x, int y, int z, UINT8 cubeId) {
+	int id = atomicAdd(activeSize, 1);
+	if (id < MAX_ACTIVE_CUBES) {
+		activeCube[id] = deviceLinearVid(x, y, z);
+		activeIndex[id] = cubeId;
+		activeTri[id] = triNumber_device[cubeId];
 	}
-	return float3();
 }
 
-__global__ void kernelMarchingCubes(int cameras, float* volume, UINT8* volumeBin, int* count, Vertex* vertex, UINT8* triBin, float3 volumeSize, float3 offset) {
+// One thread per column, the upper face of a cube is the lower face of the next one.
+__global__ void kernelClassifyCubes(DenseVolume volume, int* activeSize, UINT32* activeCube, UINT8* activeIndex, int* activeTri) {
 	int x = threadIdx.x + blockIdx.x * blockDim.x;
 	int y = threadIdx.y + blockIdx.y * blockDim.y;
 
@@ -209,140 +568,126 @@ __global__ void kernelMarchingCubes(int cameras, float* volume, UINT8* volumeBin
 		return;
 	}
 
-	Vertex* vtx = vertex + count[devicePid(x, y)] * 3;
-	UINT8* tri = triBin + count[devicePid(x, y)];
-
+	float v0[4], v1[4];
+	deviceGetCubeFace(volume, x, y, 0, v0);
 	for (int z = 0; z + 1 < VOLUME; z++) {
-		int cubeId = deviceGetCubeIndex(volume, x, y, z);
-
-		if (triTable_device[cubeId][0] != -1) {
-			int id = deviceVid(x, y, z);
-			float3 pos[12];
-			pos[0] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 0, 1, 0, 0);
-			pos[1] = deviceCalnEdgePoint(volume, x + 1, y + 0, z + 0, 0, 1, 0);
-			pos[2] = deviceCalnEdgePoint(volume, x + 0, y + 1, z + 0, 1, 0, 0);
-			pos[3] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 0, 0, 1, 0);
-
-			pos[4] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 1, 1, 0, 0);
-			pos[5] = deviceCalnEdgePoint(volume, x + 1, y + 0, z + 1, 0, 1, 0);
-			pos[6] = deviceCalnEdgePoint(volume, x + 0, y + 1, z + 1, 1, 0, 0);
-			pos[7] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 1, 0, 1, 0);
-
-			pos[8] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 0, 0, 0, 1);
-			pos[9] = deviceCalnEdgePoint(volume, x + 1, y + 0, z + 0, 0, 0, 1);
-			pos[10] = deviceCalnEdgePoint(volume, x + 1, y + 1, z + 0, 0, 0, 1);
-			pos[11] = deviceCalnEdgePoint(volume, x + 0, y + 1, z + 0, 0, 0, 1);
-
-			for (int i = 0; i < 5 && triTable_device[cubeId][i * 3] != -1; i++) {
-				for (int j = 0; j < 3; j++) {
-					int edgeId = triTable_device[cubeId][i * 3 + j];
-					vtx->pos = pos[edgeId] * volumeSize + offset;
-					vtx++;
-				}
-				*tri = volumeBin[id];
-				tri++;
-			}
+		deviceGetCubeFace(volume, x, y, z + 1, v1);
+		UINT8 cubeId = deviceCubeIndex(v0, v1);
+		if (triNumber_device[cubeId] != 0) {
+			deviceAppendCube(activeSize, activeCube, activeIndex, activeTri, x, y, z, cubeId);
+		}
+		for (int i = 0; i < 4; i++) {
+			v0[i] = v1[i];
 		}
 	}
 }
 
-__global__ void cudaCountAccumulation(int *count_device, int *sum_device, int *temp_device) {//һblock1024̣߳2048һҪresx*resy = 2^18ֳ128block
-	int block_offset = blockIdx.x * 2048;//ȷڼ2048
-	int thid = threadIdx.x;
-
-	__shared__ int shared_count_device[2048];
-	if (block_offset == 0 && thid == 0)
-		shared_count_device[0] = 0;
-	else
-		shared_count_device[2 * thid] = count_device[block_offset + 2 * thid - 1];
-	shared_count_device[2 * thid + 1] = count_device[block_offset + 2 * thid];
-	__syncthreads();//sharedֵҪͬ
-
-	//UpSweep
-	int offset = 1;
-	int n = 2048;
-	for (int d = n >> 1; d > 0; d >>= 1)                    // build sum in place up the tree
-	{
-		__syncthreads();
-		if (thid < d)
-		{
-			int ai = offset*(2 * thid + 1) - 1;
-			int bi = offset*(2 * thid + 2) - 1;
-			shared_count_device[bi] += shared_count_device[ai];
-		}
-		offset *= 2;
+__global__ void kernelClassifyBricks(SparseVolume volume, UINT32* brickList, int* activeSize, UINT32* activeCube, UINT8* activeIndex, int* activeTri) {
+	int3 origin = deviceBrickOrigin(brickList[blockIdx.x]);
+	int x = origin.x + threadIdx.x;
+	int y = origin.y + threadIdx.y;
+	int z = origin.z + threadIdx.z;
+	UINT8 cubeId = deviceGetCubeIndex(volume, x, y, z);
+	if (triNumber_device[cubeId] != 0) {
+		deviceAppendCube(activeSize, activeCube, activeIndex, activeTri, x, y, z, cubeId);
 	}
+}
 
-	//DownSweep,עΪҪblockͣʹõinclusive scan
-	for (int i = n / 2; i > 1; i /= 2) {
-		__syncthreads();
-		int start = (i - 1) + (i >> 1);
-		int doffset = (i >> 1);
-		if ((2 * thid - start) % i == 0 && 2 * thid - start >= 0) {
-			shared_count_device[2 * thid] += shared_count_device[2 * thid - doffset];
-		}
-		if ((2 * thid + 1 - start) % i == 0 && 2 * thid + 1 - start >= 0) {
-			shared_count_device[2 * thid + 1] += shared_count_device[2 * thid + 1 - doffset];
-		}
-	}
-	temp_device[block_offset + 2 * thid] = shared_count_device[2 * thid];
-	temp_device[block_offset + 2 * thid + 1] = shared_count_device[2 * thid + 1];
-	if (thid == 0) {
-		sum_device[blockIdx.x] = shared_count_device[n - 1];
+template<class Volume>
+__device__ __forceinline__ float3 deviceCalnEdgePoint(Volume volume, int x, int y, int z, int dx, int dy, int dz) {
+	float v1 = volume.get(x, y, z);
+	float v2 = volume.get(x + dx, y + dy, z + dz);
+	if ((v1 < 0) ^ (v2 < 0)) {
+		float k =  v1 / (v1 - v2);
+		return make_float3(x + k * dx, y + k * dy, z + k * dz);
 	}
+	return float3();
 }
 
-__global__ void cudaCountAccumulation2(int *count_device, int *sum_device, int *temp_device) {//һblock1024̣߳2048һҪresx*resy = 2^18ֳ128block
-	int block_offset = blockIdx.x * 2048;//ȷڼ2048
-	int thid = threadIdx.x;
-	int n = 2048;
-	__shared__ int shared_count_device[2048];
-	__shared__ int presum;
-	shared_count_device[2 * thid] = temp_device[block_offset + 2 * thid];
-	shared_count_device[2 * thid + 1] = temp_device[block_offset + 2 * thid + 1];
-	if (thid == 0) {
-		if (blockIdx.x != 0) {
-			presum = sum_device[blockIdx.x - 1];
+// Writes the triangles of a cube starting at triId, either as full vertices or,
+// for the indexed mesh, as the keys of the edges the vertices lie on.
+template<class Volume>
+__device__ __forceinline__ void deviceMarchCube(Volume volume, int x, int y, int z, int cubeId, int triId, Vertex* vertex, UINT8* triBin, UINT32* cornerKey, float3 volumeSize, float3 offset) {
+#ifdef INDEXED_MESH
+	for (int i = 0; i < 5 && triTable_device[cubeId][i * 3] != -1; i++) {
+		for (int j = 0; j < 3; j++) {
+			int4 edge = edgeTable_device[triTable_device[cubeId][i * 3 + j]];
+			cornerKey[(triId + i) * 3 + j] = deviceEdgeKey(x + edge.x, y + edge.y, z + edge.z, edge.w);
 		}
-		else {
-			presum = 0;
+	}
+#else
+	Vertex* vtx = vertex + triId * 3;
+	UINT8* tri = triBin + triId;
+	float3 pos[12];
+	pos[0] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 0, 1, 0, 0);
+	pos[1] = deviceCalnEdgePoint(volume, x + 1, y + 0, z + 0, 0, 1, 0);
+	pos[2] = deviceCalnEdgePoint(volume, x + 0, y + 1, z + 0, 1, 0, 0);
+	pos[3] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 0, 0, 1, 0);
+
+	pos[4] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 1, 1, 0, 0);
+	pos[5] = deviceCalnEdgePoint(volume, x + 1, y + 0, z + 1, 0, 1, 0);
+	pos[6] = deviceCalnEdgePoint(volume, x + 0, y + 1, z + 1, 1, 0, 0);
+	pos[7] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 1, 0, 1, 0);
+
+	pos[8] = deviceCalnEdgePoint(volume, x + 0, y + 0, z + 0, 0, 0, 1);
+	pos[9] = deviceCalnEdgePoint(volume, x + 1, y + 0, z + 0, 0, 0, 1);
+	pos[10] = deviceCalnEdgePoint(volume, x + 1, y + 1, z + 0, 0, 0, 1);
+	pos[11] = deviceCalnEdgePoint(volume, x + 0, y + 1, z + 0, 0, 0, 1);
+
+	UINT8 bin = volume.getBin(x, y, z);
+	for (int i = 0; i < 5 && triTable_device[cubeId][i * 3] != -1; i++) {
+		for (int j = 0; j < 3; j++) {
+			int edgeId = triTable_device[cubeId][i * 3 + j];
+			vtx->pos = pos[edgeId] * volumeSize + offset;
+			vtx++;
 		}
+		*tri = bin;
+		tri++;
 	}
-	__syncthreads();//sharedֵҪͬ
+#endif
+}
 
-	shared_count_device[2 * thid] += presum;
-	shared_count_device[2 * thid + 1] += presum;
+// The kernels after the scan are launched for the largest mesh and read the actual sizes from the device,
+// nothing is generated when the active cubes or the triangles exceed their buffers.
+__device__ __forceinline__ bool deviceMeshFits(int* activeSize, int* triSize) {
+	return *activeSize <= MAX_ACTIVE_CUBES && *triSize * 3 <= MAX_VERTEX;
+}
 
-	count_device[block_offset + 2 * thid] = shared_count_device[2 * thid];
-	count_device[block_offset + 2 * thid + 1] = shared_count_device[2 * thid + 1];
+// One thread per active cube, triOffset is the exclusive scan of the triangle counts.
+template<class Volume>
+__global__ void kernelMarchingCubes(Volume volume, int* activeSize, int* triSize, UINT32* activeCube, UINT8* activeIndex, int* triOffset, Vertex* vertex, UINT8* triBin, UINT32* cornerKey, float3 volumeSize, float3 offset) {
+	int id = threadIdx.x + blockIdx.x * blockDim.x;
+	if (deviceMeshFits(activeSize, triSize) && id < *activeSize) {
+		int3 p = deviceLinearPos(activeCube[id]);
+		deviceMarchCube(volume, p.x, p.y, p.z, activeIndex[id], triOffset[id], vertex, triBin, cornerKey, volumeSize, offset);
+	}
 }
 
-int cpu_cudaCountAccumulation() {
-	const int DATASIZE = VOLUME * VOLUME;
-	int threads = 1024;
-	int blocks = DATASIZE / threads / 2;
-	int sum_host[128];
-	int* sum_device;
-	int* temp_device;
-	HANDLE_ERROR(cudaMalloc(&sum_device, blocks * sizeof(int)));
-	HANDLE_ERROR(cudaMalloc(&temp_device, DATASIZE * sizeof(int)));
-	//stage1
-	cudaCountAccumulation << <blocks, threads >> > (count_device, sum_device, temp_device);
-	HANDLE_ERROR(cudaGetLastError());
-	HANDLE_ERROR(cudaMemcpy(sum_host, sum_device, blocks * sizeof(int), cudaMemcpyDeviceToHost));
-	for (int i = 1; i < blocks; ++i) {
-		sum_host[i] += sum_host[i - 1];
+#ifdef SPARSE_VOLUME
+int allocateBricks(int cameras, float* depth_device) {
+	dim3 blocks = dim3((DEPTH_W + BLOCK_SIZE - 1) / BLOCK_SIZE, (DEPTH_H + BLOCK_SIZE - 1) / BLOCK_SIZE, cameras);
+	dim3 threads = dim3(BLOCK_SIZE, BLOCK_SIZE);
+
+	// Temporal fusion keeps the bricks of previous frames until the pool is full
+	int previous = bricks;
+	if (volumeWeight_device == NULL || previous >= MAX_BRICKS) {
+		brickHash.clear();
+		previous = 0;
 	}
-	//stage2
-	HANDLE_ERROR(cudaMemcpy(sum_device, sum_host, blocks * sizeof(int), cudaMemcpyHostToDevice));
-	cudaCountAccumulation2 << <blocks, threads >> > (count_device, sum_device, temp_device);
+	kernelAllocateBricks << <blocks, threads >> > (brickHash, brickList_device, depth2world_device, depthIntrinsics_device, depth_device, volumeSize, offset);
 	HANDLE_ERROR(cudaGetLastError());
 
-	HANDLE_ERROR(cudaFree(sum_device));
-	HANDLE_ERROR(cudaFree(temp_device));
-	int tris_size = sum_host[blocks - 1];
-	return tris_size;
+	int result = brickHash.size();
+	if (result > MAX_BRICKS) {
+		std::cout << "brick size limit exceeded (size = " << result << ")" << std::endl;
+		result = MAX_BRICKS;
+	}
+	if (volumeWeight_device != NULL && result > previous) {
+		HANDLE_ERROR(cudaMemset(volumeWeight_device + previous * BRICK_VOXELS, 0, (result - previous) * BRICK_VOXELS * sizeof(float)));
+	}
+	return result;
 }
+#endif
 
 __device__ __forceinline__ uchar4 calnColor(int cameras, UINT8 bin, float3 ori, Transformation* transformation, Intrinsics* intrinsics, uchar4* color, float3 normal) {
 	float4 colorSum = float4();
@@ -369,9 +714,9 @@ __device__ __forceinline__ uchar4 calnColor(int cameras, UINT8 bin, float3 ori,
 	return make_uchar4(colorSum.x / weight, colorSum.y / weight, colorSum.z / weight, 0);
 }
 
-__global__ void kernelColorization(int cameras, int triSize, Vertex* vertex, UINT8* triBin, uchar4* color, Transformation* transformation, Intrinsics* intrinsics) {
+__global__ void kernelColorization(int cameras, int* activeSize, int* triSize, Vertex* vertex, UINT8* triBin, uchar4* color, Transformation* transformation, Intrinsics* intrinsics) {
 	int id = threadIdx.x + blockIdx.x * blockDim.x;
-	if (id < triSize) {
+	if (deviceMeshFits(activeSize, triSize) && id < *triSize) {
 
 		float3 pos[6];
 		pos[0] = vertex[id * 3 + 0].pos;
@@ -387,8 +732,81 @@ __global__ void kernelColorization(int cameras, int triSize, Vertex* vertex, UIN
 		}
 	}
 }
+
+#ifdef INDEXED_MESH
+__global__ void kernelInsertEdges(HashTable hash, int* activeSize, int* triSize, UINT32* cornerKey, UINT32* vertexKey) {
+	int id = threadIdx.x + blockIdx.x * blockDim.x;
+	if (deviceMeshFits(activeSize, triSize) && id < *triSize * 3) {
+		int vertexId = hash.insert(cornerKey[id], MAX_VERTEX);
+		if (vertexId >= 0) {
+			vertexKey[vertexId] = cornerKey[id];
+		}
+	}
+}
+
+template<class Volume>
+__global__ void kernelEdgeVertices(Volume volume, int* vertexSize, UINT32* vertexKey, MeshVertex* vertex, UINT8* vertexBin, float3* normal, float3 volumeSize, float3 offset) {
+	int id = threadIdx.x + blockIdx.x * blockDim.x;
+	if (id < *vertexSize) {
+		UINT32 key = vertexKey[id];
+		int axis = key % 3;
+		int3 p = deviceLinearPos(key / 3);
+		int dx = (axis == 0);
+		int dy = (axis == 1);
+		int dz = (axis == 2);
+		vertex[id].pos = deviceCalnEdgePoint(volume, p.x, p.y, p.z, dx, dy, dz) * volumeSize + offset;
+		vertexBin[id] = volume.getBin(p.x, p.y, p.z) | volume.getBin(p.x + dx, p.y + dy, p.z + dz);
+		normal[id] = float3();
+	}
+}
+
+// Every triangle looks up its vertices and adds its area weighted normal to them.
+__global__ void kernelIndexTriangles(HashTable hash, int* activeSize, int* triSize, UINT32* cornerKey, UINT32* index, MeshVertex* vertex, float3* normal) {
+	int id = threadIdx.x + blockIdx.x * blockDim.x;
+	if (deviceMeshFits(activeSize, triSize) && id < *triSize) {
+		int v[3];
+		for (int j = 0; j < 3; j++) {
+			v[j] = hash.find(cornerKey[id * 3 + j]);
+			index[id * 3 + j] = v[j];
+		}
+		float3 n = multi(vertex[v[1]].pos - vertex[v[0]].pos, vertex[v[2]].pos - vertex[v[0]].pos);
+		for (int j = 0; j < 3; j++) {
+			atomicAdd(&normal[v[j]].x, n.x);
+			atomicAdd(&normal[v[j]].y, n.y);
+			atomicAdd(&normal[v[j]].z, n.z);
+		}
+	}
+}
+
+__global__ void kernelColorizationIndexed(int cameras, int* vertexSize, MeshVertex* vertex, UINT8* vertexBin, float3* normal, uchar4* color, Transformation* transformation, Intrinsics* intrinsics) {
+	int id = threadIdx.x + blockIdx.x * blockDim.x;
+	if (id < *vertexSize) {
+		vertex[id].color = calnColor(cameras, vertexBin[id], vertex[id].pos, transformation, intrinsics, color, normal[id]);
+	}
+}
+
+// Merges the triangle corners on the same cube edge into one vertex, the number of vertices is edgeHash.count.
+template<class Volume>
+void indexTriangles(Volume volume, int cameras, RGBQUAD* color_device) {
+	edgeHash.clear();
+	kernelInsertEdges << <(MAX_VERTEX + 255) / 256, 256 >> > (edgeHash, activeSize_device, triSize_device, cornerKey_device, vertexKey_device);
+	HANDLE_ERROR(cudaGetLastError());
+	kernelEdgeVertices << <(MAX_VERTEX + 255) / 256, 256 >> > (volume, edgeHash.count, vertexKey_device, meshVertex_device, vertexBin_device, normal_device, volumeSize, offset);
+	HANDLE_ERROR(cudaGetLastError());
+	kernelIndexTriangles << <(MAX_VERTEX / 3 + 255) / 256, 256 >> > (edgeHash, activeSize_device, triSize_device, cornerKey_device, index_device, meshVertex_device, normal_device);
+	HANDLE_ERROR(cudaGetLastError());
+	kernelColorizationIndexed << <(MAX_VERTEX + 255) / 256, 256 >> > (cameras, edgeHash.count, meshVertex_device, vertexBin_device, normal_device, (uchar4*)color_device, world2depth_device, colorIntrinsics_device);
+	HANDLE_ERROR(cudaGetLastError());
+}
+#endif
+
+// The indexed mesh writes its vertices to vertex followed by triSize * 3 indices.
 extern "C"
+#ifdef INDEXED_MESH
+void cudaIntegrate(int cameras, int localCameras, int& vertexSize, int& triSize, MeshVertex* vertex, float* depth_device, RGBQUAD* color_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics) {
+#else
 void cudaIntegrate(int cameras, int localCameras, int& triSize, Vertex* vertex, float* depth_device, RGBQUAD* color_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics) {
+#endif
 	dim3 blocks = dim3(VOLUME / BLOCK_SIZE, VOLUME / BLOCK_SIZE);
 	dim3 threads = dim3(BLOCK_SIZE, BLOCK_SIZE);
 
@@ -396,23 +814,131 @@ void cudaIntegrate(int cameras, int localCameras, int& triSize, Vertex* vertex,
 	HANDLE_ERROR(cudaMemcpy(depthIntrinsics_device, depthIntrinsics, MAX_CAMERAS * sizeof(Intrinsics), cudaMemcpyHostToDevice));
 	HANDLE_ERROR(cudaMemcpy(colorIntrinsics_device, colorIntrinsics, MAX_CAMERAS * sizeof(Intrinsics), cudaMemcpyHostToDevice));
 
-	kernelIntegrateDepth << <blocks, threads >> > (cameras, localCameras, volume_device, volumeBin_device, world2depth_device, depthIntrinsics_device, depth_device, volumeSize, offset);
+#ifdef SPARSE_VOLUME
+	Transformation depth2world[MAX_CAMERAS];
+	for (int i = 0; i < cameras; i++) {
+		depth2world[i] = world2depth[i].inverse();
+	}
+	HANDLE_ERROR(cudaMemcpy(depth2world_device, depth2world, MAX_CAMERAS * sizeof(Transformation), cudaMemcpyHostToDevice));
+
+	SparseVolume volume = { brickHash, volume_device, volumeBin_device };
+	dim3 brickThreads = dim3(BRICK_SIZE, BRICK_SIZE, BRICK_SIZE);
+	bricks = allocateBricks(cameras, depth_device);
+	if (bricks != 0) {
+		kernelIntegrateBricks << <bricks, brickThreads >> > (cameras, localCameras, brickList_device, volume_device, volumeBin_device, volumeWeight_device, world2depth_device, depthIntrinsics_device, depth_device, volumeSize, offset, maxWeight, decay);
+		HANDLE_ERROR(cudaGetLastError());
+	}
+
+	HANDLE_ERROR(cudaMemset(activeSize_device, 0, sizeof(int)));
+	if (bricks != 0) {
+		kernelClassifyBricks << <bricks, brickThreads >> > (volume, brickList_device, activeSize_device, activeCube_device, activeIndex_device, count_device);
+		HANDLE_ERROR(cudaGetLastError());
+	}
+#else
+	DenseVolume volume = { volume_device, volumeBin_device };
+	kernelIntegrateDepth << <dim3(VOLUME / BLOCK_SIZE, VOLUME / BLOCK_SIZE, VOLUME / INTEGRATE_TILE), threads >> > (cameras, localCameras, volume_device, volumeBin_device, volumeWeight_device, world2depth_device, depthIntrinsics_device, depth_device, volumeSize, offset, maxWeight, decay);
 	HANDLE_ERROR(cudaGetLastError());
 
-	kernelMarchingCubesCount << <blocks, threads >> > (volume_device, count_device);
+	HANDLE_ERROR(cudaMemset(activeSize_device, 0, sizeof(int)));
+	kernelClassifyCubes << <blocks, threads >> > (volume, activeSize_device, activeCube_device, activeIndex_device, count_device);
 	HANDLE_ERROR(cudaGetLastError());
-	triSize = cpu_cudaCountAccumulation();
-	if (triSize * 3 <= MAX_VERTEX) {
-		kernelMarchingCubes << <blocks, threads >> > (cameras, volume_device, volumeBin_device, count_device, vertex_device, triBin_device, volumeSize, offset);
-		HANDLE_ERROR(cudaGetLastError());
+#endif
+	triScan.exclusiveScan(count_device, activeSize_device, triSize_device);
 
-		if (triSize != 0) {
-			kernelColorization << <(triSize + 255) / 256, 256 >> > (cameras, triSize, vertex_device, triBin_device, (uchar4*)color_device, world2depth_device, colorIntrinsics_device);
-			HANDLE_ERROR(cudaGetLastError());
-		}
+	kernelMarchingCubes << <(MAX_ACTIVE_CUBES + 255) / 256, 256 >> > (volume, activeSize_device, triSize_device, activeCube_device, activeIndex_device, count_device, vertex_device, triBin_device, cornerKey_device, volumeSize, offset);
+	HANDLE_ERROR(cudaGetLastError());
+#ifdef INDEXED_MESH
+	indexTriangles(volume, cameras, color_device);
+#else
+	kernelColorization << <(MAX_VERTEX / 3 + 255) / 256, 256 >> > (cameras, activeSize_device, triSize_device, vertex_device, triBin_device, (uchar4*)color_device, world2depth_device, colorIntrinsics_device);
+	HANDLE_ERROR(cudaGetLastError());
+#endif
 
+	// The only synchronization of the frame, the sizes are needed to copy the mesh back.
+	HANDLE_ERROR(cudaMemcpyAsync(meshSize_host + 0, activeSize_device, sizeof(int), cudaMemcpyDeviceToHost));
+	HANDLE_ERROR(cudaMemcpyAsync(meshSize_host + 1, triSize_device, sizeof(int), cudaMemcpyDeviceToHost));
+#ifdef INDEXED_MESH
+	HANDLE_ERROR(cudaMemcpyAsync(meshSize_host + 2, edgeHash.count, sizeof(int), cudaMemcpyDeviceToHost));
+#endif
+	HANDLE_ERROR(cudaStreamSynchronize(0));
+
+	triSize = meshSize_host[1];
+	if (meshSize_host[0] <= MAX_ACTIVE_CUBES && triSize * 3 <= MAX_VERTEX) {
+#ifdef INDEXED_MESH
+		vertexSize = meshSize_host[2];
+		HANDLE_ERROR(cudaMemcpy(vertex, meshVertex_device, vertexSize * sizeof(MeshVertex), cudaMemcpyDeviceToHost));
+		HANDLE_ERROR(cudaMemcpy(vertex + vertexSize, index_device, triSize * 3 * sizeof(UINT32), cudaMemcpyDeviceToHost));
+#else
 		HANDLE_ERROR(cudaMemcpy(vertex, vertex_device, triSize * 3 * sizeof(Vertex), cudaMemcpyDeviceToHost));
+#endif
 	} else {
-		std::cout << "vertex size limit exceeded (size = " << triSize * 3 << ")" << std::endl;
+		std::cout << "vertex size limit exceeded (size = " << max(triSize, meshSize_host[0]) * 3 << ")" << std::endl;
+#ifdef INDEXED_MESH
+		vertexSize = 0;
+		triSize = 0;
+#endif
 	}
 }
+
+#if defined(BENCHMARK) && !defined(SPARSE_VOLUME)
+extern "C"
+void cudaBenchmarkIntegrate(int cameras, float* depth_device, Transformation* world2depth, Intrinsics* depthIntrinsics, int iterations, float& columnTime, float& tileTime, int& mismatches) {
+	const int VOXELS = VOLUME * VOLUME * VOLUME;
+	dim3 threads = dim3(BLOCK_SIZE, BLOCK_SIZE);
+
+	float* reference_device;
+	UINT8* referenceBin_device;
+	HANDLE_ERROR(cudaMalloc(&reference_device, VOXELS * sizeof(float)));
+	HANDLE_ERROR(cudaMalloc(&referenceBin_device, VOXELS * sizeof(UINT8)));
+	HANDLE_ERROR(cudaMemcpy(world2depth_device, world2depth, MAX_CAMERAS * sizeof(Transformation), cudaMemcpyHostToDevice));
+	HANDLE_ERROR(cudaMemcpy(depthIntrinsics_device, depthIntrinsics, MAX_CAMERAS * sizeof(Intrinsics), cudaMemcpyHostToDevice));
+
+	cudaEvent_t start, stop;
+	HANDLE_ERROR(cudaEventCreate(&start));
+	HANDLE_ERROR(cudaEventCreate(&stop));
+
+	HANDLE_ERROR(cudaEventRecord(start));
+	for (int i = 0; i < iterations; i++) {
+		kernelIntegrateDepthColumn << <dim3(VOLUME / BLOCK_SIZE, VOLUME / BLOCK_SIZE), threads >> > (cameras, cameras, reference_device, referenceBin_device, NULL, world2depth_device, depthIntrinsics_device, depth_device, volumeSize, offset, 0, 0);
+	}
+	HANDLE_ERROR(cudaEventRecord(stop));
+	HANDLE_ERROR(cudaEventSynchronize(stop));
+	HANDLE_ERROR(cudaGetLastError());
+	HANDLE_ERROR(cudaEventElapsedTime(&columnTime, start, stop));
+	columnTime /= iterations;
+
+	HANDLE_ERROR(cudaEventRecord(start));
+	for (int i = 0; i < iterations; i++) {
+		kernelIntegrateDepth << <dim3(VOLUME / BLOCK_SIZE, VOLUME / BLOCK_SIZE, VOLUME / INTEGRATE_TILE), threads >> > (cameras, cameras, volume_device, volumeBin_device, NULL, world2depth_device, depthIntrinsics_device, depth_device, volumeSize, offset, 0, 0);
+	}
+	HANDLE_ERROR(cudaEventRecord(stop));
+	HANDLE_ERROR(cudaEventSynchronize(stop));
+	HANDLE_ERROR(cudaGetLastError());
+	HANDLE_ERROR(cudaEventElapsedTime(&tileTime, start, stop));
+	tileTime /= iterations;
+
+	float* volume_host = new float[VOXELS];
+	float* reference_host = new float[VOXELS];
+	UINT8* volumeBin_host = new UINT8[VOXELS];
+	UINT8* referenceBin_host = new UINT8[VOXELS];
+	HANDLE_ERROR(cudaMemcpy(volume_host, volume_device, VOXELS * sizeof(float), cudaMemcpyDeviceToHost));
+	HANDLE_ERROR(cudaMemcpy(reference_host, reference_device, VOXELS * sizeof(float), cudaMemcpyDeviceToHost));
+	HANDLE_ERROR(cudaMemcpy(volumeBin_host, volumeBin_device, VOXELS * sizeof(UINT8), cudaMemcpyDeviceToHost));
+	HANDLE_ERROR(cudaMemcpy(referenceBin_host, referenceBin_device, VOXELS * sizeof(UINT8), cudaMemcpyDeviceToHost));
+	mismatches = 0;
+	for (int i = 0; i < VOXELS; i++) {
+		if (memcmp(volume_host + i, reference_host + i, sizeof(float)) != 0 || volumeBin_host[i] != referenceBin_host[i]) {
+			mismatches++;
+		}
+	}
+
+	delete[] volume_host;
+	delete[] reference_host;
+	delete[] volumeBin_host;
+	delete[] referenceBin_host;
+	HANDLE_ERROR(cudaEventDestroy(start));
+	HANDLE_ERROR(cudaEventDestroy(stop));
+	HANDLE_ERROR(cudaFree(reference_device));
+	HANDLE_ERROR(cudaFree(referenceBin_device));
+}
+#endif
@@ -7,10 +7,26 @@
 #include "Vertex.h"
 #include "TsdfVolume.cuh"
 
+// Mesh returned by integrate: [int triSize][Vertex * triSize * 3],
+// or with INDEXED_MESH [int vertexSize][int triSize][MeshVertex * vertexSize][UINT32 * triSize * 3]
+#ifdef INDEXED_MESH
+#define MESH_BUFFER_SIZE (2 * sizeof(int) + MAX_VERTEX * (sizeof(MeshVertex) + sizeof(UINT32)))
+#else
+#define MESH_BUFFER_SIZE (sizeof(int) + MAX_VERTEX * sizeof(Vertex))
+#endif
+
 class TsdfVolume {
+	float3 minBounds;
+	float3 maxBounds;
 public:
 	TsdfVolume(float sizeX, float sizeY, float sizeZ, float centerX, float centerY, float centerZ);
 	~TsdfVolume();
+	void setTemporalFusion(bool enable, float maxWeight, float decay);
+	// World space box covered by the voxels
+	void getBounds(float3& volumeMin, float3& volumeMax) {
+		volumeMin = minBounds;
+		volumeMax = maxBounds;
+	}
 	void integrate(byte* result, int cameras, int localCameras, float* depth_device, RGBQUAD* color_device, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics);
 	pcl::PointCloud<pcl::PointXYZRGB>::Ptr getPointCloudFromMesh(byte* buffer);
 };
@@ -0,0 +1,407 @@
+#include <Windows.h>
+#include <math.h>
+#include <string.h>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include "Parameters.h"
+#include "Vertex.h"
+#include "TsdfVolume.cuh"
+
+// CPU reference of TsdfVolume.cu. The volume is always dense, also with SPARSE_VOLUME, and stored with z fastest,
+// so integration and classification walk contiguous memory along a column. Columns are distributed over the OpenMP threads.
+namespace tsdfCpu {
+	float3 volumeSize;
+	float3 offset;
+
+	float* volume;
+	UINT8* volumeBin;
+	int* count;
+
+	float* volumeWeight = NULL;
+	float maxWeight;
+	float decay;
+}
+using namespace tsdfCpu;
+
+inline int cpuVid(int x, int y, int z) {
+	return z + (y + x * VOLUME) * VOLUME;
+}
+
+inline UINT32 cpuEdgeKey(int x, int y, int z, int axis) {
+	return ((UINT32)x + ((UINT32)y + (UINT32)z * VOLUME) * VOLUME) * 3 + axis;
+}
+
+extern "C"
+void cpuInitVolume(float sizeX, float sizeY, float sizeZ, float centerX, float centerY, float centerZ) {
+	float3 size = make_float3(sizeX, sizeY, sizeZ);
+	float3 center = make_float3(centerX, centerY, centerZ);
+	volumeSize = size * (1.0 / VOLUME);
+	offset = center - size * 0.5;
+	volume = new float[VOLUME * VOLUME * VOLUME];
+	volumeBin = new UINT8[VOLUME * VOLUME * VOLUME];
+	count = new int[VOLUME * VOLUME + 1];
+}
+
+extern "C"
+void cpuReleaseVolume() {
+	delete[] volume;
+	delete[] volumeBin;
+	delete[] count;
+	if (volumeWeight != NULL) {
+		delete[] volumeWeight;
+		volumeWeight = NULL;
+	}
+}
+
+extern "C"
+void cpuSetTemporalFusion(bool enable, float maxWeight, float decay) {
+	tsdfCpu::maxWeight = maxWeight;
+	tsdfCpu::decay = decay;
+	if (enable && volumeWeight == NULL) {
+		volumeWeight = new float[VOLUME * VOLUME * VOLUME];
+		memset(volumeWeight, 0, VOLUME * VOLUME * VOLUME * sizeof(float));
+	}
+	if (!enable && volumeWeight != NULL) {
+		delete[] volumeWeight;
+		volumeWeight = NULL;
+	}
+}
+
+inline float cpuCalnTsdf(float3 pos, Intrinsics intrinsics, float* depthMap, float trancDist) {
+	float tsdf = -1;
+	int2 pixel = intrinsics.translate(pos);
+
+	if (pos.z > 0 && 0 <= pixel.x && pixel.x < DEPTH_W && 0 <= pixel.y && pixel.y < DEPTH_H) {
+		float depth = depthMap[pixel.y * DEPTH_W + pixel.x];
+
+		if (depth != 0) {
+			float sdf = depth - pos.z;
+
+			if (sdf >= -trancDist) {
+				tsdf = sdf / trancDist;
+			}
+		}
+	}
+	return tsdf;
+}
+
+// Same fusion rules as deviceWriteVoxel.
+inline void cpuWriteVoxel(int id, int cameras, int localCameras, float tsdf, float weight, float remoteTsdf, float remoteWeight, UINT8 bin) {
+	UINT8 localBin = (1 << localCameras) - 1;
+	UINT8 remoteBin = (1 << cameras) - (1 << localCameras);
+	float frameTsdf = -1;
+	UINT8 frameBin = 0;
+	if (bin != 0) {
+		if (remoteWeight == 0) {
+			frameTsdf = tsdf / weight;
+			frameBin = bin;
+		} else {
+			remoteTsdf = remoteTsdf / remoteWeight;
+			if (weight == 0) {
+				frameTsdf = remoteTsdf;
+				frameBin = bin;
+			} else {
+				float localTsdf = tsdf / weight;
+				if (localTsdf < remoteTsdf) {
+					frameTsdf = localTsdf;
+					frameBin = bin & localBin;
+				} else {
+					frameTsdf = remoteTsdf;
+					frameBin = bin & remoteBin;
+				}
+			}
+		}
+	}
+
+	if (volumeWeight == NULL) {
+		volume[id] = frameTsdf;
+		volumeBin[id] = frameBin;
+		return;
+	}
+
+	float w = volumeWeight[id] * decay;
+	if (frameBin != 0) {
+		volume[id] = (w == 0) ? frameTsdf : (volume[id] * w + frameTsdf) / (w + 1);
+		volumeBin[id] = frameBin;
+		volumeWeight[id] = min(w + 1, maxWeight);
+	} else if (w < 1) {
+		volume[id] = -1;
+		volumeBin[id] = 0;
+		volumeWeight[id] = 0;
+	} else {
+		volumeWeight[id] = w;
+	}
+}
+
+void cpuIntegrateDepth(int cameras, int localCameras, float* depth, Transformation* transformation, Intrinsics* intrinsics) {
+	const float TRANC_DIST_M = 3.0 * max(volumeSize.x, max(volumeSize.y, volumeSize.z));
+	float3 deltaZ[MAX_CAMERAS];
+	for (int i = 0; i < cameras; i++) {
+		deltaZ[i] = transformation[i].deltaZ() * volumeSize;
+	}
+
+	#pragma omp parallel for schedule(dynamic)
+	for (int column = 0; column < VOLUME * VOLUME; column++) {
+		int x = column / VOLUME;
+		int y = column % VOLUME;
+		float tsdf[VOLUME];
+		float weight[VOLUME];
+		float remoteTsdf[VOLUME];
+		float remoteWeight[VOLUME];
+		UINT8 bin[VOLUME];
+		memset(tsdf, 0, sizeof(tsdf));
+		memset(weight, 0, sizeof(weight));
+		memset(remoteTsdf, 0, sizeof(remoteTsdf));
+		memset(remoteWeight, 0, sizeof(remoteWeight));
+		memset(bin, 0, sizeof(bin));
+
+		// Cameras in the outer loop keep the per camera state in registers, the sums still add up in camera order
+		for (int i = 0; i < cameras; i++) {
+			float* depthMap = depth + i * DEPTH_H * DEPTH_W;
+			float* tsdfSum = (i < localCameras) ? tsdf : remoteTsdf;
+			float* weightSum = (i < localCameras) ? weight : remoteWeight;
+			float3 pos = transformation[i].translate(make_float3(x, y, -1) * volumeSize + offset);
+
+			for (int z = 0; z < VOLUME; z++) {
+				pos = pos + deltaZ[i];
+				float t = cpuCalnTsdf(pos, intrinsics[i], depthMap, TRANC_DIST_M);
+				if (t != -1) {
+					float w = 1.0 / module(pos);
+					tsdfSum[z] += t * w;
+					weightSum[z] += w;
+					bin[z] |= (1 << i);
+				}
+			}
+		}
+
+		for (int z = 0; z < VOLUME; z++) {
+			cpuWriteVoxel(cpuVid(x, y, z), cameras, localCameras, tsdf[z], weight[z], remoteTsdf[z], remoteWeight[z], bin[z]);
+		}
+	}
+}
+
+// The corners of a cube face in the order of the cube index bits.
+inline void cpuGetCubeFace(int x, int y, int z, float v[4]) {
+	v[0] = volume[cpuVid(x + 0, y + 0, z)];
+	v[1] = volume[cpuVid(x + 1, y + 0, z)];
+	v[2] = volume[cpuVid(x + 1, y + 1, z)];
+	v[3] = volume[cpuVid(x + 0, y + 1, z)];
+}
+
+inline UINT8 cpuCubeIndex(float v0[4], float v1[4]) {
+	for (int i = 0; i < 4; i++) {
+		if (v0[i] == -1 || v1[i] == -1) return 0;
+	}
+	UINT8 index = 0;
+	for (int i = 0; i < 4; i++) {
+		if (v0[i] < 0) index |= (1 << i);
+		if (v1[i] < 0) index |= (16 << i);
+	}
+	return index;
+}
+
+inline float3 cpuCalnEdgePoint(int x, int y, int z, int dx, int dy, int dz) {
+	float v1 = volume[cpuVid(x, y, z)];
+	float v2 = volume[cpuVid(x + dx, y + dy, z + dz)];
+	if ((v1 < 0) ^ (v2 < 0)) {
+		float k = v1 / (v1 - v2);
+		return make_float3(x + k * dx, y + k * dy, z + k * dz);
+	}
+	return float3();
+}
+
+// Triangles per column, scanned into count so that the generation can write in parallel.
+int cpuCountTriangles() {
+	#pragma omp parallel for schedule(dynamic)
+	for (int column = 0; column < VOLUME * VOLUME; column++) {
+		int x = column / VOLUME;
+		int y = column % VOLUME;
+		int cnt = 0;
+		if (x + 1 < VOLUME && y + 1 < VOLUME) {
+			float v0[4], v1[4];
+			cpuGetCubeFace(x, y, 0, v0);
+			for (int z = 0; z + 1 < VOLUME; z++) {
+				cpuGetCubeFace(x, y, z + 1, v1);
+				cnt += triNumber_device[cpuCubeIndex(v0, v1)];
+				memcpy(v0, v1, sizeof(v0));
+			}
+		}
+		count[column] = cnt;
+	}
+
+	int sum = 0;
+	for (int column = 0; column < VOLUME * VOLUME; column++) {
+		int cnt = count[column];
+		count[column] = sum;
+		sum += cnt;
+	}
+	count[VOLUME * VOLUME] = sum;
+	return sum;
+}
+
+// Writes full vertices and triangle bins, or with cornerKey the edge key of every triangle corner.
+void cpuMarchingCubes(Vertex* vertex, UINT8* triBin, UINT32* cornerKey) {
+	#pragma omp parallel for schedule(dynamic)
+	for (int column = 0; column < VOLUME * VOLUME; column++) {
+		int x = column / VOLUME;
+		int y = column % VOLUME;
+		int triId = count[column];
+		if (x + 1 >= VOLUME || y + 1 >= VOLUME || triId == count[column + 1]) {
+			continue;
+		}
+
+		float v0[4], v1[4];
+		cpuGetCubeFace(x, y, 0, v0);
+		for (int z = 0; z + 1 < VOLUME; z++) {
+			cpuGetCubeFace(x, y, z + 1, v1);
+			int cubeId = cpuCubeIndex(v0, v1);
+			memcpy(v0, v1, sizeof(v0));
+			if (triNumber_device[cubeId] == 0) {
+				continue;
+			}
+
+			UINT8 bin = volumeBin[cpuVid(x, y, z)];
+			for (int i = 0; i < 5 && triTable_device[cubeId][i * 3] != -1; i++, triId++) {
+				for (int j = 0; j < 3; j++) {
+					int4 edge = edgeTable_device[triTable_device[cubeId][i * 3 + j]];
+					if (cornerKey != NULL) {
+						cornerKey[triId * 3 + j] = cpuEdgeKey(x + edge.x, y + edge.y, z + edge.z, edge.w);
+					} else {
+						float3 pos = cpuCalnEdgePoint(x + edge.x, y + edge.y, z + edge.z, edge.w == 0, edge.w == 1, edge.w == 2);
+						vertex[triId * 3 + j].pos = pos * volumeSize + offset;
+					}
+				}
+				if (triBin != NULL) {
+					triBin[triId] = bin;
+				}
+			}
+		}
+	}
+}
+
+uchar4 cpuCalnColor(int cameras, UINT8 bin, float3 ori, Transformation* transformation, Intrinsics* intrinsics, uchar4* color, float3 normal) {
+	float4 colorSum = float4();
+	float weight = 0;
+	for (int i = 0; i < cameras; i++) {
+		if ((bin >> i) & 1) {
+			float3 pos = transformation[i].translate(ori);
+			int2 pixel = intrinsics[i].translate(pos);
+			if (pos.z > 0 && 0 <= pixel.x && pixel.x < COLOR_W && 0 <= pixel.y && pixel.y < COLOR_H) {
+				uchar4 tmp = color[(i * COLOR_H + pixel.y) * COLOR_W + pixel.x];
+				if (tmp.x != 0 || tmp.y != 0 || tmp.z != 0) {
+					float w = fminf(fabs(dot(pos, normal)) / module(pos) / module(normal), 1.0f);
+					weight += w;
+					colorSum.x += tmp.x * w;
+					colorSum.y += tmp.y * w;
+					colorSum.z += tmp.z * w;
+				}
+			}
+		}
+	}
+	if (weight == 0) {
+		return uchar4();
+	}
+	return make_uchar4(colorSum.x / weight, colorSum.y / weight, colorSum.z / weight, 0);
+}
+
+#ifdef INDEXED_MESH
+// Merges the corners on the same cube edge in corner order, so the vertex ids are deterministic.
+int cpuIndexTriangles(int cameras, int triSize, MeshVertex* vertex, uchar4* color, Transformation* transformation, Intrinsics* intrinsics) {
+	int corners = triSize * 3;
+	std::vector<UINT32> cornerKey(corners);
+	cpuMarchingCubes(NULL, NULL, cornerKey.data());
+
+	std::unordered_map<UINT32, int> edgeId;
+	std::vector<UINT32> vertexKey;
+	std::vector<UINT32> index(corners);
+	edgeId.reserve(corners);
+	for (int i = 0; i < corners; i++) {
+		auto result = edgeId.insert(std::make_pair(cornerKey[i], (int)vertexKey.size()));
+		if (result.second) {
+			vertexKey.push_back(cornerKey[i]);
+		}
+		index[i] = result.first->second;
+	}
+
+	int vertexSize = vertexKey.size();
+	std::vector<UINT8> vertexBin(vertexSize);
+	std::vector<float3> normal(vertexSize);
+	#pragma omp parallel for
+	for (int id = 0; id < vertexSize; id++) {
+		UINT32 key = vertexKey[id];
+		int axis = key % 3;
+		int vid = key / 3;
+		int x = vid % VOLUME;
+		int y = vid / VOLUME % VOLUME;
+		int z = vid / VOLUME / VOLUME;
+		int dx = (axis == 0);
+		int dy = (axis == 1);
+		int dz = (axis == 2);
+		vertex[id].pos = cpuCalnEdgePoint(x, y, z, dx, dy, dz) * volumeSize + offset;
+		vertexBin[id] = volumeBin[cpuVid(x, y, z)] | volumeBin[cpuVid(x + dx, y + dy, z + dz)];
+		normal[id] = float3();
+	}
+
+	for (int id = 0; id < triSize; id++) {
+		UINT32* v = &index[id * 3];
+		float3 n = multi(vertex[v[1]].pos - vertex[v[0]].pos, vertex[v[2]].pos - vertex[v[0]].pos);
+		for (int j = 0; j < 3; j++) {
+			normal[v[j]] = normal[v[j]] + n;
+		}
+	}
+
+	#pragma omp parallel for
+	for (int id = 0; id < vertexSize; id++) {
+		vertex[id].color = cpuCalnColor(cameras, vertexBin[id], vertex[id].pos, transformation, intrinsics, color, normal[id]);
+	}
+
+	memcpy(vertex + vertexSize, index.data(), corners * sizeof(UINT32));
+	return vertexSize;
+}
+#else
+void cpuColorization(int cameras, int triSize, Vertex* vertex, UINT8* triBin, uchar4* color, Transformation* transformation, Intrinsics* intrinsics) {
+	#pragma omp parallel for
+	for (int id = 0; id < triSize; id++) {
+		float3 pos[6];
+		pos[0] = vertex[id * 3 + 0].pos;
+		pos[1] = vertex[id * 3 + 1].pos;
+		pos[2] = vertex[id * 3 + 2].pos;
+		pos[3] = (pos[0] + pos[1]) * 0.5f;
+		pos[4] = (pos[1] + pos[2]) * 0.5f;
+		pos[5] = (pos[2] + pos[0]) * 0.5f;
+		float3 normal = multi(pos[1] - pos[0], pos[2] - pos[0]);
+		for (int j = 0; j < 3; j++) {
+			vertex[id * 3 + j].color = cpuCalnColor(cameras, triBin[id], pos[j], transformation, intrinsics, color, normal);
+			vertex[id * 3 + j].color2 = cpuCalnColor(cameras, triBin[id], pos[j + 3], transformation, intrinsics, color, normal);
+		}
+	}
+}
+#endif
+
+// Same contract as cudaIntegrate, all buffers are in host memory.
+extern "C"
+#ifdef INDEXED_MESH
+void cpuIntegrate(int cameras, int localCameras, int& vertexSize, int& triSize, MeshVertex* vertex, float* depth, RGBQUAD* color, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics) {
+#else
+void cpuIntegrate(int cameras, int localCameras, int& triSize, Vertex* vertex, float* depth, RGBQUAD* color, Transformation* world2depth, Intrinsics* depthIntrinsics, Intrinsics* colorIntrinsics) {
+#endif
+	cpuIntegrateDepth(cameras, localCameras, depth, world2depth, depthIntrinsics);
+	triSize = cpuCountTriangles();
+
+	if (triSize * 3 <= MAX_VERTEX) {
+#ifdef INDEXED_MESH
+		vertexSize = cpuIndexTriangles(cameras, triSize, vertex, (uchar4*)color, world2depth, colorIntrinsics);
+#else
+		std::vector<UINT8> triBin(triSize);
+		cpuMarchingCubes(vertex, triBin.data(), NULL);
+		cpuColorization(cameras, triSize, vertex, triBin.data(), (uchar4*)color, world2depth, colorIntrinsics);
+#endif
+	} else {
+		std::cout << "vertex size limit exceeded (size = " << triSize * 3 << ")" << std::endl;
+#ifdef INDEXED_MESH
+		vertexSize = 0;
+		triSize = 0;
+#endif
+	}
+}
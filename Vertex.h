@@ -1,4 +1,5 @@
 #ifndef VERTEX_H
+#define VERTEX_H
 
 #include "cuda_runtime.h"
 
@@ -8,4 +9,10 @@ struct Vertex {
 	uchar4 color2;
 };
 
+// Vertex shared by the triangles of an indexed mesh
+struct MeshVertex {
+	float3 pos;
+	uchar4 color;
+};
+
 #endif
@@ -3,13 +3,16 @@
 #include "TsdfVolume.h"
 #include "Transmission.h"
 #include "RealsenseGrabber.h"
+#include "ReplayGrabber.h"
 #include "Parameters.h"
 #include "Configuration.h"
+#include "Benchmark.h"
+#include "Backend.h"
 #include <pcl/visualization/cloud_viewer.h>
 #include <windows.h>
 
 byte* buffer = NULL;
-RealsenseGrabber* grabber = NULL;
+Grabber* grabber = NULL;
 TsdfVolume* volume = NULL;
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud;
 boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer;
@@ -77,24 +80,45 @@ void startViewer() {
 }
 
 void start() {
-	cudaSetDevice(0);
-	omp_set_num_threads(2);
+	Configuration::loadBackend();
+	if (!Backend::isCpu()) {
+		cudaSetDevice(0);
+	}
 
-	grabber = new RealsenseGrabber();
+	std::string sessionFile;
+	bool realTime;
+	if (Configuration::loadReplay(sessionFile, realTime)) {
+		grabber = new ReplayGrabber(sessionFile.c_str(), realTime);
+	} else {
+		grabber = new RealsenseGrabber();
+		if (Configuration::loadRecord(sessionFile)) {
+			grabber->record(sessionFile.c_str());
+		}
+	}
+	Configuration::loadDepthFilter(grabber->getDepthFilter());
 	cloud = pcl::PointCloud<pcl::PointXYZRGB>::Ptr(new pcl::PointCloud<pcl::PointXYZRGB>());
 	volume = new TsdfVolume(2, 2, 2, 0, 0, 0);
-	buffer = new byte[MAX_VERTEX * sizeof(Vertex)];
+	buffer = new byte[MESH_BUFFER_SIZE];
 	world2color = new Transformation[MAX_CAMERAS];
 	world2depth = new Transformation[MAX_CAMERAS];
 	Configuration::loadExtrinsics(world2color);
+	Configuration::loadTemporalFusion(volume);
 
 #if CALIBRATION == false
 	grabber->loadBackground();
 #endif
 
 #ifdef TRANSMISSION
-	int delayFrame = Configuration::loadDelayFrame();
-	transmission = new Transmission(IS_SERVER, delayFrame);
+	bool adaptiveDelay;
+	int delayFrame = Configuration::loadDelayFrame(adaptiveDelay);
+	std::vector<PeerAddress> peers;
+	Configuration::loadPeers(peers);
+	transmission = new Transmission(peers, delayFrame, Configuration::loadStreamFormat());
+	transmission->setAdaptiveDelay(adaptiveDelay);
+	// Both sites fuse into a volume of the same size, so the local one tells which parts of the frames the remote fuses
+	float3 volumeMin, volumeMax;
+	volume->getBounds(volumeMin, volumeMax);
+	transmission->setRegionOfInterest(volumeMin, volumeMax);
 	grabber->setTransmission(transmission);
 #endif
 
@@ -102,26 +126,23 @@ void start() {
 }
 
 void update() {
-	#pragma omp parallel sections
-	{
-		#pragma omp section
-		{
-			int remoteCameras = 0;
-			if (transmission != NULL && transmission->isConnected) {
-				transmission->sendFrame();
-				remoteCameras = transmission->getFrame(depthImages_device + cameras * DEPTH_H * DEPTH_W, colorImages_device + cameras * COLOR_H * COLOR_W, world2depth + cameras, depthIntrinsics + cameras, colorIntrinsics + cameras);
-			}
-
-			volume->integrate(buffer, cameras + remoteCameras, cameras, depthImages_device, colorImages_device, world2depth, depthIntrinsics, colorIntrinsics);
-			cameras = grabber->getRGBD(depthImages_device, colorImages_device, world2depth, world2color, depthIntrinsics, colorIntrinsics);
-		}
-		#pragma omp section
-		{
-			if (transmission != NULL && transmission->isConnected) {
-				transmission->recvFrame();
-			}
+	int remoteCameras = 0;
+	if (transmission != NULL && transmission->isConnected() && transmission->isMeshMode()) {
+		// Each site fuses its own cameras and the remote surface is appended to the local one
+		volume->integrate(buffer, cameras, cameras, depthImages_device, colorImages_device, world2depth, depthIntrinsics, colorIntrinsics);
+		transmission->prepareSendMesh(buffer);
+		transmission->sendFrame();
+		transmission->getMesh(buffer);
+	} else {
+		// The frames are sent and received on the I/O threads of Transmission
+		if (transmission != NULL && transmission->isConnected()) {
+			transmission->sendFrame();
+			remoteCameras = transmission->getFrame(MAX_CAMERAS - cameras, depthImages_device + cameras * DEPTH_H * DEPTH_W, colorImages_device + cameras * COLOR_H * COLOR_W, world2depth + cameras, depthIntrinsics + cameras, colorIntrinsics + cameras);
 		}
+
+		volume->integrate(buffer, cameras + remoteCameras, cameras, depthImages_device, colorImages_device, world2depth, depthIntrinsics, colorIntrinsics);
 	}
+	cameras = grabber->getRGBD(depthImages_device, colorImages_device, world2depth, world2color, depthIntrinsics, colorIntrinsics);
 }
 
 void stop() {
@@ -149,6 +170,10 @@ void stop() {
 #ifdef CREATE_EXE
 
 int main(int argc, char *argv[]) {
+#ifdef BENCHMARK
+	Benchmark::run();
+	return 0;
+#endif
 	start();
 
 	Timer timer;
@@ -190,5 +215,49 @@ extern "C" {
 	__declspec(dllexport) void callStop() {
 		stop();
 	}
+
+	__declspec(dllexport) int callGetPeerCount() {
+		return transmission != NULL ? transmission->getPeerCount() : 0;
+	}
+
+	// False for a peer that does not exist
+	__declspec(dllexport) bool callGetTransmissionStats(int peer, TransmissionStats* stats) {
+		if (transmission == NULL || peer < 0 || peer >= transmission->getPeerCount()) {
+			return false;
+		}
+		transmission->getStats(peer, *stats);
+		return true;
+	}
+
+	// The depth filter stages in the order they run, called between the calls of callUpdate. stages holds
+	// DepthFilter::MAX_STAGES entries, returns how many are in use.
+	__declspec(dllexport) int callGetDepthFilterStages(FilterStage* stages) {
+		return grabber != NULL ? grabber->getDepthFilter()->getStages(stages) : 0;
+	}
+
+	__declspec(dllexport) void callSetDepthFilterStages(int count, FilterStage* stages) {
+		if (grabber != NULL) {
+			grabber->getDepthFilter()->setStages(count, stages);
+		}
+	}
+
+	__declspec(dllexport) void callSetDepthFilterProfiling(bool profiling) {
+		if (grabber != NULL) {
+			grabber->getDepthFilter()->setProfiling(profiling);
+		}
+	}
+
+	// The times in ms of the last frame while profiling, the conversion to disparity, every stage and the conversion
+	// to depth. times holds DepthFilter::MAX_STAGES + 2 entries, returns how many are in use.
+	__declspec(dllexport) int callGetDepthFilterTimes(float* times) {
+		return grabber != NULL ? grabber->getDepthFilter()->getStageTimes(times) : 0;
+	}
+
+	// The guided filter of the depth with the aligned color, radius in pixels up to DepthFilter::MAX_GUIDE_RADIUS
+	__declspec(dllexport) void callSetDepthFilterGuide(bool guided, int radius, float epsilon) {
+		if (grabber != NULL) {
+			grabber->getDepthFilter()->setGuide(guided, radius, epsilon);
+		}
+	}
 }
 #endif